@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio/co_spawn.hpp"
+#include "asio/io_context.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/use_awaitable.hpp"
+#include "cyno/base/Histogram.h"
+#include "cyno/http/HttpClient.h"
+#include "cyno/http/HttpConfig.h"
+
+using namespace std;
+using namespace cyno;
+using Clock = chrono::steady_clock;
+
+// cyno-bench [options] url[@weight]...
+//   -c connections   open connections, spread over the threads (default 16)
+//   -t threads       event loops, one HttpClient each (default 2)
+//   -d seconds       test duration (default 10)
+//   -p depth         requests pipelined per write on a connection (default 1)
+//   -R rate          total requests per second, 0 = as fast as possible (default 0)
+//   -j               print the report as JSON
+//
+// Requests are picked from the urls by weight, e.g. "http://127.0.0.1:8080/@9
+// http://127.0.0.1:8080/users/1@1". Every url must name the same host and port.
+//
+// With -R each connection sends on a fixed schedule, and latency is measured
+// from when a request was due, not when it was sent. A stalled server then
+// shows up in the percentiles instead of silently lowering the request rate
+// (coordinated omission).
+
+struct Options {
+    size_t connections = 16;
+    size_t threads = 2;
+    double duration = 10;
+    size_t depth = 1;
+    double rate = 0;
+    bool json = false;
+    vector<pair<string, size_t>> urls;
+};
+
+struct Target {
+    string host;
+    string service;
+    // serialized requests and their cumulative weights
+    vector<string> requests;
+    vector<size_t> weights;
+};
+
+// what every connection coroutine of a thread adds to
+struct Stats {
+    Histogram latency;      // microseconds
+    atomic<uint64_t> requests = 0;
+    atomic<uint64_t> non_2xx = 0;
+    atomic<uint64_t> errors = 0;
+    atomic<uint64_t> bytes = 0;
+    // connection coroutines still running, only touched by the thread
+    size_t running = 0;
+};
+
+[[noreturn]] static void usage(const char* error) {
+    fprintf(stderr, "cyno-bench: %s\n"
+        "usage: cyno-bench [-c connections] [-t threads] [-d seconds] [-p depth] [-R rate] [-j] url[@weight]...\n", error);
+    exit(2);
+}
+
+static Options parse_options(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "-j") {
+            opts.json = true;
+            continue;
+        }
+        if (arg.size() == 2 && arg[0] == '-') {
+            if (i + 1 == argc) {
+                usage("option needs a value");
+            }
+            double value = atof(argv[++i]);
+            switch (arg[1]) {
+            case 'c': opts.connections = static_cast<size_t>(value); break;
+            case 't': opts.threads = static_cast<size_t>(value); break;
+            case 'd': opts.duration = value; break;
+            case 'p': opts.depth = static_cast<size_t>(value); break;
+            case 'R': opts.rate = value; break;
+            default: usage("unknown option");
+            }
+            continue;
+        }
+
+        size_t weight = 1;
+        if (size_t at = arg.rfind('@'); at != string::npos && arg.find('/', at) == string::npos) {
+            weight = static_cast<size_t>(atoi(arg.c_str() + at + 1));
+            arg.resize(at);
+        }
+        opts.urls.emplace_back(arg, weight);
+    }
+
+    if (opts.urls.empty()) {
+        usage("no url");
+    }
+    if (opts.connections == 0 || opts.threads == 0 || opts.depth == 0 || opts.duration <= 0) {
+        usage("connections, threads, depth and duration must be positive");
+    }
+    opts.threads = min(opts.threads, opts.connections);
+    return opts;
+}
+
+// only "http://host[:port][/path][?query]"
+static Target make_target(const Options& opts) {
+    Target target;
+    size_t total = 0;
+    for (auto& [url, weight] : opts.urls) {
+        string_view rest = url;
+        if (!rest.starts_with("http://")) {
+            usage("only http:// urls are supported");
+        }
+        rest.remove_prefix(7);
+        size_t slash = min(rest.find('/'), rest.length());
+        string_view authority = rest.substr(0, slash);
+        string_view path = slash < rest.length() ? rest.substr(slash) : "/";
+
+        size_t colon = authority.rfind(':');
+        string host(authority.substr(0, colon));
+        string service = colon == string_view::npos ? "80" : string(authority.substr(colon + 1));
+        if (!target.host.empty() && (host != target.host || service != target.service)) {
+            usage("every url must name the same host and port");
+        }
+        target.host = host;
+        target.service = service;
+
+        HttpRequest req = HttpRequest::from_default();
+        req.url = path;
+        req.headers[HttpField::Host] = string(authority);
+        req.headers.erase(HttpField::AcceptEncoding);
+        target.requests.push_back(serialize_request(req));
+        total += weight;
+        target.weights.push_back(total);
+    }
+    if (total == 0) {
+        usage("the weights add up to 0");
+    }
+    return target;
+}
+
+static asio::awaitable<void> run_connection(HttpClient& client, const Target& target, const Options& opts,
+    Stats& stats, Clock::time_point start, Clock::time_point deadline, size_t index)
+{
+    minstd_rand random(static_cast<unsigned>(index + 1));
+    asio::steady_timer timer(co_await asio::this_coro::executor);
+
+    // a batch of depth requests every interval, the connections offset evenly
+    chrono::nanoseconds interval{0};
+    Clock::time_point due = start;
+    if (opts.rate > 0) {
+        interval = chrono::nanoseconds(static_cast<int64_t>(1e9 * opts.connections * opts.depth / opts.rate));
+        due += interval * index / opts.connections;
+    }
+
+    string batch;
+    for (;;) {
+        if (opts.rate > 0) {
+            if (due >= deadline) {
+                break;
+            }
+            timer.expires_at(due);
+            co_await timer.async_wait(asio::use_awaitable);
+        } else if (Clock::now() >= deadline) {
+            break;
+        }
+
+        batch.clear();
+        for (size_t i = 0; i < opts.depth; ++i) {
+            size_t pick = random() % target.weights.back();
+            size_t which = upper_bound(target.weights.begin(), target.weights.end(), pick) - target.weights.begin();
+            batch.append(target.requests[which]);
+        }
+
+        // without a schedule a request is due when it is sent
+        Clock::time_point sent = opts.rate > 0 ? due : Clock::now();
+        bool failed = false;
+        // a pipelined response counts from its arrival, not from the end of the batch
+        auto on_response = [&](HttpResponse&& resp) {
+            auto micros = chrono::duration_cast<chrono::microseconds>(Clock::now() - sent).count();
+            stats.latency.record(static_cast<uint64_t>(micros));
+            stats.bytes.fetch_add(resp.body.size(), memory_order_relaxed);
+            if (resp.status_code < 200 || resp.status_code >= 300) {
+                stats.non_2xx.fetch_add(1, memory_order_relaxed);
+            }
+            stats.requests.fetch_add(1, memory_order_relaxed);
+        };
+        try {
+            if (opts.depth == 1) {
+                on_response(co_await client.request(batch, target.host, target.service));
+            } else {
+                co_await client.pipeline(batch, opts.depth, target.host, target.service, on_response);
+            }
+        } catch(const exception&) {
+            stats.errors.fetch_add(1, memory_order_relaxed);
+            failed = true;
+        }
+        // do not spin on a refused connection
+        if (failed && opts.rate <= 0) {
+            timer.expires_after(chrono::milliseconds(10));
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+        due += interval;
+    }
+}
+
+static string format_duration(uint64_t micros) {
+    char buf[32];
+    if (micros < 1000) {
+        snprintf(buf, sizeof(buf), "%lluus", static_cast<unsigned long long>(micros));
+    } else if (micros < 1000000) {
+        snprintf(buf, sizeof(buf), "%.2fms", micros / 1e3);
+    } else {
+        snprintf(buf, sizeof(buf), "%.2fs", micros / 1e6);
+    }
+    return buf;
+}
+
+int main(int argc, char** argv) {
+    Options opts = parse_options(argc, argv);
+    Target target = make_target(opts);
+
+    // one pooled keep-alive connection per coroutine
+    http_config.connection_pool_config.max_active_size = opts.connections;
+    http_config.connection_pool_config.max_idle_size = opts.connections;
+
+    vector<unique_ptr<asio::io_context>> contexts;
+    vector<unique_ptr<HttpClient>> clients;
+    vector<unique_ptr<Stats>> stats;
+    for (size_t t = 0; t < opts.threads; ++t) {
+        contexts.emplace_back(make_unique<asio::io_context>(1));
+        clients.emplace_back(make_unique<HttpClient>(contexts.back()->get_executor()));
+        stats.emplace_back(make_unique<Stats>());
+    }
+
+    auto start = Clock::now();
+    auto deadline = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(opts.duration));
+    for (size_t i = 0; i < opts.connections; ++i) {
+        size_t t = i % opts.threads;
+        ++stats[t]->running;
+        // the client pools keep cleanup timers, so run() would not return by itself
+        asio::co_spawn(*contexts[t],
+            run_connection(*clients[t], target, opts, *stats[t], start, deadline, i),
+            [&context = *contexts[t], &s = *stats[t]](exception_ptr) {
+                if (--s.running == 0) {
+                    context.stop();
+                }
+            });
+    }
+
+    // a request the server never answers is abandoned a little after the deadline
+    vector<thread> threads;
+    for (auto& context : contexts) {
+        threads.emplace_back([&context, deadline] {
+            asio::steady_timer stopper(*context, deadline + chrono::seconds(2));
+            stopper.async_wait([&context](error_code) { context->stop(); });
+            context->run();
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double elapsed = chrono::duration<double>(min(Clock::now(), deadline) - start).count();
+
+    HistogramSnapshot latency;
+    uint64_t requests = 0;
+    uint64_t non_2xx = 0;
+    uint64_t errors = 0;
+    uint64_t bytes = 0;
+    for (auto& s : stats) {
+        latency.add(s->latency);
+        requests += s->requests;
+        non_2xx += s->non_2xx;
+        errors += s->errors;
+        bytes += s->bytes;
+    }
+
+    static constexpr double quantiles[] = {0.5, 0.75, 0.9, 0.99, 0.999, 0.9999, 1.0};
+    if (opts.json) {
+        printf("{\n  \"connections\": %zu,\n  \"threads\": %zu,\n  \"depth\": %zu,\n  \"target_rate\": %.0f,\n",
+            opts.connections, opts.threads, opts.depth, opts.rate);
+        printf("  \"duration_s\": %.3f,\n  \"requests\": %llu,\n  \"requests_per_sec\": %.1f,\n",
+            elapsed, static_cast<unsigned long long>(requests), requests / elapsed);
+        printf("  \"body_bytes\": %llu,\n  \"non_2xx\": %llu,\n  \"errors\": %llu,\n",
+            static_cast<unsigned long long>(bytes), static_cast<unsigned long long>(non_2xx),
+            static_cast<unsigned long long>(errors));
+        printf("  \"latency_us\": {\"mean\": %.1f", latency.count ? static_cast<double>(latency.sum) / latency.count : 0.0);
+        for (double q : quantiles) {
+            printf(", \"p%g\": %llu", q * 100, static_cast<unsigned long long>(latency.value_at(q)));
+        }
+        printf("}\n}\n");
+        return 0;
+    }
+
+    printf("%.1fs test @ %s:%s, %zu url(s)\n", elapsed, target.host.c_str(), target.service.c_str(), opts.urls.size());
+    printf("  %zu threads and %zu connections, pipeline depth %zu, ", opts.threads, opts.connections, opts.depth);
+    if (opts.rate > 0) {
+        printf("target %.0f req/s\n", opts.rate);
+    } else {
+        printf("unthrottled\n");
+    }
+    printf("  Latency distribution (%s)\n", opts.rate > 0 ? "from the scheduled send time" : "from the actual send time");
+    for (double q : quantiles) {
+        printf("    %8.3f%%  %s\n", q * 100, format_duration(latency.value_at(q)).c_str());
+    }
+    printf("  %llu requests in %.2fs, %.2fMB of bodies read\n",
+        static_cast<unsigned long long>(requests), elapsed, bytes / 1048576.0);
+    if (non_2xx > 0) {
+        printf("  Non-2xx responses: %llu\n", static_cast<unsigned long long>(non_2xx));
+    }
+    if (errors > 0) {
+        printf("  Errors: %llu\n", static_cast<unsigned long long>(errors));
+    }
+    printf("Requests/sec: %.2f\n", requests / elapsed);
+    printf("Transfer/sec: %.2fMB\n", bytes / 1048576.0 / elapsed);
+}
@@ -9,9 +9,12 @@ using namespace cyno;
 
 asio::awaitable<void> amain() {
     try {
-        auto resp = co_await HttpClient::execute("https://www.baidu.com");
-        
-        spdlog::info("{}", resp.body);
+        // the second request reuses the pooled keep-alive connection
+        HttpClient client(co_await asio::this_coro::executor);
+        for (int i = 0; i < 2; ++i) {
+            auto resp = co_await client.request("http://www.baidu.com");
+            spdlog::info("{}", resp.body);
+        }
     } catch(const std::exception& e) {
         spdlog::error("{}", e.what());
     }
@@ -1,10 +1,13 @@
 #include "cyno/http/HttpRouter.h"
 #include "cyno/http/HttpServer.h"
 
-#include "asio/io_context.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/this_coro.hpp"
+#include "asio/use_awaitable.hpp"
 #include "spdlog/spdlog.h"
 
 using namespace std;
+using namespace std::chrono_literals;
 using namespace cyno;
 
 class MyExceptionHandler: public ExceptionHandler {
@@ -23,35 +26,80 @@ public:
 
 class MyInterceptor: public HttpInterceptor {
 public:
-    bool before(HttpRequest& req, HttpResponse& resp) override {
+    bool before(HttpRequestView& req, HttpResponse& resp) override {
         // spdlog::info("before interceptor");
         return true;
     }
 
-    void after(HttpRequest& req, HttpResponse& resp) override {
+    void after(HttpRequestView& req, HttpResponse& resp) override {
         // spdlog::info("after interceptor");
     }
 };
 
+// counts an upload without holding it in memory
+class SizeReader: public HttpBodyReader {
+public:
+    asio::awaitable<void> on_chunk(HttpRequestView& req, string_view chunk) override {
+        size_ += chunk.length();
+        co_return;
+    }
+
+    asio::awaitable<int> on_complete(HttpRequestView& req, HttpResponse& resp) override {
+        co_return resp.plain(to_string(size_));
+    }
+
+private:
+    size_t size_ = 0;
+};
+
 HttpRouter my_router() {
     HttpRouter router;
 
-    router.Get("/", [](HttpRequest& req, HttpResponse& resp) {
+    router.Get("/", [](HttpRequestView& req, HttpResponse& resp) {
         return 200;
     });
 
-    router.Get("/login", [](HttpRequest& req, HttpResponse& resp) {
+    router.Get("/login", [](HttpRequestView& req, HttpResponse& resp) {
         spdlog::info("username: {} password: {}", req.query["username"], req.query["password"]);
 
         return resp.plain("login succeeded");
     });
 
-    router.Post("/info/*", [](HttpRequest& req, HttpResponse& resp) {
+    router.Get("/users/:id", [](HttpRequestView& req, HttpResponse& resp) {
+        return resp.plain(req.params["id"]);
+    });
+    // serve the same bytes for a second without calling the handler
+    router.cache("/users/:id", 1000);
+
+    router.Get("/slow", [](HttpRequestView& req, HttpResponse& resp) -> asio::awaitable<int> {
+        // stands in for a database or upstream call
+        asio::steady_timer timer(co_await asio::this_coro::executor, 100ms);
+        co_await timer.async_wait(asio::use_awaitable);
+
+        co_return resp.plain("done");
+    });
+
+    router.Get("/report", [](HttpRequestView& req, HttpResponseWriter& writer) -> asio::awaitable<void> {
+        writer.response().headers["Content-Type"] = "text/csv";
+        co_await writer.write("id,value\n");
+        for (int i = 0; i < 10000; ++i) {
+            co_await writer.write(to_string(i) + "," + to_string(i * i) + "\n");
+        }
+    });
+
+    router.Post("/info/*", [](HttpRequestView& req, HttpResponse& resp) {
         spdlog::info("{}", req.body);
 
         return 200;
     });
 
+    router.Post("/upload", [](HttpRequestView& req) -> unique_ptr<HttpBodyReader> {
+        return make_unique<SizeReader>();
+    });
+
+    // GET /assets/app.js -> ./public/app.js
+    router.Static("/assets", "./public");
+
     return router;
 }
 
@@ -59,16 +107,15 @@ int main() {
     try {
         spdlog::set_pattern("[%C-%m-%d %H:%M:%S] [%^%l%$] %v");
 
-        asio::io_context ioc;
-
-        HttpServer server(ioc.get_executor());
+        // one event loop per core, see http_config.server_config
+        HttpServer server;
         server.routes(my_router());
         server.add_interceptor(make_unique<MyInterceptor>());
         server.exception_handler(make_unique<MyExceptionHandler>());
+        server.enable_metrics("/metrics");
         server.bind("127.0.0.1", 8080);
         server.start();
-
-        ioc.run();
+        server.join();
     } catch(const exception& e) {
         spdlog::critical("{}", e.what());
     }
@@ -1,6 +1,7 @@
 #ifndef CYNO_EXCEPTIONS_H_
 #define CYNO_EXCEPTIONS_H_
 
+#include <cstdint>
 #include <stdexcept>
 
 namespace cyno {
@@ -59,6 +60,38 @@ public:
     using Base::Base;
 };
 
+class OverloadedError: public CynoRuntimeError {
+    using Base = CynoRuntimeError;
+public:
+    using Base::Base;
+};
+
+// carries the HTTP/2 error code sent in GOAWAY or RST_STREAM
+class Http2Error: public CynoRuntimeError {
+    using Base = CynoRuntimeError;
+public:
+    Http2Error(uint32_t code, const char* what): Base(what), code_(code) {}
+
+    uint32_t code() const {
+        return code_;
+    }
+private:
+    uint32_t code_;
+};
+
+// carries the status code of the WebSocket close frame
+class WebSocketError: public CynoRuntimeError {
+    using Base = CynoRuntimeError;
+public:
+    WebSocketError(uint16_t code, const char* what): Base(what), code_(code) {}
+
+    uint16_t code() const {
+        return code_;
+    }
+private:
+    uint16_t code_;
+};
+
 
 }
 
@@ -0,0 +1,110 @@
+#ifndef CYNO_HISTOGRAM_H_
+#define CYNO_HISTOGRAM_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+
+namespace cyno {
+
+// Log-linear buckets like HdrHistogram: every power of two is split into
+// 8 linear sub-buckets, so a value is known to within 12.5%. record() is
+// wait-free and may run on any thread while another one reads the counts.
+class Histogram {
+public:
+    static constexpr size_t sub_bucket_bits = 3;
+    static constexpr size_t sub_bucket_count = size_t(1) << sub_bucket_bits;
+    // values up to 2^40, e.g. about 12 days in microseconds
+    static constexpr size_t max_bits = 40;
+    static constexpr size_t bucket_count = (max_bits - sub_bucket_bits + 1) * sub_bucket_count;
+
+    static size_t bucket_of(uint64_t value) {
+        value = std::min(value, (uint64_t(1) << max_bits) - 1);
+        if (value < sub_bucket_count) {
+            return static_cast<size_t>(value);
+        }
+        size_t shift = static_cast<size_t>(std::bit_width(value)) - 1 - sub_bucket_bits;
+        return (shift + 1) * sub_bucket_count + static_cast<size_t>(value >> shift) - sub_bucket_count;
+    }
+
+    // the values of bucket i are [lower_bound(i), lower_bound(i + 1))
+    static uint64_t lower_bound(size_t bucket) {
+        if (bucket < sub_bucket_count) {
+            return bucket;
+        }
+        size_t shift = bucket / sub_bucket_count - 1;
+        return (uint64_t(bucket % sub_bucket_count) + sub_bucket_count) << shift;
+    }
+
+    void record(uint64_t value) {
+        counts_[bucket_of(value)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    uint64_t count() const {
+        return count_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t sum() const {
+        return sum_.load(std::memory_order_relaxed);
+    }
+
+    uint64_t count_at(size_t bucket) const {
+        return counts_[bucket].load(std::memory_order_relaxed);
+    }
+
+private:
+    std::array<std::atomic<uint64_t>, bucket_count> counts_{};
+    std::atomic<uint64_t> count_ = 0;
+    std::atomic<uint64_t> sum_ = 0;
+};
+
+// Several histograms added up, e.g. the shards of one metric
+struct HistogramSnapshot {
+    std::array<uint64_t, Histogram::bucket_count> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+
+    // count is taken from the buckets, so it agrees with them during a record()
+    void add(const Histogram& histogram) {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            uint64_t n = histogram.count_at(i);
+            counts[i] += n;
+            count += n;
+        }
+        sum += histogram.sum();
+    }
+
+    // recorded values below limit, bucket by bucket
+    uint64_t count_below(uint64_t limit) const {
+        uint64_t res = 0;
+        for (size_t i = 0; i < counts.size() && Histogram::lower_bound(i) < limit; ++i) {
+            res += counts[i];
+        }
+        return res;
+    }
+
+    // the value at quantile q in [0, 1], the upper end of its bucket
+    uint64_t value_at(double q) const {
+        if (count == 0) {
+            return 0;
+        }
+        // q = 1 is the largest value, not one past it
+        uint64_t rank = std::min(static_cast<uint64_t>(q * count), count - 1);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return Histogram::lower_bound(i + 1) - 1;
+            }
+        }
+        return 0;
+    }
+};
+
+}
+
+#endif
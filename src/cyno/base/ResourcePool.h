@@ -1,107 +1,278 @@
 #ifndef CYNO_RESOURECEPOOL_H_
 #define CYNO_RESOURECEPOOL_H_
 
+#include <array>
+#include <atomic>
+#include <functional>
+#include <list>
 #include <memory>
-#include <memory_resource>
+#include <mutex>
+#include <thread>
 #include "asio/awaitable.hpp"
+#include "asio/co_spawn.hpp"
+#include "asio/post.hpp"
+#include "asio/redirect_error.hpp"
 #include "asio/steady_timer.hpp"
+#include "asio/strand.hpp"
+#include "asio/this_coro.hpp"
 #include "asio/use_awaitable.hpp"
 #include "cyno/base/Exceptions.h"
+#include "cyno/base/MpmcQueue.h"
 #include "cyno/base/configs.h"
 
 namespace cyno {
 
+// Idle items sit in a small cache per thread, then in a lock-free queue.
+// Only an exhausted pool takes a lock: borrowers queue up in FIFO order and
+// each returned item is handed to the first of them at once.
 template<typename T, typename Executor = asio::any_io_executor>
 class ResourcePool {
 public:
-    inline static std::pmr::unsynchronized_pool_resource pool_resource;
-
     using executor_type = Executor;
 
-    struct Item {
-        std::unique_ptr<T> data;
-        std::chrono::steady_clock::time_point time_stamp = std::chrono::steady_clock::now();
-    };
-
     ResourcePool(executor_type executor, PoolConfig config, std::function<T()> init)
         : executor_(executor)
         , config_(config)
         , initializer(std::move(init))
         , timer_(executor_)
-        , idle_list_(&pool_resource)
+        , shard_count_(std::max(1u, std::thread::hardware_concurrency()))
+        , shards_(std::make_unique<Shard[]>(shard_count_))
+        , idle_queue_(std::max<size_t>(config_.max_idle_size, 1))
     {
-        for (size_t i = 0 ; i < config_.core_idle_size; ++i) {
-            idle_list_.push_back({std::make_unique<T>(initializer())});
+        for (size_t i = 0 ; i < config_.core_idle_size && i < config_.max_idle_size; ++i) {
+            idle_queue_.push(new Node{initializer()});
+            ++idle_size_;
         }
-        timer_.expires_after(std::chrono::milliseconds(config_.max_idle_time));
         run_scheduled_cleanup_task();
     }
 
     ResourcePool(ResourcePool &&) = delete;
     ResourcePool& operator=(ResourcePool &&) = delete;
 
+    ~ResourcePool() {
+        Node* node = nullptr;
+        while (idle_queue_.pop(node)) {
+            delete node;
+        }
+        for (size_t i = 0; i < shard_count_; ++i) {
+            for (size_t j = 0; j < shards_[i].size; ++j) {
+                delete shards_[i].items[j];
+            }
+        }
+    }
+
+    // throw ResourceExhaustedError after waiting config.wait_timeout
     asio::awaitable<std::shared_ptr<T>> borrow() {
-        std::unique_lock lk(mutex_);
-        if (active_size_ >= config_.max_active_size) {
-            lk.unlock();
-            asio::steady_timer timer(executor_, 
-                                    std::chrono::milliseconds(config_.wait_timeout));
-            co_await timer.async_wait(asio::use_awaitable);
-            lk.lock();
-
-            if (active_size_ >= config_.max_active_size) {
-                throw ResourceExhaustedError("Pool resource exhausted");
+        Node* node = try_acquire() ? take_node() : co_await wait_node();
+        co_return std::shared_ptr<T>(&node->data, [this, node](T*) { return_node(node); });
+    }
+
+    executor_type get_executor() {
+        return executor_;
+    }
+
+    size_t active_size() const {
+        return active_size_.load(std::memory_order_relaxed);
+    }
+
+    size_t idle_size() const {
+        return idle_size_.load(std::memory_order_relaxed) + cached_size_.load(std::memory_order_relaxed);
+    }
+
+    // borrows that timed out
+    size_t exhausted_count() const {
+        return exhausted_count_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Node {
+        T data;
+        std::chrono::steady_clock::time_point idle_since = std::chrono::steady_clock::now();
+    };
+
+    static constexpr size_t shard_capacity = 8;
+
+    // Threads map onto shards by index. A shard held by another thread is
+    // skipped, never waited for.
+    struct alignas(64) Shard {
+        std::atomic_flag busy = ATOMIC_FLAG_INIT;
+        std::array<Node*, shard_capacity> items;
+        size_t size = 0;
+    };
+
+    // The borrower may run on an executor with several threads. Its wait
+    // starts on the strand the wake-up is posted to, so the two never touch
+    // the timer at the same time.
+    struct Waiter {
+        asio::strand<asio::any_io_executor> strand;
+        asio::steady_timer timer;
+        Node* node = nullptr;
+        typename std::list<std::shared_ptr<Waiter>>::iterator pos;
+
+        explicit Waiter(asio::any_io_executor executor)
+            : strand(asio::make_strand(executor))
+            , timer(strand) 
+        {}
+
+        static asio::awaitable<void> wait(std::shared_ptr<Waiter> waiter) {
+            asio::error_code err;
+            co_await waiter->timer.async_wait(asio::redirect_error(asio::use_awaitable, err));
+        }
+    };
+
+    Shard& local_shard() {
+        static std::atomic<size_t> thread_count = 0;
+        thread_local size_t index = thread_count.fetch_add(1, std::memory_order_relaxed);
+        return shards_[index % shard_count_];
+    }
+
+    bool try_acquire() {
+        size_t active = active_size_.load(std::memory_order_seq_cst);
+        while (active < config_.max_active_size) {
+            if (active_size_.compare_exchange_weak(active, active + 1, std::memory_order_seq_cst)) {
+                return true;
             }
         }
+        return false;
+    }
 
-        ++active_size_;
-        if (idle_list_.empty()) {
-            co_return std::shared_ptr<T>(new T(initializer()), [this](T* elem) { return_item(elem); });
+    Node* take_node() {
+        Shard& shard = local_shard();
+        if (!shard.busy.test_and_set(std::memory_order_acquire)) {
+            Node* node = shard.size > 0 ? shard.items[--shard.size] : nullptr;
+            shard.busy.clear(std::memory_order_release);
+            if (node) {
+                cached_size_.fetch_sub(1, std::memory_order_relaxed);
+                return node;
+            }
         }
 
-        auto item = std::move(idle_list_.front());
-        idle_list_.pop_front();
-        co_return std::shared_ptr<T>(item.data.release(), [this](T* elem) { return_item(elem); });
+        Node* node = nullptr;
+        if (idle_queue_.pop(node)) {
+            idle_size_.fetch_sub(1, std::memory_order_relaxed);
+            return node;
+        }
+        return new Node{initializer()};
     }
 
-    void return_item(T* elem) {
-        std::unique_lock lk(mutex_);
-        --active_size_;
-        if (idle_list_.size() >= config_.max_idle_size) {
-            delete elem;
+    void put_node(Node* node) {
+        node->idle_since = std::chrono::steady_clock::now();
+
+        Shard& shard = local_shard();
+        if (!shard.busy.test_and_set(std::memory_order_acquire)) {
+            bool cached = shard.size < shard.items.size();
+            if (cached) {
+                shard.items[shard.size++] = node;
+                cached_size_.fetch_add(1, std::memory_order_relaxed);
+            }
+            shard.busy.clear(std::memory_order_release);
+            if (cached) {
+                return;
+            }
+        }
+
+        if (idle_size_.fetch_add(1, std::memory_order_relaxed) < config_.max_idle_size
+            && idle_queue_.push(node))
+        {
             return;
         }
+        idle_size_.fetch_sub(1, std::memory_order_relaxed);
+        delete node;
+    }
 
-        idle_list_.push_back({
-            std::unique_ptr<T>(elem), 
-            std::chrono::steady_clock::now() + std::chrono::milliseconds(config_.max_idle_time)
-        });
+    void return_node(Node* node) {
+        put_node(node);
+        // pairs with the waiting_ increment and try_acquire in wait_node
+        active_size_.fetch_sub(1, std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_seq_cst) > 0) {
+            wake_waiters();
+        }
     }
 
-    executor_type get_executor() {
-        return executor_;
+    void wake_waiters() {
+        std::unique_lock lk(waiters_mutex_);
+        for (; !waiters_.empty() && try_acquire();) {
+            auto waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+            waiting_.fetch_sub(1, std::memory_order_seq_cst);
+            waiter->node = take_node();
+
+            // an expiry in the past also wakes a wait that has not started yet
+            asio::post(waiter->strand, [waiter] {
+                waiter->timer.expires_at(std::chrono::steady_clock::time_point::min());
+            });
+        }
+    }
+
+    asio::awaitable<Node*> wait_node() {
+        auto waiter = std::make_shared<Waiter>(co_await asio::this_coro::executor);
+        waiter->timer.expires_after(std::chrono::milliseconds(config_.wait_timeout));
+        {
+            std::unique_lock lk(waiters_mutex_);
+            waiting_.fetch_add(1, std::memory_order_seq_cst);
+            if (try_acquire()) {
+                waiting_.fetch_sub(1, std::memory_order_seq_cst);
+                lk.unlock();
+                co_return take_node();
+            }
+            waiter->pos = waiters_.insert(waiters_.end(), waiter);
+        }
+
+        co_await asio::co_spawn(waiter->strand, Waiter::wait(waiter), asio::use_awaitable);
+
+        std::unique_lock lk(waiters_mutex_);
+        if (waiter->node) {
+            co_return waiter->node;
+        }
+        waiters_.erase(waiter->pos);
+        waiting_.fetch_sub(1, std::memory_order_seq_cst);
+        exhausted_count_.fetch_add(1, std::memory_order_relaxed);
+        throw ResourceExhaustedError("Pool resource exhausted");
+    }
+
+    void evict_cached(Shard& shard, std::chrono::steady_clock::time_point deadline) {
+        if (shard.busy.test_and_set(std::memory_order_acquire)) {
+            return;
+        }
+        size_t kept = 0;
+        for (size_t i = 0; i < shard.size; ++i) {
+            if (shard.items[i]->idle_since <= deadline && idle_size() > config_.core_idle_size) {
+                cached_size_.fetch_sub(1, std::memory_order_relaxed);
+                delete shard.items[i];
+            } else {
+                shard.items[kept++] = shard.items[i];
+            }
+        }
+        shard.size = kept;
+        shard.busy.clear(std::memory_order_release);
     }
-private:
 
     void run_scheduled_cleanup_task() {
+        timer_.expires_after(std::chrono::milliseconds(config_.max_idle_time));
         timer_.async_wait([this](std::error_code err) {
             if (err) {
                 return;
             }
 
-            if (idle_list_.size() > config_.core_idle_size) {
-                std::unique_lock lk(mutex_);
-                for (auto it = idle_list_.begin(); 
-                    it != idle_list_.end() && idle_list_.size() > config_.core_idle_size;) 
-                {
-                    if (it->time_stamp <= std::chrono::steady_clock::now()) {
-                        it = idle_list_.erase(it);
-                    } else {
-                        ++it;
-                    }
+            auto deadline = std::chrono::steady_clock::now() - std::chrono::milliseconds(config_.max_idle_time);
+            for (size_t i = 0; i < shard_count_ && idle_size() > config_.core_idle_size; ++i) {
+                evict_cached(shards_[i], deadline);
+            }
+
+            // the queue is FIFO, so the oldest items come out first
+            for (size_t n = idle_size_.load(); n > 0 && idle_size() > config_.core_idle_size; --n) {
+                Node* node = nullptr;
+                if (!idle_queue_.pop(node)) {
+                    break;
                 }
+                if (node->idle_since > deadline) {
+                    idle_queue_.push(node);
+                    break;
+                }
+                idle_size_.fetch_sub(1, std::memory_order_relaxed);
+                delete node;
             }
-            
+
             run_scheduled_cleanup_task();
         });
     }
@@ -111,14 +282,21 @@ private:
     std::function<T()> initializer;
     asio::steady_timer timer_;
 
-    // idle = idle_list_.size()
-    // active = active_size_
-    // all = idle + active
-    std::pmr::list<Item> idle_list_;
-    size_t active_size_ = 0;
-    std::mutex mutex_;
+    size_t shard_count_;
+    std::unique_ptr<Shard[]> shards_;
+    MpmcQueue<Node*> idle_queue_;
+
+    // all = idle + cached + active
+    std::atomic<size_t> idle_size_ = 0;
+    std::atomic<size_t> cached_size_ = 0;
+    std::atomic<size_t> active_size_ = 0;
+    std::atomic<size_t> exhausted_count_ = 0;
+
+    std::mutex waiters_mutex_;
+    std::list<std::shared_ptr<Waiter>> waiters_;
+    std::atomic<size_t> waiting_ = 0;
 };
 
 }
 
-#endif
\ No newline at end of file
+#endif
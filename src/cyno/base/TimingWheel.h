@@ -0,0 +1,206 @@
+#ifndef CYNO_TIMING_WHEEL_H_
+#define CYNO_TIMING_WHEEL_H_
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include "asio/any_io_executor.hpp"
+#include "asio/steady_timer.hpp"
+
+namespace cyno {
+
+// Coarse deadlines for timers that are mostly cancelled or pushed back before
+// they fire, like connection timeouts. One asio timer ticks while anything is
+// scheduled; schedule and cancel are O(1) list operations on a hierarchical
+// wheel of 256 + 3 * 64 slots, so a 100ms tick covers about 77 days.
+// Callbacks run under the wheel's lock and must not touch the wheel.
+// The wheel must outlive its entries.
+class TimingWheel {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Intrusive node, usually a member of what it times out.
+    // Destroying it cancels it.
+    class Entry {
+    public:
+        explicit Entry(std::function<void()> on_expire): on_expire_(std::move(on_expire)) {}
+
+        Entry(const Entry&) = delete;
+        Entry& operator=(const Entry&) = delete;
+
+        ~Entry() {
+            if (owner_) {
+                owner_->cancel(*this);
+            }
+        }
+
+    private:
+        friend class TimingWheel;
+
+        std::function<void()> on_expire_;
+        TimingWheel* owner_ = nullptr;
+        // guarded by the owner's lock
+        bool linked_ = false;
+        Entry** slot_ = nullptr;
+        Entry* prev_ = nullptr;
+        Entry* next_ = nullptr;
+        uint64_t expires_ = 0;
+    };
+
+    TimingWheel(asio::any_io_executor executor, std::chrono::milliseconds tick)
+        : timer_(executor)
+        , tick_(std::max(tick, std::chrono::milliseconds(1)))
+        , origin_(Clock::now())
+    {}
+
+    TimingWheel(TimingWheel &&) = delete;
+    TimingWheel& operator=(TimingWheel &&) = delete;
+
+    // fires after timeout, rounded up to the tick; reschedules if pending
+    void schedule(Entry& entry, std::chrono::milliseconds timeout) {
+        std::unique_lock lk(mutex_);
+        if (entry.linked_) {
+            unlink(entry);
+        }
+        uint64_t now = now_tick();
+        if (!armed_) {
+            // nothing is scheduled, so no slot is skipped
+            current_ = now;
+            arm();
+        }
+
+        // current_ lags behind while a late tick has not run yet, counting
+        // from it would fire the entry early by that much
+        uint64_t ticks = (timeout + tick_ - std::chrono::milliseconds(1)) / tick_;
+        entry.expires_ = std::max(now, current_) + std::max<uint64_t>(ticks, 1);
+        entry.owner_ = this;
+        entry.linked_ = true;
+        link(entry);
+        ++size_;
+    }
+
+    void cancel(Entry& entry) {
+        std::unique_lock lk(mutex_);
+        if (entry.linked_) {
+            unlink(entry);
+        }
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+private:
+    static constexpr size_t level_count = 4;
+    // slots per level: 256, 64, 64, 64
+    static constexpr std::array<uint64_t, level_count> shifts = {0, 8, 14, 20};
+    static constexpr std::array<uint64_t, level_count> slot_counts = {256, 64, 64, 64};
+
+    uint64_t now_tick() const {
+        return static_cast<uint64_t>((Clock::now() - origin_) / tick_);
+    }
+
+    // the lowest level whose slot for expires_ comes round before it is due
+    void link(Entry& entry) {
+        uint64_t expires = entry.expires_;
+        size_t level = 0;
+        for (; level + 1 < level_count
+            && (expires >> shifts[level]) - (current_ >> shifts[level]) >= slot_counts[level]; ++level);
+        if (level == level_count - 1) {
+            uint64_t max_expires = ((current_ >> shifts[level]) + slot_counts[level] - 1) << shifts[level];
+            expires = std::min(expires, max_expires);
+        }
+
+        Entry*& head = levels_[level][(expires >> shifts[level]) & (slot_counts[level] - 1)];
+        entry.slot_ = &head;
+        entry.prev_ = nullptr;
+        entry.next_ = head;
+        if (head) {
+            head->prev_ = &entry;
+        }
+        head = &entry;
+    }
+
+    void unlink(Entry& entry) {
+        if (entry.prev_) {
+            entry.prev_->next_ = entry.next_;
+        } else {
+            *entry.slot_ = entry.next_;
+        }
+        if (entry.next_) {
+            entry.next_->prev_ = entry.prev_;
+        }
+        entry.prev_ = entry.next_ = nullptr;
+        entry.linked_ = false;
+        --size_;
+    }
+
+    // the entries of a higher slot move down once their block begins
+    void cascade(size_t level) {
+        Entry* entry = std::exchange(levels_[level][(current_ >> shifts[level]) & (slot_counts[level] - 1)], nullptr);
+        for (; entry;) {
+            Entry* next = entry->next_;
+            link(*entry);
+            entry = next;
+        }
+    }
+
+    void advance(uint64_t target) {
+        for (; current_ < target && size_ > 0;) {
+            ++current_;
+
+            // higher levels first, they may refill lower slots due now
+            size_t top = 0;
+            for (; top + 1 < level_count && (current_ & ((uint64_t(1) << shifts[top + 1]) - 1)) == 0; ++top);
+            for (size_t level = top; level > 0; --level) {
+                cascade(level);
+            }
+
+            Entry* entry = std::exchange(levels_[0][current_ & (slot_counts[0] - 1)], nullptr);
+            for (; entry;) {
+                Entry* next = entry->next_;
+                entry->prev_ = entry->next_ = nullptr;
+                entry->linked_ = false;
+                --size_;
+                entry->on_expire_();
+                entry = next;
+            }
+        }
+        current_ = std::max(current_, target);
+    }
+
+    void arm() {
+        armed_ = true;
+        timer_.expires_at(origin_ + tick_ * (current_ + 1));
+        timer_.async_wait([this](std::error_code err) {
+            if (err) {
+                return;
+            }
+            std::unique_lock lk(mutex_);
+            advance(now_tick());
+            if (size_ > 0) {
+                arm();
+            } else {
+                armed_ = false;
+            }
+        });
+    }
+
+    asio::steady_timer timer_;
+    std::chrono::milliseconds tick_;
+    Clock::time_point origin_;
+
+    std::mutex mutex_;
+    bool armed_ = false;
+    uint64_t current_ = 0;
+    size_t size_ = 0;
+    std::array<std::array<Entry*, 256>, level_count> levels_{};
+};
+
+}
+
+#endif
@@ -0,0 +1,145 @@
+#include "cyno/http/DnsCache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include "asio/co_spawn.hpp"
+#include "asio/detached.hpp"
+#include "asio/redirect_error.hpp"
+#include "asio/use_awaitable.hpp"
+
+namespace cyno {
+
+using Clock = std::chrono::steady_clock;
+
+struct DnsEntry {
+    DnsCache::Endpoints endpoints;
+    asio::error_code error;
+    Clock::time_point expires;
+    bool refreshing = false;
+    std::atomic<size_t> next = 0;
+};
+
+// shared with background refreshes, which may outlive the cache
+struct DnsCache::State {
+    DnsConfig config;
+    std::mutex mutex;
+    std::unordered_map<std::string, std::shared_ptr<DnsEntry>> entries;
+
+    void store(const std::string& key, Endpoints endpoints, asio::error_code error) {
+        auto entry = std::make_shared<DnsEntry>();
+        entry->endpoints = std::move(endpoints);
+        entry->error = error;
+        entry->expires = Clock::now() + std::chrono::milliseconds(error ? config.negative_ttl : config.ttl);
+
+        std::unique_lock lk(mutex);
+        if (entries.size() >= config.max_entries && !entries.contains(key)) {
+            auto now = Clock::now();
+            std::erase_if(entries, [now](auto& kv) { return kv.second->expires <= now; });
+            if (entries.size() >= config.max_entries) {
+                entries.erase(entries.begin());
+            }
+        }
+        entries[key] = std::move(entry);
+    }
+};
+
+static std::string make_key(const std::string& host, const std::string& service) {
+    std::string key = host;
+    key.append(":");
+    key.append(service);
+    return key;
+}
+
+static asio::awaitable<std::pair<DnsCache::Endpoints, asio::error_code>> lookup(std::string host, std::string service) {
+    asio::ip::tcp::resolver resolver(co_await asio::this_coro::executor);
+    asio::error_code err;
+    auto results = co_await resolver.async_resolve(host, service, asio::redirect_error(asio::use_awaitable, err));
+
+    DnsCache::Endpoints endpoints;
+    if (!err) {
+        for (auto& res : results) {
+            endpoints.push_back(res.endpoint());
+        }
+        if (endpoints.empty()) {
+            err = asio::error::host_not_found;
+        }
+    }
+    co_return std::make_pair(std::move(endpoints), err);
+}
+
+DnsCache::DnsCache(DnsConfig config)
+    : state_(std::make_shared<State>())
+{
+    state_->config = config;
+}
+
+asio::awaitable<DnsCache::Endpoints> DnsCache::resolve(std::string host, std::string service) {
+    auto key = make_key(host, service);
+    auto now = Clock::now();
+
+    std::shared_ptr<DnsEntry> entry;
+    bool refresh = false;
+    {
+        std::unique_lock lk(state_->mutex);
+        if (auto it = state_->entries.find(key); it != state_->entries.end() && now < it->second->expires) {
+            entry = it->second;
+            auto refresh_at = entry->expires - std::chrono::milliseconds(state_->config.refresh_ahead);
+            if (!entry->error && now >= refresh_at && !entry->refreshing) {
+                entry->refreshing = refresh = true;
+            }
+        }
+    }
+
+    if (refresh) {
+        // parameters, not captures: the lambda is gone once the coroutine first suspends
+        auto task = [](std::shared_ptr<State> state, std::shared_ptr<DnsEntry> entry, std::string key,
+            std::string host, std::string service) -> asio::awaitable<void> 
+        {
+            // a refresh that fails or throws may be tried again by the next resolve()
+            struct RefreshGuard {
+                State& state;
+                DnsEntry& entry;
+
+                ~RefreshGuard() {
+                    std::unique_lock lk(state.mutex);
+                    entry.refreshing = false;
+                }
+            } guard{*state, *entry};
+
+            auto [endpoints, err] = co_await lookup(host, service);
+            if (!err) {
+                state->store(key, std::move(endpoints), err);
+            }
+        };
+        asio::co_spawn(co_await asio::this_coro::executor, task(state_, entry, key, host, service), asio::detached);
+    }
+
+    if (!entry) {
+        // miss, resolve on the request path
+        auto [endpoints, err] = co_await lookup(host, service);
+        state_->store(key, endpoints, err);
+        if (err) {
+            throw std::system_error(err);
+        }
+        co_return endpoints;
+    }
+
+    if (entry->error) {
+        throw std::system_error(entry->error);
+    }
+
+    Endpoints res(entry->endpoints.size());
+    size_t first = entry->next.fetch_add(1, std::memory_order_relaxed) % res.size();
+    std::rotate_copy(entry->endpoints.begin(), entry->endpoints.begin() + first, 
+                    entry->endpoints.end(), res.begin());
+    co_return res;
+}
+
+void DnsCache::forget(const std::string& host, const std::string& service) {
+    std::unique_lock lk(state_->mutex);
+    state_->entries.erase(make_key(host, service));
+}
+
+}
@@ -0,0 +1,34 @@
+#ifndef CYNO_DNS_CACHE_H_
+#define CYNO_DNS_CACHE_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include "asio/awaitable.hpp"
+#include "asio/ip/tcp.hpp"
+#include "cyno/http/HttpConfig.h"
+
+namespace cyno {
+
+// Caches resolver answers for config.ttl and re-resolves them in the
+// background before they expire. Failures are cached for config.negative_ttl.
+// Successive lookups of a name rotate its endpoints (round robin).
+class DnsCache {
+public:
+    using Endpoints = std::vector<asio::ip::tcp::endpoint>;
+
+    explicit DnsCache(DnsConfig config = http_config.dns_config);
+
+    // throw std::system_error
+    asio::awaitable<Endpoints> resolve(std::string host, std::string service);
+    // e.g. after connecting to every cached endpoint failed
+    void forget(const std::string& host, const std::string& service);
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+}
+
+#endif
@@ -0,0 +1,282 @@
+#include "cyno/http/Hpack.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <unordered_map>
+#include "cyno/base/Exceptions.h"
+#include "cyno/http/Http2Session.h"
+
+namespace cyno {
+
+static constexpr std::pair<std::string_view, std::string_view> hpack_static_table[] = {
+    {":authority", ""}, {":method", "GET"}, {":method", "POST"}, {":path", "/"},
+    {":path", "/index.html"}, {":scheme", "http"}, {":scheme", "https"}, {":status", "200"},
+    {":status", "204"}, {":status", "206"}, {":status", "304"}, {":status", "400"},
+    {":status", "404"}, {":status", "500"}, {"accept-charset", ""}, {"accept-encoding", "gzip, deflate"},
+    {"accept-language", ""}, {"accept-ranges", ""}, {"accept", ""}, {"access-control-allow-origin", ""},
+    {"age", ""}, {"allow", ""}, {"authorization", ""}, {"cache-control", ""},
+    {"content-disposition", ""}, {"content-encoding", ""}, {"content-language", ""}, {"content-length", ""},
+    {"content-location", ""}, {"content-range", ""}, {"content-type", ""}, {"cookie", ""},
+    {"date", ""}, {"etag", ""}, {"expect", ""}, {"expires", ""},
+    {"from", ""}, {"host", ""}, {"if-match", ""}, {"if-modified-since", ""},
+    {"if-none-match", ""}, {"if-range", ""}, {"if-unmodified-since", ""}, {"last-modified", ""},
+    {"link", ""}, {"location", ""}, {"max-forwards", ""}, {"proxy-authenticate", ""},
+    {"proxy-authorization", ""}, {"range", ""}, {"referer", ""}, {"refresh", ""},
+    {"retry-after", ""}, {"server", ""}, {"set-cookie", ""}, {"strict-transport-security", ""},
+    {"transfer-encoding", ""}, {"user-agent", ""}, {"vary", ""}, {"via", ""},
+    {"www-authenticate", ""},
+};
+static constexpr size_t hpack_static_size = std::size(hpack_static_table);
+
+// code length of every symbol, 256 is EOS
+static constexpr uint8_t huffman_lengths[257] = {
+    13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+    28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+    6, 10, 10, 12, 13, 6, 8, 11, 10, 10, 8, 11, 8, 6, 6, 6,
+    5, 5, 5, 6, 6, 6, 6, 6, 6, 6, 7, 8, 15, 6, 12, 10,
+    13, 6, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
+    7, 7, 7, 7, 7, 7, 7, 7, 8, 7, 8, 13, 19, 13, 14, 6,
+    15, 5, 6, 5, 6, 5, 6, 6, 6, 5, 7, 7, 6, 6, 6, 5,
+    6, 7, 6, 5, 5, 6, 7, 7, 7, 7, 7, 15, 11, 14, 13, 28,
+    20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+    24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+    22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+    21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+    26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+    19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+    20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+    26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+    30,
+};
+
+// The code is canonical: codes of one length are consecutive, in symbol
+// order, so a code is found from the first code and count of its length.
+struct HuffmanTable {
+    std::array<uint32_t, 31> first_code{};
+    std::array<uint16_t, 31> first_index{};
+    std::array<uint16_t, 31> count{};
+    std::array<uint16_t, 257> symbols{};
+
+    HuffmanTable() {
+        size_t next = 0;
+        for (size_t len = 1; len <= 30; ++len) {
+            first_index[len] = static_cast<uint16_t>(next);
+            for (uint16_t sym = 0; sym < 257; ++sym) {
+                if (huffman_lengths[sym] == len) {
+                    symbols[next++] = sym;
+                }
+            }
+            count[len] = static_cast<uint16_t>(next - first_index[len]);
+        }
+
+        uint32_t code = 0;
+        for (size_t len = 1; len <= 30; ++len) {
+            first_code[len] = code;
+            code = (code + count[len]) << 1;
+        }
+    }
+};
+
+static void huffman_decode(std::string_view data, std::string& out) {
+    static const HuffmanTable table;
+
+    uint32_t code = 0;
+    size_t len = 0;
+    for (unsigned char byte : data) {
+        for (int bit = 7; bit >= 0; --bit) {
+            code = (code << 1) | ((byte >> bit) & 1);
+            ++len;
+            if (code - table.first_code[len] < table.count[len]) {
+                uint16_t sym = table.symbols[table.first_index[len] + code - table.first_code[len]];
+                if (sym == 256) {
+                    throw Http2Error(HTTP2_COMPRESSION_ERROR, "EOS in a Huffman string");
+                }
+                out.push_back(static_cast<char>(sym));
+                code = 0;
+                len = 0;
+            } else if (len == 30) {
+                throw Http2Error(HTTP2_COMPRESSION_ERROR, "Invalid Huffman code");
+            }
+        }
+    }
+    // the padding is the start of EOS, all ones and shorter than a byte
+    if (len > 7 || code != (1u << len) - 1) {
+        throw Http2Error(HTTP2_COMPRESSION_ERROR, "Invalid Huffman padding");
+    }
+}
+
+// integer with an N-bit prefix, pos moves past it
+static uint64_t decode_integer(std::string_view block, size_t& pos, int prefix_bits) {
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    uint64_t value = static_cast<unsigned char>(block[pos++]) & max_prefix;
+    if (value < max_prefix) {
+        return value;
+    }
+    for (int shift = 0; ; shift += 7) {
+        if (pos == block.length() || shift > 28) {
+            throw Http2Error(HTTP2_COMPRESSION_ERROR, "Invalid integer in a header block");
+        }
+        unsigned char byte = static_cast<unsigned char>(block[pos++]);
+        value += static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            return value;
+        }
+    }
+}
+
+// a plain string is returned as a view into block, a Huffman one decoded into buf
+static std::string_view decode_string(std::string_view block, size_t& pos, std::string& buf) {
+    if (pos == block.length()) {
+        throw Http2Error(HTTP2_COMPRESSION_ERROR, "Truncated header block");
+    }
+    bool huffman = block[pos] & 0x80;
+    uint64_t length = decode_integer(block, pos, 7);
+    if (length > block.length() - pos) {
+        throw Http2Error(HTTP2_COMPRESSION_ERROR, "Truncated header block");
+    }
+    std::string_view str = block.substr(pos, length);
+    pos += length;
+    if (!huffman) {
+        return str;
+    }
+    buf.clear();
+    huffman_decode(str, buf);
+    return buf;
+}
+
+void HpackDecoder::decode(std::string_view block, const OnField& on_field) {
+    size_t pos = 0;
+    bool fields_started = false;
+    for (; pos < block.length();) {
+        unsigned char first = static_cast<unsigned char>(block[pos]);
+
+        // indexed field
+        if (first & 0x80) {
+            auto [name, value] = field_at(decode_integer(block, pos, 7));
+            fields_started = true;
+            on_field(name, value);
+            continue;
+        }
+
+        // dynamic table size update, only before the first field
+        if ((first & 0xe0) == 0x20) {
+            uint64_t size = decode_integer(block, pos, 5);
+            if (fields_started || size > max_table_size_) {
+                throw Http2Error(HTTP2_COMPRESSION_ERROR, "Invalid dynamic table size update");
+            }
+            limit_ = size;
+            evict(limit_);
+            continue;
+        }
+
+        // literal, with incremental indexing (01), without (0000) or never indexed (0001)
+        bool indexing = (first & 0xc0) == 0x40;
+        uint64_t name_index = decode_integer(block, pos, indexing ? 6 : 4);
+        std::string_view name = name_index > 0 
+            ? field_at(name_index).first 
+            : decode_string(block, pos, name_buf_);
+        if (name_index > 0 && indexing) {
+            // an entry inserted below may evict the one the name points into
+            name_buf_.assign(name);
+            name = name_buf_;
+        }
+        std::string_view value = decode_string(block, pos, value_buf_);
+        fields_started = true;
+        on_field(name, value);
+        if (indexing) {
+            insert(name, value);
+        }
+    }
+}
+
+std::pair<std::string_view, std::string_view> HpackDecoder::field_at(uint64_t index) const {
+    if (index == 0 || index > hpack_static_size + table_.size()) {
+        throw Http2Error(HTTP2_COMPRESSION_ERROR, "Invalid header table index");
+    }
+    if (index <= hpack_static_size) {
+        return hpack_static_table[index - 1];
+    }
+    auto& entry = table_[index - hpack_static_size - 1];
+    return {entry.first, entry.second};
+}
+
+void HpackDecoder::insert(std::string_view name, std::string_view value) {
+    size_t size = name.length() + value.length() + 32;
+    // a field larger than the table empties it and is not stored
+    evict(size > limit_ ? 0 : limit_ - size);
+    if (size <= limit_) {
+        table_.emplace_front(name, value);
+        size_ += size;
+    }
+}
+
+void HpackDecoder::evict(size_t limit) {
+    for (; size_ > limit;) {
+        auto& entry = table_.back();
+        size_ -= entry.first.length() + entry.second.length() + 32;
+        table_.pop_back();
+    }
+}
+
+static void encode_integer(std::string& out, uint64_t value, int prefix_bits, unsigned char flags) {
+    uint64_t max_prefix = (1u << prefix_bits) - 1;
+    if (value < max_prefix) {
+        out.push_back(static_cast<char>(flags | value));
+        return;
+    }
+    out.push_back(static_cast<char>(flags | max_prefix));
+    value -= max_prefix;
+    for (; value >= 0x80; value >>= 7) {
+        out.push_back(static_cast<char>(0x80 | (value & 0x7f)));
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+static void encode_string(std::string& out, std::string_view str) {
+    encode_integer(out, str.length(), 7, 0);
+    out.append(str);
+}
+
+void hpack_encode(std::string& out, std::string_view name, std::string_view value) {
+    // lowest index of every name in the static table
+    static const auto names = [] {
+        std::unordered_map<std::string_view, size_t> res;
+        for (size_t i = 0; i < hpack_static_size; ++i) {
+            res.emplace(hpack_static_table[i].first, i + 1);
+        }
+        return res;
+    }();
+
+    std::string lower(name);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
+        return static_cast<char>(c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c);
+    });
+
+    // literal without indexing, 4-bit name index
+    if (auto it = names.find(lower); it != names.end()) {
+        encode_integer(out, it->second, 4, 0);
+    } else {
+        out.push_back(0);
+        encode_string(out, lower);
+    }
+    encode_string(out, value);
+}
+
+void hpack_encode_status(std::string& out, int status) {
+    switch (status) {
+    case 200: out.push_back(static_cast<char>(0x80 | 8)); return;
+    case 204: out.push_back(static_cast<char>(0x80 | 9)); return;
+    case 206: out.push_back(static_cast<char>(0x80 | 10)); return;
+    case 304: out.push_back(static_cast<char>(0x80 | 11)); return;
+    case 400: out.push_back(static_cast<char>(0x80 | 12)); return;
+    case 404: out.push_back(static_cast<char>(0x80 | 13)); return;
+    case 500: out.push_back(static_cast<char>(0x80 | 14)); return;
+    }
+    char buf[4] = {};
+    std::snprintf(buf, sizeof(buf), "%03d", status % 1000);
+    encode_integer(out, 8, 4, 0);
+    encode_string(out, std::string_view(buf, 3));
+}
+
+}
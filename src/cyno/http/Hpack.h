@@ -0,0 +1,52 @@
+#ifndef CYNO_HTTP_HPACK_H_
+#define CYNO_HTTP_HPACK_H_
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace cyno {
+
+// HPACK (RFC 7541) header block decoding for one HTTP/2 connection.
+// Keeps the dynamic table between blocks, so every block of the
+// connection must go through the same decoder, in order.
+class HpackDecoder {
+public:
+    // the views are only valid during the call
+    using OnField = std::function<void(std::string_view name, std::string_view value)>;
+
+    // the SETTINGS_HEADER_TABLE_SIZE we announced
+    explicit HpackDecoder(size_t max_table_size = 4096): max_table_size_(max_table_size), limit_(max_table_size) {}
+
+    // throw Http2Error with COMPRESSION_ERROR
+    void decode(std::string_view block, const OnField& on_field);
+
+private:
+    std::pair<std::string_view, std::string_view> field_at(uint64_t index) const;
+    void insert(std::string_view name, std::string_view value);
+    void evict(size_t limit);
+
+    size_t max_table_size_;
+    // set by the encoder with a table size update, at most max_table_size_
+    size_t limit_;
+    size_t size_ = 0;
+    // newest first, index 62 is front()
+    std::deque<std::pair<std::string, std::string>> table_;
+    std::string name_buf_;
+    std::string value_buf_;
+};
+
+// Literal fields without indexing and without Huffman coding, so the peer's
+// table needs no state from us. Names come from the static table if listed
+// and are written in lower case, which HTTP/2 requires.
+void hpack_encode(std::string& out, std::string_view name, std::string_view value);
+
+// ":status", fully indexed for the seven codes in the static table
+void hpack_encode_status(std::string& out, int status);
+
+}
+
+#endif
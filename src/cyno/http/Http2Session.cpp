@@ -0,0 +1,974 @@
+#include "cyno/http/Http2Session.h"
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "spdlog/spdlog.h"
+#include "asio/co_spawn.hpp"
+#include "asio/detached.hpp"
+#include "asio/redirect_error.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/use_awaitable.hpp"
+#include "cyno/http/HttpConfig.h"
+#include "cyno/http/Hpack.h"
+#include "cyno/http/HttpParser.h"
+#include "cyno/http/StaticFiles.h"
+
+namespace cyno {
+
+enum Http2FrameType : uint8_t {
+    HTTP2_DATA = 0x0,
+    HTTP2_HEADERS = 0x1,
+    HTTP2_PRIORITY = 0x2,
+    HTTP2_RST_STREAM = 0x3,
+    HTTP2_SETTINGS = 0x4,
+    HTTP2_PUSH_PROMISE = 0x5,
+    HTTP2_PING = 0x6,
+    HTTP2_GOAWAY = 0x7,
+    HTTP2_WINDOW_UPDATE = 0x8,
+    HTTP2_CONTINUATION = 0x9,
+};
+
+enum Http2Flag : uint8_t {
+    HTTP2_FLAG_END_STREAM = 0x1,
+    HTTP2_FLAG_ACK = 0x1,
+    HTTP2_FLAG_END_HEADERS = 0x4,
+    HTTP2_FLAG_PADDED = 0x8,
+    HTTP2_FLAG_PRIORITY = 0x20,
+};
+
+enum Http2Setting : uint16_t {
+    HTTP2_SETTINGS_HEADER_TABLE_SIZE = 0x1,
+    HTTP2_SETTINGS_ENABLE_PUSH = 0x2,
+    HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+    HTTP2_SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+    HTTP2_SETTINGS_MAX_FRAME_SIZE = 0x5,
+    HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE = 0x6,
+};
+
+static constexpr size_t http2_frame_header_size = 9;
+// the default SETTINGS_MAX_FRAME_SIZE, we never announce more
+static constexpr size_t http2_max_frame_size = 16384;
+static constexpr int64_t http2_max_window = 0x7fffffff;
+static constexpr int64_t http2_default_window = 65535;
+// streams stop queueing DATA while the writer is this far behind
+static constexpr size_t http2_write_high_water = 64 * 1024;
+
+static uint32_t read_uint32(const char* p) {
+    auto u = reinterpret_cast<const unsigned char*>(p);
+    return (uint32_t(u[0]) << 24) | (uint32_t(u[1]) << 16) | (uint32_t(u[2]) << 8) | u[3];
+}
+
+static void append_uint32(std::string& out, uint32_t value) {
+    char bytes[4] = {
+        static_cast<char>(value >> 24), static_cast<char>(value >> 16),
+        static_cast<char>(value >> 8), static_cast<char>(value),
+    };
+    out.append(bytes, 4);
+}
+
+static bool parse_http2_method(std::string_view str, http_method& method) {
+    static const auto methods = [] {
+        std::unordered_map<std::string_view, http_method> res;
+#define XX(num, name, string) res.emplace(#string, HTTP_##name);
+        HTTP_METHOD_MAP(XX)
+#undef XX
+        return res;
+    }();
+
+    auto it = methods.find(str);
+    if (it == methods.end()) {
+        return false;
+    }
+    method = it->second;
+    return true;
+}
+
+// HTTP2-Settings is base64url without padding
+static bool decode_base64url(std::string_view str, std::string& out) {
+    uint32_t bits = 0;
+    int count = 0;
+    for (char c : str) {
+        int value = c >= 'A' && c <= 'Z' ? c - 'A'
+            : c >= 'a' && c <= 'z' ? c - 'a' + 26
+            : c >= '0' && c <= '9' ? c - '0' + 52
+            : c == '-' ? 62
+            : c == '_' ? 63
+            : -1;
+        if (c == '=') {
+            break;
+        }
+        if (value < 0) {
+            return false;
+        }
+        bits = (bits << 6) | static_cast<uint32_t>(value);
+        count += 6;
+        if (count >= 8) {
+            count -= 8;
+            out.push_back(static_cast<char>(bits >> count));
+        }
+    }
+    return true;
+}
+
+// headers that only mean something to the HTTP/1 connection
+static bool connection_specific(std::string_view name) {
+    switch (http_field_of(name)) {
+    case HttpField::Connection:
+    case HttpField::KeepAlive:
+    case HttpField::TransferEncoding:
+    case HttpField::Upgrade:
+    case HttpField::Http2Settings:
+        return true;
+    default:
+        return iequals(name, "proxy-connection");
+    }
+}
+
+struct Http2Stream {
+    uint32_t id = 0;
+    HttpRequestView req;
+    // the url, header names and values req points into
+    std::string fields;
+    // from content-length, npos if absent
+    size_t expected_length = std::string::npos;
+    int64_t send_window = 0;
+    // received but not yet given back with WINDOW_UPDATE
+    size_t unacked = 0;
+    // the request is complete
+    bool end_stream = false;
+    // serve() owns it now and erases it when done
+    bool dispatched = false;
+    // by either side, nothing more is sent on it
+    bool reset = false;
+};
+
+struct Http2Session::Impl {
+    HttpStream& connection;
+    TimingWheel& wheel;
+    Handler handler;
+    asio::any_io_executor executor;
+    // closing the socket fails the pending read
+    TimingWheel::Entry deadline{[this] {
+        asio::error_code err;
+        connection.socket().close(err);
+    }};
+
+    HpackDecoder decoder;
+    std::unordered_map<uint32_t, std::unique_ptr<Http2Stream>> streams;
+    uint32_t last_stream_id = 0;
+    // The last streams we sent RST_STREAM for. The peer may have sent frames
+    // before it saw the reset, they are dropped instead of failing the connection.
+    std::array<uint32_t, 32> reset_ids{};
+    size_t next_reset_id = 0;
+    // the header block being received is decoded, then dropped
+    uint32_t discarding = 0;
+    // stream 1 after upgrade(), served as soon as run() starts
+    std::unique_ptr<Http2Stream> upgraded;
+    // a header block split over HEADERS and CONTINUATION frames
+    uint32_t continuing = 0;
+    bool continuing_end_stream = false;
+    std::string header_block;
+    // name offset, name length, value offset, value length in Http2Stream::fields
+    std::vector<std::array<size_t, 4>> field_offsets;
+
+    // the peer's settings and our send windows
+    size_t peer_max_frame_size = http2_max_frame_size;
+    int64_t peer_initial_window = http2_default_window;
+    int64_t send_window = http2_default_window;
+    // received on the connection but not yet given back
+    size_t unacked = 0;
+
+    // frames queued for the writer, and the ones being written
+    std::string out;
+    std::string writing;
+    // never expires, cancel() wakes every coroutine waiting for a change
+    asio::steady_timer changed;
+    size_t serving = 0;
+    bool goaway_received = false;
+    // nothing more is read, sent or served
+    bool closing = false;
+    bool writer_done = false;
+
+    Impl(HttpStream& s, TimingWheel& w, Handler h)
+        : connection(s)
+        , wheel(w)
+        , handler(std::move(h))
+        , changed(s.socket().get_executor(), asio::steady_timer::time_point::max())
+    {}
+
+    void notify() {
+        changed.cancel();
+    }
+
+    asio::awaitable<void> wait() {
+        asio::error_code err;
+        co_await changed.async_wait(asio::redirect_error(asio::use_awaitable, err));
+    }
+
+    Http2Stream* find(uint32_t id) {
+        auto it = streams.find(id);
+        return it == streams.end() ? nullptr : it->second.get();
+    }
+
+    bool recently_reset(uint32_t id) const {
+        return std::find(reset_ids.begin(), reset_ids.end(), id) != reset_ids.end();
+    }
+
+    void frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+    void send_settings();
+    void send_headers(uint32_t id, std::string_view block, bool end_stream);
+    void send_rst(uint32_t id, uint32_t code);
+    void send_goaway(uint32_t code, std::string_view debug);
+    void reset_stream(Http2Stream& stream, uint32_t code);
+
+    void apply_settings(std::string_view payload);
+    void build_request(Http2Stream& stream);
+    void finish_request(Http2Stream& stream);
+
+    void handle_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload);
+    void on_headers(uint8_t flags, uint32_t id, std::string_view payload);
+    void end_headers(uint32_t id, bool end_stream);
+    void on_data(uint8_t flags, uint32_t id, std::string_view payload);
+    void on_window_update(uint32_t id, std::string_view payload);
+
+    asio::awaitable<void> read_loop(std::string& buffer);
+    asio::awaitable<void> write_loop();
+    asio::awaitable<void> serve(Http2Stream& stream);
+    asio::awaitable<void> send_response(Http2Stream& stream, const HttpResponse& resp);
+};
+
+CLASS_PIMPL_IMPLEMENT(Http2Session)
+
+Http2Session::Http2Session(HttpStream& stream, TimingWheel& wheel, Handler handler) {
+    impl = new Impl(stream, wheel, std::move(handler));
+}
+
+void Http2Session::upgrade(const HttpRequestView& req, std::string_view settings) {
+    std::string payload;
+    if (!decode_base64url(settings, payload) || payload.size() % 6 != 0) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid HTTP2-Settings");
+    }
+    impl->apply_settings(payload);
+
+    // copied, the HTTP/1 buffer is reused
+    auto stream = std::make_unique<Http2Stream>();
+    stream->id = 1;
+    stream->send_window = impl->peer_initial_window;
+    stream->end_stream = true;
+    stream->req.method = req.method;
+    stream->req.body_storage.assign(req.body);
+
+    auto& fields = stream->fields;
+    fields.assign(req.url);
+    impl->field_offsets.clear();
+    for (auto& field : req.headers) {
+        if (connection_specific(field.name)) {
+            continue;
+        }
+        size_t name_at = fields.size();
+        fields.append(field.name);
+        impl->field_offsets.push_back({name_at, field.name.size(), fields.size(), field.value.size()});
+        fields.append(field.value);
+    }
+    stream->req.url = std::string_view(fields).substr(0, req.url.size());
+    for (auto [name_at, name_len, value_at, value_len] : impl->field_offsets) {
+        stream->req.headers.add(std::string_view(fields).substr(name_at, name_len),
+            std::string_view(fields).substr(value_at, value_len));
+    }
+    stream->req.version = "HTTP/2";
+
+    impl->last_stream_id = 1;
+    impl->upgraded = std::move(stream);
+}
+
+asio::awaitable<void> Http2Session::run(std::string_view received) {
+    auto& self = *impl;
+    self.executor = co_await asio::this_coro::executor;
+    asio::co_spawn(self.executor, self.write_loop(), asio::detached);
+    self.send_settings();
+    if (self.upgraded) {
+        auto& stream = *self.upgraded;
+        self.streams.emplace(stream.id, std::move(self.upgraded));
+        self.finish_request(stream);
+    }
+
+    std::string buffer(received);
+    try {
+        co_await self.read_loop(buffer);
+        self.send_goaway(HTTP2_NO_ERROR, {});
+    } catch(const Http2Error& err) {
+        spdlog::warn("HTTP/2 connection error: {}", err.what());
+        self.send_goaway(err.code(), err.what());
+    } catch(const std::system_error&) {
+        // closed by the peer, or timed out
+    }
+    self.wheel.cancel(self.deadline);
+
+    // handlers still running finish first, their streams refer to the session
+    self.closing = true;
+    self.notify();
+    for (; self.serving > 0 || !self.writer_done;) {
+        co_await self.wait();
+    }
+}
+
+void Http2Session::Impl::frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+    char header[http2_frame_header_size] = {
+        static_cast<char>(payload.size() >> 16), static_cast<char>(payload.size() >> 8),
+        static_cast<char>(payload.size()), static_cast<char>(type), static_cast<char>(flags),
+        static_cast<char>(id >> 24), static_cast<char>(id >> 16), static_cast<char>(id >> 8), static_cast<char>(id),
+    };
+    out.append(header, sizeof(header));
+    out.append(payload);
+    notify();
+}
+
+void Http2Session::Impl::send_settings() {
+    const auto& config = http_config.http2_config;
+    std::string payload;
+    auto setting = [&payload](uint16_t key, size_t value) {
+        payload.push_back(static_cast<char>(key >> 8));
+        payload.push_back(static_cast<char>(key));
+        append_uint32(payload, static_cast<uint32_t>(value));
+    };
+    setting(HTTP2_SETTINGS_MAX_CONCURRENT_STREAMS, config.max_concurrent_streams);
+    setting(HTTP2_SETTINGS_INITIAL_WINDOW_SIZE, std::min<size_t>(config.initial_window_size, http2_max_window));
+    setting(HTTP2_SETTINGS_MAX_HEADER_LIST_SIZE, config.max_header_list_size);
+    frame(HTTP2_SETTINGS, 0, 0, payload);
+
+    // the connection window only grows through WINDOW_UPDATE
+    int64_t window = std::min<int64_t>(config.initial_window_size, http2_max_window);
+    if (window > http2_default_window) {
+        payload.clear();
+        append_uint32(payload, static_cast<uint32_t>(window - http2_default_window));
+        frame(HTTP2_WINDOW_UPDATE, 0, 0, payload);
+    }
+}
+
+// split into CONTINUATION frames, queued at once so no other frame comes between
+void Http2Session::Impl::send_headers(uint32_t id, std::string_view block, bool end_stream) {
+    size_t first = std::min(block.size(), peer_max_frame_size);
+    uint8_t flags = (end_stream ? HTTP2_FLAG_END_STREAM : 0) | (first == block.size() ? HTTP2_FLAG_END_HEADERS : 0);
+    frame(HTTP2_HEADERS, flags, id, block.substr(0, first));
+    for (size_t pos = first; pos < block.size();) {
+        size_t n = std::min(block.size() - pos, peer_max_frame_size);
+        frame(HTTP2_CONTINUATION, pos + n == block.size() ? HTTP2_FLAG_END_HEADERS : 0, id, block.substr(pos, n));
+        pos += n;
+    }
+}
+
+void Http2Session::Impl::send_rst(uint32_t id, uint32_t code) {
+    std::string payload;
+    append_uint32(payload, code);
+    frame(HTTP2_RST_STREAM, 0, id, payload);
+    reset_ids[next_reset_id++ % reset_ids.size()] = id;
+}
+
+void Http2Session::Impl::send_goaway(uint32_t code, std::string_view debug) {
+    std::string payload;
+    append_uint32(payload, last_stream_id);
+    append_uint32(payload, code);
+    payload.append(debug);
+    frame(HTTP2_GOAWAY, 0, 0, payload);
+}
+
+void Http2Session::Impl::reset_stream(Http2Stream& stream, uint32_t code) {
+    send_rst(stream.id, code);
+    stream.reset = true;
+    if (!stream.dispatched) {
+        streams.erase(stream.id);
+    }
+}
+
+void Http2Session::Impl::apply_settings(std::string_view payload) {
+    for (size_t pos = 0; pos + 6 <= payload.size(); pos += 6) {
+        uint16_t key = static_cast<uint16_t>((static_cast<unsigned char>(payload[pos]) << 8)
+            | static_cast<unsigned char>(payload[pos + 1]));
+        uint32_t value = read_uint32(payload.data() + pos + 2);
+        switch (key) {
+        case HTTP2_SETTINGS_ENABLE_PUSH:
+            if (value > 1) {
+                throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid SETTINGS_ENABLE_PUSH");
+            }
+            break;
+        case HTTP2_SETTINGS_INITIAL_WINDOW_SIZE: {
+            if (value > http2_max_window) {
+                throw Http2Error(HTTP2_FLOW_CONTROL_ERROR, "Invalid SETTINGS_INITIAL_WINDOW_SIZE");
+            }
+            // applies to the windows of open streams too
+            int64_t delta = static_cast<int64_t>(value) - peer_initial_window;
+            peer_initial_window = value;
+            for (auto& [id, stream] : streams) {
+                stream->send_window += delta;
+                if (stream->send_window > http2_max_window) {
+                    throw Http2Error(HTTP2_FLOW_CONTROL_ERROR, "Stream window overflow");
+                }
+            }
+            break;
+        }
+        case HTTP2_SETTINGS_MAX_FRAME_SIZE:
+            if (value < http2_max_frame_size || value > 0xffffff) {
+                throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid SETTINGS_MAX_FRAME_SIZE");
+            }
+            peer_max_frame_size = value;
+            break;
+        default:
+            // we neither push nor index what we send, the rest does not concern us
+            break;
+        }
+    }
+    notify();
+}
+
+void Http2Session::Impl::handle_frame(uint8_t type, uint8_t flags, uint32_t id, std::string_view payload) {
+    if (continuing && (type != HTTP2_CONTINUATION || id != continuing)) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "Expected a CONTINUATION frame");
+    }
+
+    switch (type) {
+    case HTTP2_DATA:
+        on_data(flags, id, payload);
+        break;
+    case HTTP2_HEADERS:
+        on_headers(flags, id, payload);
+        break;
+    case HTTP2_PRIORITY:
+        // deprecated, streams are served as they come
+        if (id == 0) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "PRIORITY on stream 0");
+        }
+        if (payload.size() != 5) {
+            send_rst(id, HTTP2_FRAME_SIZE_ERROR);
+        }
+        break;
+    case HTTP2_RST_STREAM:
+        if (id == 0 || id > last_stream_id) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "RST_STREAM on an idle stream");
+        }
+        if (payload.size() != 4) {
+            throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Invalid RST_STREAM");
+        }
+        if (auto stream = find(id)) {
+            stream->reset = true;
+            if (!stream->dispatched) {
+                streams.erase(id);
+            }
+            notify();
+        }
+        break;
+    case HTTP2_SETTINGS:
+        if (id != 0) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "SETTINGS on a stream");
+        }
+        if (flags & HTTP2_FLAG_ACK) {
+            if (!payload.empty()) {
+                throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "SETTINGS ACK with a payload");
+            }
+            break;
+        }
+        if (payload.size() % 6 != 0) {
+            throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Invalid SETTINGS");
+        }
+        apply_settings(payload);
+        frame(HTTP2_SETTINGS, HTTP2_FLAG_ACK, 0, {});
+        break;
+    case HTTP2_PUSH_PROMISE:
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "PUSH_PROMISE from a client");
+    case HTTP2_PING:
+        if (id != 0) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "PING on a stream");
+        }
+        if (payload.size() != 8) {
+            throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Invalid PING");
+        }
+        if (!(flags & HTTP2_FLAG_ACK)) {
+            frame(HTTP2_PING, HTTP2_FLAG_ACK, 0, payload);
+        }
+        break;
+    case HTTP2_GOAWAY:
+        if (id != 0) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "GOAWAY on a stream");
+        }
+        // the open streams are still answered
+        goaway_received = true;
+        break;
+    case HTTP2_WINDOW_UPDATE:
+        on_window_update(id, payload);
+        break;
+    case HTTP2_CONTINUATION:
+        if (!continuing) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "Unexpected CONTINUATION");
+        }
+        header_block.append(payload);
+        if (header_block.size() > 2 * http_config.http2_config.max_header_list_size) {
+            throw Http2Error(HTTP2_ENHANCE_YOUR_CALM, "Header block too large");
+        }
+        if (flags & HTTP2_FLAG_END_HEADERS) {
+            continuing = 0;
+            end_headers(id, continuing_end_stream);
+        }
+        break;
+    default:
+        // unknown frame types are ignored
+        break;
+    }
+}
+
+void Http2Session::Impl::on_headers(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id == 0 || id % 2 == 0) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "HEADERS on an invalid stream");
+    }
+    size_t pos = 0;
+    size_t padding = 0;
+    if (flags & HTTP2_FLAG_PADDED) {
+        if (payload.empty()) {
+            throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Invalid HEADERS");
+        }
+        padding = static_cast<unsigned char>(payload[0]);
+        pos = 1;
+    }
+    if (flags & HTTP2_FLAG_PRIORITY) {
+        pos += 5;
+    }
+    if (pos + padding > payload.size()) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid HEADERS padding");
+    }
+
+    // trailers come on an open stream, a new stream needs a higher id
+    if (!find(id)) {
+        if (id > last_stream_id) {
+            last_stream_id = id;
+        } else if (recently_reset(id)) {
+            // sent before the peer saw our RST_STREAM (RFC 9113 section 5.4.2)
+            discarding = id;
+        } else {
+            throw Http2Error(HTTP2_STREAM_CLOSED, "HEADERS on a closed stream");
+        }
+    }
+
+    header_block.assign(payload.substr(pos, payload.size() - pos - padding));
+    continuing_end_stream = flags & HTTP2_FLAG_END_STREAM;
+    if (flags & HTTP2_FLAG_END_HEADERS) {
+        end_headers(id, continuing_end_stream);
+    } else {
+        continuing = id;
+    }
+}
+
+void Http2Session::Impl::end_headers(uint32_t id, bool end_stream) {
+    const auto& config = http_config.http2_config;
+    Http2Stream* stream = find(id);
+    bool trailers = stream != nullptr;
+    bool discard = discarding == id;
+    discarding = 0;
+    std::unique_ptr<Http2Stream> created;
+    if (!trailers && !discard) {
+        created = std::make_unique<Http2Stream>();
+        stream = created.get();
+    }
+
+    // always decoded, the dynamic table has to stay in step with the peer's
+    size_t list_size = 0;
+    field_offsets.clear();
+    decoder.decode(header_block, [&](std::string_view name, std::string_view value) {
+        list_size += name.size() + value.size() + 32;
+        if (trailers || discard || list_size > config.max_header_list_size) {
+            return;
+        }
+        auto& fields = stream->fields;
+        size_t name_at = fields.size();
+        fields.append(name);
+        field_offsets.push_back({name_at, name.size(), fields.size(), value.size()});
+        fields.append(value);
+    });
+    header_block.clear();
+    if (discard) {
+        return;
+    }
+
+    // trailers are not passed on
+    if (trailers) {
+        if (stream->end_stream || !end_stream) {
+            reset_stream(*stream, HTTP2_PROTOCOL_ERROR);
+            return;
+        }
+        stream->end_stream = true;
+        finish_request(*stream);
+        return;
+    }
+
+    if (goaway_received) {
+        return;
+    }
+    if (streams.size() >= config.max_concurrent_streams) {
+        send_rst(id, HTTP2_REFUSED_STREAM);
+        return;
+    }
+    if (list_size > config.max_header_list_size) {
+        send_rst(id, HTTP2_ENHANCE_YOUR_CALM);
+        return;
+    }
+
+    stream->id = id;
+    stream->send_window = peer_initial_window;
+    stream->end_stream = end_stream;
+    try {
+        build_request(*stream);
+    } catch(const Http2Error& err) {
+        send_rst(id, err.code());
+        return;
+    }
+    streams.emplace(id, std::move(created));
+    if (end_stream) {
+        finish_request(*stream);
+    }
+}
+
+// req from the decoded fields, throws Http2Error if it is malformed
+void Http2Session::Impl::build_request(Http2Stream& stream) {
+    std::string_view fields = stream.fields;
+    auto& req = stream.req;
+    bool has_method = false;
+    bool regular = false;
+    std::string_view authority;
+
+    for (auto [name_at, name_len, value_at, value_len] : field_offsets) {
+        std::string_view name = fields.substr(name_at, name_len);
+        std::string_view value = fields.substr(value_at, value_len);
+        // RFC 9113 section 8.2.1
+        if (std::any_of(name.begin(), name.end(), [](char c) { return c >= 'A' && c <= 'Z'; })) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "Upper case header field name");
+        }
+        if (!name.starts_with(':')) {
+            regular = true;
+            // section 8.2.2, TE is only allowed as "trailers"
+            if (connection_specific(name) || (name == "te" && value != "trailers")) {
+                throw Http2Error(HTTP2_PROTOCOL_ERROR, "Connection-specific header field");
+            }
+            if (http_field_of(name) == HttpField::ContentLength) {
+                size_t length = 0;
+                auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+                if (ec != std::errc() || ptr != value.data() + value.size()) {
+                    throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid content-length");
+                }
+                stream.expected_length = length;
+            }
+            req.headers.add(name, value);
+            continue;
+        }
+
+        // pseudo-headers come first
+        if (regular) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "Pseudo-header field after a regular one");
+        }
+        if (name == ":method") {
+            has_method = parse_http2_method(value, req.method);
+            if (!has_method) {
+                throw Http2Error(HTTP2_PROTOCOL_ERROR, "Unknown method");
+            }
+        } else if (name == ":path") {
+            req.url = value;
+        } else if (name == ":authority") {
+            authority = value;
+        } else if (name != ":scheme") {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "Unknown pseudo-header field");
+        }
+    }
+
+    if (!has_method || (req.url.empty() && req.method != HTTP_CONNECT)) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "Missing pseudo-header field");
+    }
+    // handlers look for Host as they do on HTTP/1
+    if (!authority.empty() && !req.headers.contains(HttpField::Host)) {
+        req.headers.add(http_field_name(HttpField::Host), authority);
+    }
+    req.version = "HTTP/2";
+}
+
+void Http2Session::Impl::finish_request(Http2Stream& stream) {
+    auto& req = stream.req;
+    if (stream.expected_length != std::string::npos && stream.expected_length != req.body_storage.size()) {
+        reset_stream(stream, HTTP2_PROTOCOL_ERROR);
+        return;
+    }
+    req.body = req.body_storage;
+    req.content_length = req.body.size();
+
+    stream.dispatched = true;
+    ++serving;
+    asio::co_spawn(executor, serve(stream), asio::detached);
+}
+
+void Http2Session::Impl::on_data(uint8_t flags, uint32_t id, std::string_view payload) {
+    if (id == 0) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "DATA on stream 0");
+    }
+
+    // the whole frame counts against the window, padding included
+    size_t window = std::min<size_t>(http_config.http2_config.initial_window_size, http2_max_window);
+    unacked += payload.size();
+    if (unacked >= window / 2) {
+        std::string inc;
+        append_uint32(inc, static_cast<uint32_t>(unacked));
+        frame(HTTP2_WINDOW_UPDATE, 0, 0, inc);
+        unacked = 0;
+    }
+
+    std::string_view data = payload;
+    if (flags & HTTP2_FLAG_PADDED) {
+        size_t padding = payload.empty() ? 0 : static_cast<unsigned char>(payload[0]);
+        if (payload.empty() || padding >= payload.size()) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid DATA padding");
+        }
+        data = payload.substr(1, payload.size() - 1 - padding);
+    }
+
+    Http2Stream* stream = find(id);
+    if (!stream) {
+        if (id > last_stream_id) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "DATA on an idle stream");
+        }
+        // still in flight when we reset it, it was counted against the window
+        if (!recently_reset(id)) {
+            send_rst(id, HTTP2_STREAM_CLOSED);
+        }
+        return;
+    }
+    if (stream->end_stream) {
+        reset_stream(*stream, HTTP2_STREAM_CLOSED);
+        return;
+    }
+    if (stream->req.body_storage.size() + data.size() > http_config.request_config.max_body_size) {
+        reset_stream(*stream, HTTP2_CANCEL);
+        return;
+    }
+    stream->req.body_storage.append(data);
+
+    if (flags & HTTP2_FLAG_END_STREAM) {
+        stream->end_stream = true;
+        finish_request(*stream);
+        return;
+    }
+    stream->unacked += payload.size();
+    if (stream->unacked >= window / 2) {
+        std::string inc;
+        append_uint32(inc, static_cast<uint32_t>(stream->unacked));
+        frame(HTTP2_WINDOW_UPDATE, 0, id, inc);
+        stream->unacked = 0;
+    }
+}
+
+void Http2Session::Impl::on_window_update(uint32_t id, std::string_view payload) {
+    if (payload.size() != 4) {
+        throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Invalid WINDOW_UPDATE");
+    }
+    uint32_t increment = read_uint32(payload.data()) & 0x7fffffff;
+
+    if (id == 0) {
+        if (increment == 0) {
+            throw Http2Error(HTTP2_PROTOCOL_ERROR, "WINDOW_UPDATE of 0");
+        }
+        send_window += increment;
+        if (send_window > http2_max_window) {
+            throw Http2Error(HTTP2_FLOW_CONTROL_ERROR, "Connection window overflow");
+        }
+        notify();
+        return;
+    }
+
+    if (id > last_stream_id) {
+        throw Http2Error(HTTP2_PROTOCOL_ERROR, "WINDOW_UPDATE on an idle stream");
+    }
+    Http2Stream* stream = find(id);
+    if (!stream || stream->reset) {
+        return;
+    }
+    if (increment == 0) {
+        reset_stream(*stream, HTTP2_PROTOCOL_ERROR);
+        return;
+    }
+    stream->send_window += increment;
+    if (stream->send_window > http2_max_window) {
+        reset_stream(*stream, HTTP2_FLOW_CONTROL_ERROR);
+        return;
+    }
+    notify();
+}
+
+asio::awaitable<void> Http2Session::Impl::read_loop(std::string& buffer) {
+    const auto& config = http_config.request_config;
+    bool preface = false;
+    size_t begin = 0;
+
+    for (;;) {
+        if (!preface && buffer.size() >= http2_preface.size()) {
+            if (!std::string_view(buffer).starts_with(http2_preface)) {
+                throw Http2Error(HTTP2_PROTOCOL_ERROR, "Invalid connection preface");
+            }
+            preface = true;
+            begin = http2_preface.size();
+        }
+
+        // every complete frame in the buffer
+        for (; preface && buffer.size() - begin >= http2_frame_header_size;) {
+            auto p = reinterpret_cast<const unsigned char*>(buffer.data() + begin);
+            size_t length = (size_t(p[0]) << 16) | (size_t(p[1]) << 8) | p[2];
+            if (length > http2_max_frame_size) {
+                throw Http2Error(HTTP2_FRAME_SIZE_ERROR, "Frame larger than SETTINGS_MAX_FRAME_SIZE");
+            }
+            if (buffer.size() - begin - http2_frame_header_size < length) {
+                break;
+            }
+            const char* frame_at = buffer.data() + begin;
+            handle_frame(p[3], p[4], read_uint32(frame_at + 5) & 0x7fffffff,
+                std::string_view(frame_at + http2_frame_header_size, length));
+            begin += http2_frame_header_size + length;
+        }
+        if (closing || (goaway_received && streams.empty())) {
+            co_return;
+        }
+        buffer.erase(0, begin);
+        begin = 0;
+
+        // Idle, or a request body on its way. While every open stream is
+        // with its handler nothing is expected, as on HTTP/1.
+        bool receiving = std::any_of(streams.begin(), streams.end(), [](auto& entry) {
+            return !entry.second->end_stream;
+        });
+        if (streams.empty() || receiving) {
+            size_t timeout = streams.empty() ? config.keepalive_timeout : config.receive_body_timeout;
+            wheel.schedule(deadline, std::chrono::milliseconds(timeout));
+        }
+
+        size_t used = buffer.size();
+        buffer.resize(used + http2_max_frame_size + http2_frame_header_size);
+        size_t read_len = co_await connection.read_some(asio::buffer(buffer.data() + used, buffer.size() - used));
+        wheel.cancel(deadline);
+        buffer.resize(used + read_len);
+    }
+}
+
+asio::awaitable<void> Http2Session::Impl::write_loop() {
+    try {
+        for (;;) {
+            if (out.empty()) {
+                if (closing) {
+                    break;
+                }
+                co_await wait();
+                continue;
+            }
+            // frames queued meanwhile go out with the next write
+            std::swap(out, writing);
+            co_await connection.write(asio::buffer(writing));
+            writing.clear();
+            notify();
+        }
+    } catch(const std::system_error&) {
+        closing = true;
+        asio::error_code err;
+        connection.socket().close(err);
+    }
+    writer_done = true;
+    notify();
+}
+
+asio::awaitable<void> Http2Session::Impl::serve(Http2Stream& stream) {
+    HttpResponse resp = HttpResponse::from_default();
+    bool handled = false;
+    try {
+        co_await handler(stream.req, resp);
+        handled = true;
+    } catch(const std::exception& err) {
+        spdlog::error("HTTP/2 stream {} failed: {}", stream.id, err.what());
+    }
+
+    if (handled) {
+        try {
+            co_await send_response(stream, resp);
+        } catch(const std::exception& err) {
+            spdlog::error("HTTP/2 stream {} failed: {}", stream.id, err.what());
+            handled = false;
+        }
+    }
+    if (!handled && !stream.reset && !closing) {
+        send_rst(stream.id, HTTP2_INTERNAL_ERROR);
+    }
+
+    streams.erase(stream.id);
+    --serving;
+    notify();
+    // the last stream after a GOAWAY, the read loop is done
+    if (goaway_received && streams.empty()) {
+        asio::error_code err;
+        connection.socket().cancel(err);
+    }
+}
+
+asio::awaitable<void> Http2Session::Impl::send_response(Http2Stream& stream, const HttpResponse& resp) {
+    // a pre-serialized response, e.g. from the cache, is taken apart again
+    HttpResponse parsed;
+    const HttpResponse* source = &resp;
+    if (resp.raw) {
+        HttpParser<HttpResponse> parser;
+        parser.parse(*resp.raw);
+        parsed = std::move(parser.result());
+        source = &parsed;
+    }
+
+    std::string block;
+    hpack_encode_status(block, source->status_code);
+    for (auto& field : source->headers) {
+        if (!connection_specific(field.name)) {
+            hpack_encode(block, field.name, field.value);
+        }
+    }
+
+    size_t length = stream.req.method == HTTP_HEAD ? 0
+        : source->file ? source->file->length
+        : source->body.size();
+    if (closing || stream.reset) {
+        co_return;
+    }
+    send_headers(stream.id, block, length == 0);
+
+    std::string chunk;
+    for (size_t sent = 0; sent < length;) {
+        for (; !closing && !stream.reset
+            && (send_window <= 0 || stream.send_window <= 0 || out.size() >= http2_write_high_water);)
+        {
+            co_await wait();
+        }
+        if (closing || stream.reset) {
+            co_return;
+        }
+
+        size_t n = std::min({length - sent, peer_max_frame_size,
+            static_cast<size_t>(send_window), static_cast<size_t>(stream.send_window)});
+        std::string_view data;
+        if (source->file) {
+            chunk.resize(n);
+            n = read_file_at(source->file->fd, chunk.data(), n, source->file->offset + sent);
+            if (n == 0) {
+                // truncated after the headers went out
+                throw std::system_error(EIO, std::system_category(), "read_file_at");
+            }
+            data = std::string_view(chunk.data(), n);
+        } else {
+            data = std::string_view(source->body).substr(sent, n);
+        }
+
+        frame(HTTP2_DATA, sent + n == length ? HTTP2_FLAG_END_STREAM : 0, stream.id, data);
+        send_window -= static_cast<int64_t>(n);
+        stream.send_window -= static_cast<int64_t>(n);
+        sent += n;
+    }
+}
+
+}
@@ -0,0 +1,65 @@
+#ifndef CYNO_HTTP2_SESSION_H_
+#define CYNO_HTTP2_SESSION_H_
+
+#include <cstdint>
+#include <functional>
+#include <string_view>
+#include "asio/awaitable.hpp"
+#include "cyno/base/Pimpl.h"
+#include "cyno/base/TimingWheel.h"
+#include "cyno/http/HttpMessage.h"
+#include "cyno/http/HttpStream.h"
+
+namespace cyno {
+
+// what every HTTP/2 connection starts with
+inline constexpr std::string_view http2_preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+// RFC 9113 section 7
+enum Http2ErrorCode : uint32_t {
+    HTTP2_NO_ERROR = 0x0,
+    HTTP2_PROTOCOL_ERROR = 0x1,
+    HTTP2_INTERNAL_ERROR = 0x2,
+    HTTP2_FLOW_CONTROL_ERROR = 0x3,
+    HTTP2_SETTINGS_TIMEOUT = 0x4,
+    HTTP2_STREAM_CLOSED = 0x5,
+    HTTP2_FRAME_SIZE_ERROR = 0x6,
+    HTTP2_REFUSED_STREAM = 0x7,
+    HTTP2_CANCEL = 0x8,
+    HTTP2_COMPRESSION_ERROR = 0x9,
+    HTTP2_CONNECT_ERROR = 0xa,
+    HTTP2_ENHANCE_YOUR_CALM = 0xb,
+    HTTP2_INADEQUATE_SECURITY = 0xc,
+    HTTP2_HTTP_1_1_REQUIRED = 0xd,
+};
+
+// One HTTP/2 connection, cleartext (h2c) or after ALPN chose "h2". Every
+// stream is served by its own coroutine, so a slow handler holds up only its
+// stream. Responses go out as the peer's flow control windows allow, through
+// one writer that coalesces the frames of all streams. Must run on a strand.
+class Http2Session {
+
+    CLASS_PIMPL_DECLARE(Http2Session)
+
+public:
+    // Fills resp the way an HTTP/1 dispatch would. The request views stay
+    // valid until it returns; throwing resets the stream.
+    using Handler = std::function<asio::awaitable<void>(HttpRequestView&, HttpResponse&)>;
+
+    // Timeouts and the body limit come from http_config.request_config.
+    // The stream and the wheel must outlive the session.
+    Http2Session(HttpStream& stream, TimingWheel& wheel, Handler handler);
+
+    // After a 101 to "Upgrade: h2c": req becomes stream 1, half closed,
+    // and settings is its HTTP2-Settings header
+    // throw Http2Error
+    void upgrade(const HttpRequestView& req, std::string_view settings);
+
+    // received is what was read but not consumed, the client preface first.
+    // Returns once the connection is done, errors are answered with GOAWAY.
+    asio::awaitable<void> run(std::string_view received);
+};
+
+}
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef CYNO_HTTP_BODY_READER_H_
+#define CYNO_HTTP_BODY_READER_H_
+
+#include "asio/awaitable.hpp"
+#include "cyno/http/HttpMessage.h"
+
+namespace cyno {
+
+// Interface
+// Receives a request body piece by piece as it arrives. The connection is
+// not read while on_chunk runs, so a slow reader slows the sender down.
+class HttpBodyReader {
+public:
+    // chunk points into the connection buffer and is only valid during the call
+    virtual asio::awaitable<void> on_chunk(HttpRequestView& req, std::string_view chunk) = 0;
+    virtual asio::awaitable<int> on_complete(HttpRequestView& req, HttpResponse& resp) = 0;
+    virtual ~HttpBodyReader() = default;
+};
+
+}
+
+#endif
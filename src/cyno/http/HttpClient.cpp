@@ -1,23 +1,52 @@
 #include "cyno/http/HttpClient.h"
 
-#include <iostream>
+#include <mutex>
+#include <unordered_map>
 #include "asio/ip/address_v6.hpp"
 #include "asio/ip/tcp.hpp"
-#include "asio/write.hpp"
 #include "asio/connect.hpp"
+#include "asio/redirect_error.hpp"
 #include "asio/use_awaitable.hpp"
 
+#include "cyno/base/ResourcePool.h"
+#include "cyno/http/DnsCache.h"
+#include "cyno/http/HttpConfig.h"
 #include "cyno/http/HttpParser.h"
+#include "cyno/http/HttpStream.h"
 
 namespace cyno {
 
+struct ClientConnection {
+    HttpStream stream;
+    std::string buffer;
+};
+
 struct HttpClient::Impl {
+    asio::any_io_executor executor;
 
+    // "scheme://host:service" -> idle keep-alive connections, with TLS
+    // still set up, so a reused connection skips the handshake
+    std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<ResourcePool<ClientConnection>>> pools;
+
+    ResourcePool<ClientConnection>& pool_of(const std::string& host, const std::string& service, bool tls);
+    // req_str holds count requests, their responses go to on_response in order
+    template<typename OnResponse>
+    asio::awaitable<void> send(std::string_view req_str, size_t count, 
+        const std::string& host, const std::string& service, bool tls, OnResponse on_response);
 };
 
 CLASS_PIMPL_IMPLEMENT(HttpClient)
 
-asio::awaitable<HttpResponse> HttpClient::execute(std::string url) {
+struct HttpTarget {
+    HttpRequest req;
+    std::string host;
+    std::string service;
+    bool tls = false;
+};
+
+// throw IllegalUrlError
+static HttpTarget parse_url(std::string_view url) {
     http_parser_url parser;
     http_parser_url_init(&parser);
 
@@ -26,9 +55,9 @@ asio::awaitable<HttpResponse> HttpClient::execute(std::string url) {
         throw IllegalUrlError("Illegal url");
     }
 
-    auto req = HttpRequest::from_default();
+    HttpTarget target{HttpRequest::from_default()};
+    auto& req = target.req;
     std::string schema;
-    std::string host;
     unsigned port = 0;
 
     if (parser.field_set & (1 << UF_SCHEMA)) {
@@ -36,10 +65,16 @@ asio::awaitable<HttpResponse> HttpClient::execute(std::string url) {
     } else {
         throw IllegalUrlError("Url missing schema");
     }
+    target.tls = schema == "https";
+#ifndef CYNO_ENABLE_SSL
+    if (target.tls) {
+        throw IllegalUrlError("https needs a build with CYNO_ENABLE_SSL");
+    }
+#endif
 
     if (parser.field_set & (1 << UF_HOST)) {
-        host.assign(url.data() + parser.field_data[UF_HOST].off, parser.field_data[UF_HOST].len);
-        req.headers["Host"] = host;
+        target.host.assign(url.data() + parser.field_data[UF_HOST].off, parser.field_data[UF_HOST].len);
+        req.headers[HttpField::Host] = target.host;
     } else {
         throw IllegalUrlError("Url missing host");
     }
@@ -57,34 +92,224 @@ asio::awaitable<HttpResponse> HttpClient::execute(std::string url) {
         port = parser.port;
     }
 
-    std::string service = port != 0 ? std::to_string(port) : schema;
+    target.service = port != 0 ? std::to_string(port) : schema;
+    return target;
+}
+
+// An idle keep-alive connection has nothing to read. EOF means the server
+// closed it, and unexpected data means it is out of sync.
+static bool is_reusable(asio::ip::tcp::socket& socket) {
+    if (!socket.is_open()) {
+        return false;
+    }
 
-    return execute(req, std::move(host), std::move(service));
+    asio::error_code err;
+    char c;
+    socket.non_blocking(true, err);
+    socket.receive(asio::buffer(&c, 1), asio::socket_base::message_peek, err);
+    bool idle = err == asio::error::would_block;
+    socket.non_blocking(false, err);
+    return idle;
 }
 
-asio::awaitable<HttpResponse> HttpClient::execute(const HttpRequest& req, std::string host, std::string service) {
-    return execute(serialize_request(req), std::move(host), std::move(service));
+// shared by every client and the static execute()
+static DnsCache& dns_cache() {
+    static DnsCache cache;
+    return cache;
 }
 
-asio::awaitable<HttpResponse> HttpClient::execute(std::string req_str, std::string host, std::string service) {
-    auto executor = co_await asio::this_coro::executor;
-    asio::ip::tcp::resolver resolver(executor);
-    auto eps = co_await resolver.async_resolve(host, service, asio::use_awaitable);
+// the service "https" without a url means TLS too
+static bool is_tls_service(const std::string& service) {
+    return service == "https";
+}
+
+static asio::awaitable<void> connect(HttpStream& stream, const std::string& host, const std::string& service, bool tls) {
+    auto eps = co_await dns_cache().resolve(host, service);
+
+    asio::error_code err;
+    stream.close();
+    co_await asio::async_connect(stream.socket(), eps, asio::redirect_error(asio::use_awaitable, err));
+    if (err) {
+        // the cached addresses may be stale
+        dns_cache().forget(host, service);
+        throw std::system_error(err);
+    }
 
-    asio::ip::tcp::socket socket(executor);
-    co_await asio::async_connect(socket, eps, asio::use_awaitable);
-    co_await asio::async_write(socket, asio::buffer(req_str), asio::use_awaitable);
+    if (tls) {
+#ifdef CYNO_ENABLE_SSL
+        // a session from an earlier connection to host:service makes it an abbreviated handshake
+        co_await stream.connect_tls(client_tls_context(), host, host + ":" + service);
+#else
+        throw IllegalUrlError("https needs a build with CYNO_ENABLE_SSL");
+#endif
+    }
+}
+
+// Writes req_str and reads count responses, several may come in one read.
+// received counts the response bytes, so a caller can tell whether the
+// server saw the request at all
+template<typename OnResponse>
+static asio::awaitable<void> exchange(ClientConnection& conn, std::string_view req_str, size_t count, 
+    size_t& received, OnResponse& on_response) 
+{
+    co_await conn.stream.write(asio::buffer(req_str));
 
     HttpParser<HttpResponse> response_parser;
-    std::string buffer(4 * 1024, 0);
+    conn.buffer.resize(4 * 1024);
+
+    // [begin, end) was read but not parsed yet
+    size_t begin = 0;
+    size_t end = 0;
+    for (; count > 0;) {
+        if (begin == end) {
+            end = co_await conn.stream.read_some(asio::buffer(conn.buffer));
+            begin = 0;
+            received += end;
+        }
+        begin += response_parser.parse({conn.buffer.data() + begin, end - begin});
 
-    for (; response_parser.state() != HttpParser<HttpResponse>::Success; ) {
-        size_t len = co_await socket.async_receive(asio::buffer(buffer), asio::use_awaitable);
-        
-        response_parser.parse({buffer.data(), len});
+        if (response_parser.state() == HttpParser<HttpResponse>::Success) {
+            on_response(std::move(response_parser.result()));
+            response_parser.restart();
+            --count;
+        }
     }
+}
+
+static asio::awaitable<HttpResponse> exchange(ClientConnection& conn, std::string_view req_str, size_t& received) {
+    HttpResponse resp;
+    auto on_response = [&resp](HttpResponse&& res) { resp = std::move(res); };
+    co_await exchange(conn, req_str, 1, received, on_response);
+    co_return resp;
+}
+
+ResourcePool<ClientConnection>& HttpClient::Impl::pool_of(const std::string& host, const std::string& service, bool tls) {
+    std::string key = tls ? "https://" : "http://";
+    key.append(host);
+    key.append(":");
+    key.append(service);
 
-    co_return std::move(response_parser.result());
+    std::unique_lock lk(mutex);
+    auto& pool = pools[key];
+    if (!pool) {
+        pool = std::make_unique<ResourcePool<ClientConnection>>(
+            executor,
+            PoolConfig(http_config.connection_pool_config),
+            [this] {
+                return ClientConnection{HttpStream(asio::ip::tcp::socket(executor))};
+            });
+    }
+    return *pool;
+}
+
+HttpClient::HttpClient(asio::any_io_executor executor) {
+    impl = new Impl{executor};
+}
+
+asio::awaitable<HttpResponse> HttpClient::request(std::string url) {
+    auto target = parse_url(url);
+    HttpResponse resp;
+    co_await impl->send(serialize_request(target.req), 1, target.host, target.service, target.tls, 
+        [&resp](HttpResponse&& res) { resp = std::move(res); });
+    co_return resp;
+}
+
+asio::awaitable<HttpResponse> HttpClient::request(const HttpRequest& req, std::string host, std::string service) {
+    return request(serialize_request(req), std::move(host), std::move(service));
+}
+
+asio::awaitable<HttpResponse> HttpClient::request(std::string req_str, std::string host, std::string service) {
+    HttpResponse resp;
+    co_await impl->send(req_str, 1, host, service, is_tls_service(service), 
+        [&resp](HttpResponse&& res) { resp = std::move(res); });
+    co_return resp;
+}
+
+asio::awaitable<std::vector<HttpResponse>> HttpClient::pipeline(std::string req_str, size_t count, 
+    std::string host, std::string service) 
+{
+    std::vector<HttpResponse> resps;
+    resps.reserve(count);
+    co_await impl->send(req_str, count, host, service, is_tls_service(service), [&resps](HttpResponse&& res) { 
+        resps.push_back(std::move(res)); 
+    });
+    co_return resps;
+}
+
+asio::awaitable<void> HttpClient::pipeline(std::string req_str, size_t count, std::string host, std::string service,
+    std::function<void(HttpResponse&&)> on_response)
+{
+    co_await impl->send(req_str, count, host, service, is_tls_service(service), on_response);
+}
+
+template<typename OnResponse>
+asio::awaitable<void> HttpClient::Impl::send(std::string_view req_str, size_t count, 
+    const std::string& host, const std::string& service, bool tls, OnResponse on_response) 
+{
+    auto conn = co_await pool_of(host, service, tls).borrow();
+
+    try {
+        bool reused = is_reusable(conn->stream.socket());
+        if (!reused) {
+            co_await connect(conn->stream, host, service, tls);
+        }
+
+        // the last response says whether the connection stays open
+        bool keep_alive = true;
+        auto collect = [&](HttpResponse&& resp) {
+            keep_alive = resp.should_keep_alive;
+            on_response(std::move(resp));
+        };
+
+        size_t received = 0;
+        bool stale = false;
+        try {
+            co_await exchange(*conn, req_str, count, received, collect);
+        } catch(const std::system_error&) {
+            // the server may close an idle connection just as it is reused
+            if (!reused || received > 0) {
+                throw;
+            }
+            stale = true;
+        }
+
+        if (stale) {
+            co_await connect(conn->stream, host, service, tls);
+            co_await exchange(*conn, req_str, count, received, collect);
+        }
+
+        if (!keep_alive) {
+            conn->stream.close();
+        }
+    } catch(...) {
+        conn->stream.close();
+        throw;
+    }
+}
+
+// with TLS the session of an earlier connection is still resumed
+static asio::awaitable<HttpResponse> execute_once(std::string_view req_str, const std::string& host, 
+    const std::string& service, bool tls) 
+{
+    auto executor = co_await asio::this_coro::executor;
+    ClientConnection conn{HttpStream(asio::ip::tcp::socket(executor))};
+    co_await connect(conn.stream, host, service, tls);
+
+    size_t received = 0;
+    co_return co_await exchange(conn, req_str, received);
+}
+
+asio::awaitable<HttpResponse> HttpClient::execute(std::string url) {
+    auto target = parse_url(url);
+    co_return co_await execute_once(serialize_request(target.req), target.host, target.service, target.tls);
+}
+
+asio::awaitable<HttpResponse> HttpClient::execute(const HttpRequest& req, std::string host, std::string service) {
+    return execute(serialize_request(req), std::move(host), std::move(service));
+}
+
+asio::awaitable<HttpResponse> HttpClient::execute(std::string req_str, std::string host, std::string service) {
+    co_return co_await execute_once(req_str, host, service, is_tls_service(service));
 }
 
 }
\ No newline at end of file
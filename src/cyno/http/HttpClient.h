@@ -1,11 +1,14 @@
 #ifndef CYNO_HTTP_CLIENT_H_
 #define CYNO_HTTP_CLIENT_H_
 
+#include "asio/any_io_executor.hpp"
 #include "asio/awaitable.hpp"
 #include "asio/io_context.hpp"
 #include "cyno/base/Pimpl.h"
 #include "cyno/http/HttpMessage.h"
+#include <functional>
 #include <string_view>
+#include <vector>
 
 namespace cyno {
 
@@ -14,7 +17,26 @@ class HttpClient {
     CLASS_PIMPL_DECLARE(HttpClient)
 
 public:
+    // Keeps up to http_config.connection_pool_config connections per
+    // (host, service) alive between requests
+    explicit HttpClient(asio::any_io_executor executor);
+
+    // throw
+    // TLS for "https://" urls, or for the service "https", if built with
+    // CYNO_ENABLE_SSL; sessions are resumed per host and service
+    asio::awaitable<HttpResponse> request(std::string url);
+    asio::awaitable<HttpResponse> request(const HttpRequest& req, std::string host, std::string service);
+    asio::awaitable<HttpResponse> request(std::string req_str, std::string host, std::string service);
+    // req_str holds count requests, sent in one write on one connection;
+    // the responses come back in the same order (HTTP/1.1 pipelining)
+    asio::awaitable<std::vector<HttpResponse>> pipeline(std::string req_str, size_t count, 
+        std::string host, std::string service);
+    // the same, with each response handed to on_response as soon as it is read
+    asio::awaitable<void> pipeline(std::string req_str, size_t count, std::string host, std::string service,
+        std::function<void(HttpResponse&&)> on_response);
+
     // throw
+    // one connection per call
     static asio::awaitable<HttpResponse> execute(std::string url);
     static asio::awaitable<HttpResponse> execute(const HttpRequest& req, std::string host, std::string service);
     static asio::awaitable<HttpResponse> execute(std::string req_str, std::string host, std::string service);
@@ -23,4 +45,4 @@ public:
 }
 
 
-#endif
\ No newline at end of file
+#endif
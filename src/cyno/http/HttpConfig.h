@@ -12,10 +12,77 @@ struct RequestConfig {
     size_t receive_headers_timeout;
     size_t receive_body_timeout;
     size_t keepalive_timeout;
+    size_t max_pipeline_depth;      // responses flushed in one write
+    size_t response_arena_size;     // per connection, header fields of the responses until they are sent
+};
+
+struct ServerConfig {
+    size_t event_loops;     // 0 = std::thread::hardware_concurrency()
+    bool reuse_port;        // one SO_REUSEPORT acceptor per loop
+    bool pin_cpu;           // pin loop i to cpu i
+    size_t timer_tick;      // resolution of connection timeouts
+};
+
+struct DnsConfig {
+    size_t ttl;                     // positive answers
+    size_t refresh_ahead;           // re-resolve in the background this long before expiry
+    size_t negative_ttl;            // failed lookups
+    size_t max_entries;
+};
+
+struct StaticFileConfig {
+    size_t max_open_files;          // cached descriptors
+    size_t revalidate;              // stat a cached file again after this long
+};
+
+struct CacheConfig {
+    size_t max_bytes;               // serialized responses kept
+    size_t max_entry_size;          // larger responses are not cached
+    size_t coalesce_timeout;        // wait for a concurrent miss, then run the handler too
+};
+
+struct AdmissionConfig {
+    size_t max_connections;         // open connections, 0 = unlimited
+    size_t max_inflight;            // requests being handled, 0 = unlimited
+    size_t max_queue_time;          // shed requests while a loop runs this late, 0 = off
+    size_t retry_after;             // seconds, sent with the 503
+};
+
+struct Http2Config {
+    bool h2c;                       // prior knowledge and "Upgrade: h2c" on plain connections
+    size_t max_concurrent_streams;
+    size_t initial_window_size;     // receive window of each stream and of the connection
+    size_t max_header_list_size;    // decoded, name + value + 32 per field
+};
+
+// only used when built with CYNO_ENABLE_SSL
+struct TlsConfig {
+    bool http2;                     // server offers "h2" by ALPN
+    bool verify_peer;               // client checks the certificate chain and host name
+    bool session_resumption;        // client resumes the last session of each host:port
+    size_t session_cache_size;      // server sessions kept for resumption, 0 = none
+    size_t session_timeout;         // seconds, for cached sessions and tickets
+    bool session_tickets;           // server also resumes from stateless tickets
+};
+
+struct WebSocketConfig {
+    size_t max_message_size;        // reassembled from its fragments, larger ones close with 1009
+    size_t max_pending_bytes;       // queued for sending; send() waits, a broadcast drops the connection
+    size_t ping_interval;           // ms without a frame from the peer before pinging it, 0 = never
+    size_t idle_timeout;            // ms receive() waits for a frame, 0 = forever
 };
 
 struct HttpConfig {
 
+    /* event loops, used by HttpServer() */
+    ServerConfig server_config
+    {
+        .event_loops = 0,
+        .reuse_port = true,
+        .pin_cpu = false,
+        .timer_tick = 100,
+    };
+
     /* buffer resource */
     PoolConfig buffer_pool_config
     {
@@ -26,6 +93,78 @@ struct HttpConfig {
         .wait_timeout = 1000 * 15
     };
 
+    /* HttpClient keep-alive connections, one pool per (host, port) */
+    PoolConfig connection_pool_config
+    {
+        .core_idle_size = 0,
+        .max_idle_size = 32,
+        .max_active_size = 64,
+        .max_idle_time = 1000 * 30,
+        .wait_timeout = 1000 * 15
+    };
+
+    /* HttpClient resolver cache */
+    DnsConfig dns_config
+    {
+        .ttl = 1000 * 60,
+        .refresh_ahead = 1000 * 10,
+        .negative_ttl = 1000 * 5,
+        .max_entries = 1024,
+    };
+
+    /* StaticFiles, per instance */
+    StaticFileConfig static_file_config
+    {
+        .max_open_files = 1024,
+        .revalidate = 1000,
+    };
+
+    /* HttpServer response cache, see HttpRouter::cache */
+    CacheConfig cache_config
+    {
+        .max_bytes = 64 * 1024 * 1024,
+        .max_entry_size = 1024 * 1024,
+        .coalesce_timeout = 1000 * 5,
+    };
+
+    /* HttpServer overload protection, limits are split evenly over the loops */
+    AdmissionConfig admission_config
+    {
+        .max_connections = 0,
+        .max_inflight = 0,
+        .max_queue_time = 0,
+        .retry_after = 1,
+    };
+
+    /* HttpServer HTTP/2, body size and timeouts come from request_config */
+    Http2Config http2_config
+    {
+        .h2c = true,
+        .max_concurrent_streams = 100,
+        .initial_window_size = 1024 * 1024,
+        .max_header_list_size = 1024 * 16,
+    };
+
+    /* TLS of HttpServer::enable_tls and of https:// in HttpClient */
+    TlsConfig tls_config
+    {
+        .http2 = true,
+        .verify_peer = true,
+        .session_resumption = true,
+        .session_cache_size = 1024 * 20,
+        .session_timeout = 60 * 60 * 2,
+        .session_tickets = true,
+    };
+
+    /* routes added with HttpRouter::Ws */
+    WebSocketConfig websocket_config
+    {
+        .max_message_size = 1024 * 1024,
+        .max_pending_bytes = 1024 * 1024 * 4,
+        .ping_interval = 1000 * 30,
+        .idle_timeout = 1000 * 75,
+    };
+
     /* http request */
     RequestConfig request_config
     {
@@ -35,6 +174,8 @@ struct HttpConfig {
         .receive_headers_timeout = 1000 * 15,
         .receive_body_timeout = 1000 * 15,
         .keepalive_timeout = 1000 * 60,
+        .max_pipeline_depth = 32,
+        .response_arena_size = 1024 * 4,
     };
 };
 
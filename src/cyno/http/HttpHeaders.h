@@ -0,0 +1,352 @@
+#ifndef CYNO_HTTP_HEADERS_H_
+#define CYNO_HTTP_HEADERS_H_
+
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <new>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+namespace cyno {
+
+#define CYNO_HTTP_FIELD_MAP(XX)                                     \
+    XX(Accept,                  "Accept")                           \
+    XX(AcceptEncoding,          "Accept-Encoding")                  \
+    XX(AcceptRanges,            "Accept-Ranges")                    \
+    XX(Authorization,           "Authorization")                    \
+    XX(CacheControl,            "Cache-Control")                    \
+    XX(Connection,              "Connection")                       \
+    XX(ContentEncoding,         "Content-Encoding")                 \
+    XX(ContentLength,           "Content-Length")                   \
+    XX(ContentRange,            "Content-Range")                    \
+    XX(ContentType,             "Content-Type")                     \
+    XX(Cookie,                  "Cookie")                           \
+    XX(Date,                    "Date")                             \
+    XX(ETag,                    "ETag")                             \
+    XX(Expect,                  "Expect")                           \
+    XX(Host,                    "Host")                             \
+    XX(Http2Settings,           "HTTP2-Settings")                   \
+    XX(IfModifiedSince,         "If-Modified-Since")                \
+    XX(IfNoneMatch,             "If-None-Match")                    \
+    XX(IfRange,                 "If-Range")                         \
+    XX(KeepAlive,               "Keep-Alive")                       \
+    XX(LastModified,            "Last-Modified")                    \
+    XX(Location,                "Location")                         \
+    XX(Origin,                  "Origin")                           \
+    XX(Range,                   "Range")                            \
+    XX(RetryAfter,              "Retry-After")                      \
+    XX(SecWebSocketAccept,      "Sec-WebSocket-Accept")             \
+    XX(SecWebSocketKey,         "Sec-WebSocket-Key")                \
+    XX(SecWebSocketProtocol,    "Sec-WebSocket-Protocol")           \
+    XX(SecWebSocketVersion,     "Sec-WebSocket-Version")            \
+    XX(Server,                  "Server")                           \
+    XX(SetCookie,               "Set-Cookie")                       \
+    XX(TransferEncoding,        "Transfer-Encoding")                \
+    XX(Upgrade,                 "Upgrade")                          \
+    XX(UserAgent,               "User-Agent")                       \
+    XX(XForwardedFor,           "X-Forwarded-For")                  \
+
+// Well-known header fields, looked up without comparing names
+enum class HttpField : uint8_t {
+    Unknown,
+#define XX(name, string) name,
+    CYNO_HTTP_FIELD_MAP(XX)
+#undef XX
+};
+
+constexpr size_t http_field_count = 1 + 0
+#define XX(name, string) + 1
+    CYNO_HTTP_FIELD_MAP(XX)
+#undef XX
+    ;
+
+// header names are ASCII tokens
+inline bool iequals(std::string_view a, std::string_view b) {
+    if (a.length() != b.length()) {
+        return false;
+    }
+    auto lower = [](char c) { return c >= 'A' && c <= 'Z' ? static_cast<char>(c + ('a' - 'A')) : c; };
+    for (size_t i = 0; i < a.length(); ++i) {
+        if (lower(a[i]) != lower(b[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+inline std::string_view http_field_name(HttpField field) {
+    static constexpr std::string_view names[] = {
+        "",
+#define XX(name, string) string,
+        CYNO_HTTP_FIELD_MAP(XX)
+#undef XX
+    };
+    return names[static_cast<size_t>(field)];
+}
+
+// Unknown if the name is not a well-known field
+inline HttpField http_field_of(std::string_view name) {
+    // grouped by length, so only a few names are compared
+    static const auto by_length = [] {
+        std::array<std::vector<HttpField>, 32> res;
+        for (size_t i = 1; i < http_field_count; ++i) {
+            auto field = static_cast<HttpField>(i);
+            res[http_field_name(field).length()].push_back(field);
+        }
+        return res;
+    }();
+
+    if (name.length() >= by_length.size()) {
+        return HttpField::Unknown;
+    }
+    for (auto field : by_length[name.length()]) {
+        if (iequals(http_field_name(field), name)) {
+            return field;
+        }
+    }
+    return HttpField::Unknown;
+}
+
+// The heap for header fields that have no arena. new_delete_resource()
+// would take the aligned operator new, which is slower than the plain one
+// for the small alignments strings ask for.
+class HttpHeapResource final: public std::pmr::memory_resource {
+public:
+    static HttpHeapResource* instance() {
+        static HttpHeapResource resource;
+        return &resource;
+    }
+
+private:
+    void* do_allocate(size_t bytes, size_t alignment) override {
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            return ::operator new(bytes);
+        }
+        return ::operator new(bytes, std::align_val_t(alignment));
+    }
+
+    void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+        if (alignment <= __STDCPP_DEFAULT_NEW_ALIGNMENT__) {
+            ::operator delete(p, bytes);
+        } else {
+            ::operator delete(p, bytes, std::align_val_t(alignment));
+        }
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+        return this == &other;
+    }
+};
+
+// Header fields in arrival order in one flat array, names compared without
+// regard to case. Well-known fields are also indexed by HttpField, so looking
+// them up is O(1). Repeated fields are all kept, lookups see the first one.
+// clear() keeps the capacity for the next message.
+template<typename String>
+class BasicHttpHeaders {
+public:
+    struct Field {
+        HttpField id;
+        String name;
+        String value;
+    };
+
+    using iterator = typename std::vector<Field>::iterator;
+    using const_iterator = typename std::vector<Field>::const_iterator;
+
+    BasicHttpHeaders(): BasicHttpHeaders(HttpHeapResource::instance()) {}
+
+    explicit BasicHttpHeaders(std::pmr::memory_resource* memory): memory_(memory) {
+        fields_.reserve(16);
+    }
+
+    BasicHttpHeaders(const BasicHttpHeaders& other): BasicHttpHeaders() {
+        *this = other;
+    }
+
+    // keeps the memory resource of this
+    BasicHttpHeaders& operator=(const BasicHttpHeaders& other) {
+        if (this != &other) {
+            clear();
+            fields_.reserve(other.fields_.size());
+            for (auto& field : other.fields_) {
+                push(field.id, field.name, field.value);
+            }
+        }
+        return *this;
+    }
+
+    BasicHttpHeaders(BasicHttpHeaders&&) = default;
+    BasicHttpHeaders& operator=(BasicHttpHeaders&&) = default;
+
+    // nullptr if missing
+    const String* find(HttpField id) const {
+        auto pos = index_[static_cast<size_t>(id)];
+        return pos ? &fields_[pos - 1].value : nullptr;
+    }
+
+    String* find(HttpField id) {
+        auto pos = index_[static_cast<size_t>(id)];
+        return pos ? &fields_[pos - 1].value : nullptr;
+    }
+
+    const String* find(std::string_view name) const {
+        return const_cast<BasicHttpHeaders*>(this)->find(name);
+    }
+
+    String* find(std::string_view name) {
+        if (auto id = http_field_of(name); id != HttpField::Unknown) {
+            return find(id);
+        }
+        for (auto& field : fields_) {
+            if (field.id == HttpField::Unknown && iequals(field.name, name)) {
+                return &field.value;
+            }
+        }
+        return nullptr;
+    }
+
+    // empty if missing
+    std::string_view get(HttpField id) const {
+        auto value = find(id);
+        return value ? std::string_view(*value) : std::string_view();
+    }
+
+    std::string_view get(std::string_view name) const {
+        auto value = find(name);
+        return value ? std::string_view(*value) : std::string_view();
+    }
+
+    bool contains(HttpField id) const {
+        return find(id) != nullptr;
+    }
+
+    bool contains(std::string_view name) const {
+        return find(name) != nullptr;
+    }
+
+    // the value of the first such field, added empty if missing
+    String& operator[](HttpField id) {
+        if (auto value = find(id)) {
+            return *value;
+        }
+        return push(id, http_field_name(id), {}).value;
+    }
+
+    String& operator[](std::string_view name) {
+        if (auto id = http_field_of(name); id != HttpField::Unknown) {
+            return (*this)[id];
+        }
+        if (auto value = find(name)) {
+            return *value;
+        }
+        return push(HttpField::Unknown, name, {}).value;
+    }
+
+    // keeps any earlier field of the same name, e.g. for Set-Cookie
+    void add(std::string_view name, std::string_view value) {
+        push(http_field_of(name), name, value);
+    }
+
+    // every field of that name
+    size_t erase(HttpField id) {
+        if (id == HttpField::Unknown) {
+            return 0;
+        }
+        return erase_if([id](const Field& field) { return field.id == id; });
+    }
+
+    size_t erase(std::string_view name) {
+        if (auto id = http_field_of(name); id != HttpField::Unknown) {
+            return erase(id);
+        }
+        return erase_if([name](const Field& field) {
+            return field.id == HttpField::Unknown && iequals(field.name, name);
+        });
+    }
+
+    void clear() {
+        fields_.clear();
+        index_.fill(0);
+    }
+
+    void reserve(size_t size) {
+        fields_.reserve(size);
+    }
+
+    size_t size() const {
+        return fields_.size();
+    }
+
+    bool empty() const {
+        return fields_.empty();
+    }
+
+    iterator begin() {
+        return fields_.begin();
+    }
+
+    iterator end() {
+        return fields_.end();
+    }
+
+    const_iterator begin() const {
+        return fields_.begin();
+    }
+
+    const_iterator end() const {
+        return fields_.end();
+    }
+
+    std::pmr::memory_resource* memory() const {
+        return memory_;
+    }
+
+private:
+    String make_string(std::string_view str) const {
+        if constexpr (std::is_same_v<String, std::string_view>) {
+            return str;
+        } else {
+            return String(str, memory_);
+        }
+    }
+
+    Field& push(HttpField id, std::string_view name, std::string_view value) {
+        fields_.emplace_back(id, make_string(name), make_string(value));
+        auto& pos = index_[static_cast<size_t>(id)];
+        if (id != HttpField::Unknown && pos == 0) {
+            pos = static_cast<uint16_t>(fields_.size());
+        }
+        return fields_.back();
+    }
+
+    template<typename Pred>
+    size_t erase_if(Pred pred) {
+        size_t count = std::erase_if(fields_, pred);
+        if (count > 0) {
+            index_.fill(0);
+            for (size_t i = 0; i < fields_.size(); ++i) {
+                auto& pos = index_[static_cast<size_t>(fields_[i].id)];
+                if (fields_[i].id != HttpField::Unknown && pos == 0) {
+                    pos = static_cast<uint16_t>(i + 1);
+                }
+            }
+        }
+        return count;
+    }
+
+    std::pmr::memory_resource* memory_;
+    std::vector<Field> fields_;
+    // position + 1 of the first field of each id, 0 if missing
+    std::array<uint16_t, http_field_count> index_{};
+};
+
+using HttpHeaders = BasicHttpHeaders<std::pmr::string>;
+using HttpHeadersView = BasicHttpHeaders<std::string_view>;
+
+}
+
+#endif
@@ -1,6 +1,7 @@
 #ifndef CYNO_INTERCEPTOR_H_
 #define CYNO_INTERCEPTOR_H_
 
+#include "asio/awaitable.hpp"
 #include "cyno/http/HttpMessage.h"
 
 namespace cyno {
@@ -8,11 +9,21 @@ namespace cyno {
 // Interface
 class HttpInterceptor {
 public:
-    virtual bool before(HttpRequest&, HttpResponse&) = 0;
-    virtual void after(HttpRequest&, HttpResponse&) = 0;
+    virtual bool before(HttpRequestView&, HttpResponse&) = 0;
+    virtual void after(HttpRequestView&, HttpResponse&) = 0;
     virtual ~HttpInterceptor() = default;
 };
 
+// Interface
+// For interceptors that do I/O, e.g. a session lookup. Once one is added,
+// every request goes through the slower awaitable path.
+class AsyncHttpInterceptor {
+public:
+    virtual asio::awaitable<bool> before(HttpRequestView&, HttpResponse&) = 0;
+    virtual asio::awaitable<void> after(HttpRequestView&, HttpResponse&) = 0;
+    virtual ~AsyncHttpInterceptor() = default;
+};
+
 }
 
 #endif
\ No newline at end of file
@@ -1,18 +1,20 @@
 #ifndef CYNO_HTTP_MESSAGE_H_
 #define CYNO_HTTP_MESSAGE_H_
 
+#include <array>
+#include <memory>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
+#include <vector>
 #include "http_parser.h"
 #include "cyno/base/Exceptions.h"
+#include "cyno/http/HttpHeaders.h"
+#include "cyno/http/HttpUrl.h"
 
 namespace cyno {
 
-struct HttpRequestUrl {
-    std::vector<std::string> path;
-    std::unordered_map<std::string, std::string> query;
-};
-
 struct HttpRequest {
     using Method = http_method;
 
@@ -20,7 +22,7 @@ struct HttpRequest {
     std::string url;
     std::string version;
     std::string body;
-    std::unordered_map<std::string, std::string> headers;
+    HttpHeaders headers;
 
     std::vector<std::string> path;
     std::unordered_map<std::string, std::string> query;
@@ -33,40 +35,184 @@ struct HttpRequest {
         req.method = Method::HTTP_GET;
         req.url = "/";
         req.version = "HTTP/1.1";
-        req.headers["User-Agent"] = "cyno/0.0.1";
-        req.headers["Accept"] = "*/*";
-        req.headers["Accept-Encoding"] = "gzip, deflate, br";
-        req.headers["Connection"] = "keep-alive";
-        req.headers["Content-Length"] = "0";
+        req.headers[HttpField::UserAgent] = "cyno/0.0.1";
+        req.headers[HttpField::Accept] = "*/*";
+        req.headers[HttpField::AcceptEncoding] = "gzip, deflate, br";
+        req.headers[HttpField::Connection] = "keep-alive";
+        req.headers[HttpField::ContentLength] = "0";
+        return req;
+    }
+};
+
+// Captures of the matched route: ":name" segments and the "*" tail.
+// Names point into the router, values into the url.
+class PathParams {
+public:
+    static constexpr size_t max_size = 8;
+    using value_type = std::pair<std::string_view, std::string_view>;
+
+    // empty if the route has no such capture
+    std::string_view operator[](std::string_view name) const {
+        for (size_t i = 0; i < size_; ++i) {
+            if (params_[i].first == name) {
+                return params_[i].second;
+            }
+        }
+        return {};
+    }
+
+    void push(std::string_view name, std::string_view value) {
+        params_[size_++] = {name, value};
+    }
+
+    void pop() {
+        --size_;
+    }
+
+    void clear() {
+        size_ = 0;
+    }
+
+    size_t size() const {
+        return size_;
+    }
+
+    value_type* begin() {
+        return params_.data();
+    }
+
+    value_type* end() {
+        return params_.data() + size_;
+    }
+
+    const value_type* begin() const {
+        return params_.data();
+    }
+
+    const value_type* end() const {
+        return params_.data() + size_;
+    }
+
+private:
+    std::array<value_type, max_size> params_;
+    size_t size_ = 0;
+};
+
+// Request parsed in place: every view points into the connection buffer and
+// is only valid during the handler call. Use to_owned() to keep it longer.
+struct HttpRequestView {
+    using Method = http_method;
+
+    Method method;
+    std::string_view url;
+    std::string_view version;
+    std::string_view body;
+    HttpHeadersView headers;
+
+    // set by bind_url(), decoded on first access
+    HttpUrlPath path;
+    HttpUrlQuery query;
+    PathParams params;
+
+    size_t content_length = 0;
+    bool should_keep_alive = true;
+
+    // a chunked body is not contiguous in the buffer, so it is joined here
+    std::string body_storage;
+
+    // keep capacity for the next request on the connection
+    void reset() {
+        url = {};
+        version = {};
+        body = {};
+        headers.clear();
+        path.clear();
+        query.clear();
+        params.clear();
+        content_length = 0;
+        should_keep_alive = true;
+        body_storage.clear();
+    }
+
+    // points path and query at url, which is not parsed until they are read
+    void bind_url() {
+        auto [raw_path, raw_query] = split_url_target(url);
+        path.assign(raw_path);
+        query.assign(raw_query);
+    }
+
+    HttpRequest to_owned() const {
+        HttpRequest req;
+        req.method = method;
+        req.url = url;
+        req.version = version;
+        req.body = body;
+        for (auto& field : headers) {
+            req.headers.add(field.name, field.value);
+        }
+        for (auto& str : path) {
+            req.path.emplace_back(str);
+        }
+        for (auto&& [key, value] : query) {
+            req.query.emplace(key, value);
+        }
+        req.content_length = content_length;
+        req.should_keep_alive = should_keep_alive;
         return req;
     }
 };
 
+// A region of an open file, sent with sendfile after the head instead of body.
+// owner keeps the descriptor open until the response is written.
+struct HttpFileBody {
+    std::shared_ptr<const void> owner;
+    int fd = -1;
+    size_t offset = 0;
+    size_t length = 0;
+};
+
 struct HttpResponse {
     using Status = http_status;
     Status status_code;
     std::string version;
     std::string status;
     std::string body;
-    std::unordered_map<std::string, std::string> headers;
+    std::optional<HttpFileBody> file;
+    // a complete serialized response, sent as is instead of everything above
+    std::shared_ptr<const std::string> raw;
+    HttpHeaders headers;
 
     size_t content_length = 0;
     bool should_keep_alive = true;
 
+    HttpResponse() = default;
+    // header fields are allocated from memory, e.g. an arena of the connection
+    explicit HttpResponse(std::pmr::memory_resource* memory): headers(memory) {}
+
     static HttpResponse from_default() {
         HttpResponse resp;
-        resp.version = "HTTP/1.1";
-        resp.status_code = Status::HTTP_STATUS_OK;
-        resp.status = "OK";
-        resp.headers["Connection"] = "keep-alive";
-        resp.headers["Content-Length"] = "0";
-
+        resp.reset();
         return resp;
     }
 
+    // back to from_default(), keeping the capacity of body and headers
+    void reset() {
+        version = "HTTP/1.1";
+        status_code = Status::HTTP_STATUS_OK;
+        status = "OK";
+        body.clear();
+        file.reset();
+        raw.reset();
+        headers.clear();
+        headers[HttpField::Connection] = "keep-alive";
+        headers[HttpField::ContentLength] = "0";
+        content_length = 0;
+        should_keep_alive = true;
+    }
+
     int data(std::string_view type, std::string_view content) {
         body = content;
-        headers["Content-Type"] = type;
+        headers[HttpField::ContentType] = type;
         return Status::HTTP_STATUS_OK;
     }
 
@@ -84,10 +230,10 @@ inline std::string serialize_request(const HttpRequest& req) {
     res.append(" ");
     res.append(req.version);
     res.append("\r\n");
-    for (auto&& [key, value] : req.headers) {
-        res.append(key);
+    for (auto& field : req.headers) {
+        res.append(field.name);
         res.append(": ");
-        res.append(value);
+        res.append(field.value);
         res.append("\r\n");
     }
     res.append("\r\n");
@@ -96,21 +242,57 @@ inline std::string serialize_request(const HttpRequest& req) {
     return res;
 }
 
+// "HTTP/1.1 200 OK\r\n", built once per status code. Empty for unknown codes.
+inline std::string_view http_status_line(http_status status) {
+    static const auto lines = [] {
+        std::array<std::string, 600> res;
+#define XX(num, name, string) res[num] = "HTTP/1.1 " #num " " #string "\r\n";
+        HTTP_STATUS_MAP(XX)
+#undef XX
+        return res;
+    }();
+
+    size_t code = static_cast<size_t>(status);
+    return code < lines.size() ? std::string_view(lines[code]) : std::string_view();
+}
+
+// Writes the header block to head and returns the shared status line, so the
+// response can go out as {status line, head, body} without copying the body.
+// A custom version or reason phrase is written to head and the result is empty.
+inline std::string_view serialize_response_head(const HttpResponse& resp, std::string& head) {
+    head.clear();
+    
+    std::string_view line = http_status_line(resp.status_code);
+    std::string_view reason = line.empty() ? line : line.substr(13, line.length() - 15);
+    if (line.empty() || resp.version != "HTTP/1.1" || resp.status != reason) {
+        line = {};
+        head.append(resp.version);
+        head.append(" ");
+        head.append(std::to_string(resp.status_code));
+        head.append(" ");
+        head.append(resp.status);
+        head.append("\r\n");
+    }
+
+    for (auto& field : resp.headers) {
+        head.append(field.name);
+        head.append(": ");
+        head.append(field.value);
+        head.append("\r\n");
+    }
+    head.append("\r\n");
+
+    return line;
+}
+
 inline std::string serialize_response(const HttpResponse& resp) {
+    std::string head;
+    auto line = serialize_response_head(resp, head);
+
     std::string res;
-    res.append(resp.version);
-    res.append(" ");
-    res.append(std::to_string(resp.status_code));
-    res.append(" ");
-    res.append(resp.status);
-    res.append("\r\n");
-    for (auto&& [key, value] : resp.headers) {
-        res.append(key);
-        res.append(": ");
-        res.append(value);
-        res.append("\r\n");
-    }
-    res.append("\r\n");
+    res.reserve(line.length() + head.length() + resp.body.length());
+    res.append(line);
+    res.append(head);
     res.append(resp.body);
 
     return res;
@@ -0,0 +1,172 @@
+#include "cyno/http/HttpMetrics.h"
+
+#include <charconv>
+#include "cyno/http/HttpRouter.h"
+
+namespace cyno {
+
+MetricShard::MetricShard(size_t route_count)
+    : route_count_(route_count)
+    , latencies_(std::make_unique<std::array<std::atomic<Histogram*>, 5>[]>(route_count + 1))
+{}
+
+MetricShard::~MetricShard() {
+    for (size_t i = 0; i <= route_count_; ++i) {
+        for (auto& histogram : latencies_[i]) {
+            delete histogram.load(std::memory_order_acquire);
+        }
+    }
+}
+
+Histogram& MetricShard::latency(size_t route_id, size_t status_class) {
+    auto& slot = latencies_[std::min(route_id, route_count_)][status_class];
+    Histogram* histogram = slot.load(std::memory_order_acquire);
+    if (histogram) {
+        return *histogram;
+    }
+    // the executor may run the loop on several threads
+    auto created = new Histogram;
+    if (slot.compare_exchange_strong(histogram, created, std::memory_order_acq_rel)) {
+        return *created;
+    }
+    delete created;
+    return *histogram;
+}
+
+HttpMetrics::HttpMetrics(size_t shard_count, size_t route_count) {
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.emplace_back(std::make_unique<MetricShard>(route_count));
+    }
+}
+
+static void append_number(std::string& out, uint64_t value) {
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), value);
+    out.append(buf, end);
+}
+
+static void append_seconds(std::string& out, uint64_t micros) {
+    append_number(out, micros / 1000000);
+    if (uint64_t frac = micros % 1000000; frac > 0) {
+        char buf[8] = {'.'};
+        for (int i = 6; i > 0; --i, frac /= 10) {
+            buf[i] = static_cast<char>('0' + frac % 10);
+        }
+        size_t len = 7;
+        for (; buf[len - 1] == '0'; --len);
+        out.append(buf, len);
+    }
+}
+
+// label values escape backslash, quote and newline
+static void append_label(std::string& out, std::string_view value) {
+    for (char c : value) {
+        if (c == '\\' || c == '"') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (c == '\n') {
+            out.append("\\n");
+        } else {
+            out.push_back(c);
+        }
+    }
+}
+
+static void append_metric(std::string& out, std::string_view name, std::string_view type,
+    std::string_view help, uint64_t value)
+{
+    out.append("# HELP ").append(name).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(name).append(" ").append(type).append("\n");
+    out.append(name).append(" ");
+    append_number(out, value);
+    out.append("\n");
+}
+
+void HttpMetrics::render(const HttpRouter& router, const PoolStats& buffers, std::string& out) const {
+    // le boundaries of the exported buckets, in microseconds
+    static constexpr uint64_t bounds[] = {
+        100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+        100000, 250000, 500000, 1000000, 2500000, 5000000, 10000000,
+    };
+    static constexpr std::string_view classes[] = {"1xx", "2xx", "3xx", "4xx", "5xx"};
+
+    uint64_t opened = 0;
+    uint64_t closed = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t parse_errors = 0;
+    uint64_t rejected = 0;
+    uint64_t shed = 0;
+    for (auto& shard : shards_) {
+        // closed first, so active never goes below zero
+        closed += shard->connections_closed_.load(std::memory_order_relaxed);
+        opened += shard->connections_opened_.load(std::memory_order_relaxed);
+        bytes_in += shard->bytes_in_.load(std::memory_order_relaxed);
+        bytes_out += shard->bytes_out_.load(std::memory_order_relaxed);
+        parse_errors += shard->parse_errors_.load(std::memory_order_relaxed);
+        rejected += shard->connections_rejected_.load(std::memory_order_relaxed);
+        shed += shard->requests_shed_.load(std::memory_order_relaxed);
+    }
+
+    std::string_view name = "cyno_http_request_duration_seconds";
+    out.append("# HELP cyno_http_request_duration_seconds Time from the request headers to the response, by route.\n");
+    out.append("# TYPE cyno_http_request_duration_seconds histogram\n");
+
+    size_t route_count = shards_.empty() ? 0 : shards_.front()->route_count_;
+    auto snapshot = std::make_unique<HistogramSnapshot>();
+    for (size_t id = 0; id <= route_count; ++id) {
+        for (size_t cls = 0; cls < 5; ++cls) {
+            *snapshot = HistogramSnapshot();
+            for (auto& shard : shards_) {
+                if (auto histogram = shard->latencies_[id][cls].load(std::memory_order_acquire)) {
+                    snapshot->add(*histogram);
+                }
+            }
+            if (snapshot->count == 0) {
+                continue;
+            }
+
+            std::string labels = "{method=\"";
+            if (id < route_count) {
+                auto [method, path] = router.route_info(id);
+                labels.append(http_method_str(method)).append("\",route=\"");
+                append_label(labels, path);
+            } else {
+                labels.append("\",route=\"");
+            }
+            labels.append("\",status=\"").append(classes[cls]).append("\"");
+
+            // a bucket straddling a bound counts below it, within the histogram's 12.5%
+            for (uint64_t bound : bounds) {
+                out.append(name).append("_bucket").append(labels).append(",le=\"");
+                append_seconds(out, bound);
+                out.append("\"} ");
+                append_number(out, snapshot->count_below(bound + 1));
+                out.append("\n");
+            }
+            out.append(name).append("_bucket").append(labels).append(",le=\"+Inf\"} ");
+            append_number(out, snapshot->count);
+            out.append("\n");
+
+            out.append(name).append("_sum").append(labels).append("} ");
+            append_seconds(out, snapshot->sum);
+            out.append("\n");
+            out.append(name).append("_count").append(labels).append("} ");
+            append_number(out, snapshot->count);
+            out.append("\n");
+        }
+    }
+
+    append_metric(out, "cyno_http_connections_active", "gauge", "Open connections.", opened - closed);
+    append_metric(out, "cyno_http_connections_total", "counter", "Accepted connections.", opened);
+    append_metric(out, "cyno_http_received_bytes_total", "counter", "Bytes read from clients.", bytes_in);
+    append_metric(out, "cyno_http_sent_bytes_total", "counter", "Bytes written to clients.", bytes_out);
+    append_metric(out, "cyno_http_parse_errors_total", "counter", "Requests rejected as malformed or too large.", parse_errors);
+    append_metric(out, "cyno_http_rejected_connections_total", "counter", "Connections refused with 503 by admission control.", rejected);
+    append_metric(out, "cyno_http_shed_requests_total", "counter", "Requests answered with 503 by admission control.", shed);
+    append_metric(out, "cyno_buffer_pool_active", "gauge", "Request buffers in use.", buffers.active);
+    append_metric(out, "cyno_buffer_pool_idle", "gauge", "Request buffers ready for reuse.", buffers.idle);
+    append_metric(out, "cyno_buffer_pool_exhausted_total", "counter", "Buffer borrows that timed out.", buffers.exhausted);
+}
+
+}
@@ -0,0 +1,108 @@
+#ifndef CYNO_HTTP_METRICS_H_
+#define CYNO_HTTP_METRICS_H_
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include "cyno/base/Histogram.h"
+
+namespace cyno {
+
+class HttpRouter;
+
+// The counters of one event loop. Only the loop's own threads write them,
+// with relaxed atomics, so recording takes no lock and shares no cache line
+// with other loops. A scrape reads every shard and adds them up.
+class MetricShard {
+public:
+    // routes numbered by HttpRouter::route_id, the last one is "no route"
+    explicit MetricShard(size_t route_count);
+    ~MetricShard();
+
+    MetricShard(const MetricShard&) = delete;
+    MetricShard& operator=(const MetricShard&) = delete;
+
+    void connection_opened() {
+        connections_opened_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void connection_closed() {
+        connections_closed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void received(size_t bytes) {
+        bytes_in_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void sent(size_t bytes) {
+        bytes_out_.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    void parse_error() {
+        parse_errors_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // answered with 503 by admission control
+    void connection_rejected() {
+        connections_rejected_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void request_shed() {
+        requests_shed_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // micros from the headers being in to the response being ready
+    void request(size_t route_id, int status, uint64_t micros) {
+        latency(route_id, status_class(status)).record(micros);
+    }
+
+    static size_t status_class(int status) {
+        return static_cast<size_t>(std::clamp(status / 100, 1, 5) - 1);
+    }
+
+private:
+    friend class HttpMetrics;
+
+    // created on first use, most routes never see most status classes
+    Histogram& latency(size_t route_id, size_t status_class);
+
+    size_t route_count_;
+    std::unique_ptr<std::array<std::atomic<Histogram*>, 5>[]> latencies_;
+    alignas(64) std::atomic<uint64_t> connections_opened_ = 0;
+    std::atomic<uint64_t> connections_closed_ = 0;
+    std::atomic<uint64_t> bytes_in_ = 0;
+    std::atomic<uint64_t> bytes_out_ = 0;
+    std::atomic<uint64_t> parse_errors_ = 0;
+    std::atomic<uint64_t> connections_rejected_ = 0;
+    std::atomic<uint64_t> requests_shed_ = 0;
+};
+
+// summed over the pools of every loop
+struct PoolStats {
+    size_t active = 0;
+    size_t idle = 0;
+    size_t exhausted = 0;
+};
+
+// One shard per event loop, rendered in the Prometheus text format
+class HttpMetrics {
+public:
+    HttpMetrics(size_t shard_count, size_t route_count);
+
+    MetricShard& shard(size_t index) {
+        return *shards_[index];
+    }
+
+    // appends to out; route labels come from router
+    void render(const HttpRouter& router, const PoolStats& buffers, std::string& out) const;
+
+private:
+    std::vector<std::unique_ptr<MetricShard>> shards_;
+};
+
+}
+
+#endif
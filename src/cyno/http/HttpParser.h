@@ -7,11 +7,15 @@
 namespace cyno {
 
 template<typename T>
-requires (std::is_same_v<T, HttpRequest> || std::is_same_v<T, HttpResponse>)
+requires (std::is_same_v<T, HttpRequest> 
+    || std::is_same_v<T, HttpRequestView> 
+    || std::is_same_v<T, HttpResponse>)
 class HttpParser {
+    static constexpr bool is_view = std::is_same_v<T, HttpRequestView>;
+    using String = std::conditional_t<is_view, std::string_view, std::string>;
 public:
     enum State {
-        NotStarted, Parsing, Fail, Success
+        NotStarted, Parsing, HeadersComplete, Fail, Success
     };
 
     HttpParser() {
@@ -32,30 +36,92 @@ public:
     }
 
     void restart() {
-        result_ = T{};
+        if constexpr (is_view) {
+            result_.reset();
+        } else {
+            result_ = T{};
+        }
+        current_kv_ = {};
+        in_value_ = false;
+        stream_body_ = false;
+        chunks_.clear();
         http_parser_init(&parser_, http_parser_type::HTTP_BOTH);
         parser_.data = static_cast<void*>(this);
         state_ = NotStarted;
     }
 
     // throw HttpRequestError
-    void parse(std::string_view str) {
-        http_parser_execute(&parser_, &settings_, str.data(), str.length());
-        if (parser_.http_errno != http_errno::HPE_OK) {
+    // For HttpRequestView successive calls must pass adjacent pieces of one
+    // buffer, which has to stay alive and in place while the result is used.
+    // Stops after one message and returns the bytes consumed, anything left
+    // belongs to the next (pipelined) message and needs a restart() first.
+    size_t parse(std::string_view str) {
+        size_t len = http_parser_execute(&parser_, &settings_, str.data(), str.length());
+        if (HTTP_PARSER_ERRNO(&parser_) == http_errno::HPE_PAUSED) {
+            http_parser_pause(&parser_, 0);
+        } else if (parser_.http_errno != http_errno::HPE_OK) {
             state_ = Fail;
             throw HttpRequestError(http_errno_description(HTTP_PARSER_ERRNO(&parser_)));
         }
 
         result_.should_keep_alive = http_should_keep_alive(&parser_);
+        result_.version = parser_.http_minor == 0 ? "HTTP/1.0" : "HTTP/1.1";
         
-        if constexpr (std::is_same_v<T, HttpRequest>) {
-            // request
-            result_.method = static_cast<http_method>(parser_.method);
-        } else {
+        if constexpr (std::is_same_v<T, HttpResponse>) {
             // response
             result_.status_code = static_cast<http_status>(parser_.status_code);
+        } else {
+            // request
+            result_.method = static_cast<http_method>(parser_.method);
         }
-        
+
+        return len;
+    }
+
+    // The buffer holding [from, from + size) moved to to, e.g. it grew
+    // while reading the body. Shift every view that points into it.
+    void rebase(const char* from, const char* to, size_t size) requires is_view {
+        auto shift = [=](std::string_view& view) {
+            if (view.data() >= from && view.data() < from + size) {
+                view = {to + (view.data() - from), view.size()};
+            }
+        };
+
+        shift(result_.url);
+        shift(result_.body);
+        shift(current_kv_.first);
+        shift(current_kv_.second);
+
+        for (auto& field : result_.headers) {
+            shift(field.name);
+            shift(field.value);
+        }
+
+        // set once the request was routed
+        result_.path.rebase(shift);
+        result_.query.rebase(shift);
+        for (auto& param : result_.params) {
+            shift(param.second);
+        }
+    }
+
+    // parse() also returns once the headers are complete
+    void pause_after_headers(bool pause) {
+        pause_after_headers_ = pause;
+    }
+
+    // Until restart(), body pieces go to chunks() instead of the result.
+    // They point into the parsed buffer and are collected per parse() call.
+    void stream_body(bool stream) {
+        stream_body_ = stream;
+    }
+
+    const std::vector<std::string_view>& chunks() const {
+        return chunks_;
+    }
+
+    void clear_chunks() {
+        chunks_.clear();
     }
 
     T& result() {
@@ -71,48 +137,97 @@ private:
         return *static_cast<HttpParser*>(data);
     }
 
+    // http_parser may hand one token over in several adjacent pieces
+    static void append(String& str, const char* at, size_t len) {
+        if constexpr (is_view) {
+            str = str.empty() ? std::string_view(at, len) : std::string_view(str.data(), str.size() + len);
+        } else {
+            str.append(at, len);
+        }
+    }
+
+    void commit_header() {
+        if (!current_kv_.first.empty()) {
+            result_.headers.add(std::move(current_kv_.first), std::move(current_kv_.second));
+        }
+        current_kv_ = {};
+        in_value_ = false;
+    }
+
     static int on_message_begin(http_parser* parser) {
         hook(parser->data).state_ = Parsing;
         return 0;
     }
 
     static int on_url(http_parser* parser, const char* at, size_t len) {
-        if constexpr (std::is_same_v<T, HttpRequest>) {
-            hook(parser->data).result_.url.assign(at, len);
+        if constexpr (!std::is_same_v<T, HttpResponse>) {
+            append(hook(parser->data).result_.url, at, len);
         }
         return 0;
     }
 
     static int on_status(http_parser* parser, const char* at, size_t len) {
         if constexpr (std::is_same_v<T, HttpResponse>) {
-            hook(parser->data).result_.status.assign(at, len);
+            hook(parser->data).result_.status.append(at, len);
         }
         return 0;
     }
 
     static int on_header_field(http_parser* parser, const char* at, size_t len) {
-        hook(parser->data).current_kv_.first.assign(at, len);
+        auto& self = hook(parser->data);
+        if (self.in_value_) {
+            self.commit_header();
+        }
+        append(self.current_kv_.first, at, len);
         return 0;
     }
 
     static int on_header_value(http_parser* parser, const char* at, size_t len) {
-        hook(parser->data).current_kv_.second.assign(at, len);
-        hook(parser->data).result_.headers.insert(std::move(hook(parser->data).current_kv_));
+        auto& self = hook(parser->data);
+        self.in_value_ = true;
+        append(self.current_kv_.second, at, len);
         return 0;
     }
 
     static int on_headers_complete(http_parser* parser) {
-         hook(parser->data).result_.content_length = parser->content_length;
+        auto& self = hook(parser->data);
+        self.commit_header();
+        self.result_.content_length = parser->content_length;
+        self.state_ = HeadersComplete;
+        if (self.pause_after_headers_) {
+            http_parser_pause(parser, 1);
+        }
         return 0;
     }
 
     static int on_body(http_parser* parser, const char* at, size_t len) {
-        hook(parser->data).result_.body.append(at,len);
+        auto& self = hook(parser->data);
+        auto& result = self.result_;
+        if (self.stream_body_) {
+            self.chunks_.emplace_back(at, len);
+            return 0;
+        }
+
+        if constexpr (is_view) {
+            if (result.body.empty() || result.body.data() + result.body.size() == at) {
+                append(result.body, at, len);
+            } else {
+                // chunk framing sits between the pieces
+                if (result.body.data() != result.body_storage.data()) {
+                    result.body_storage.assign(result.body);
+                }
+                result.body_storage.append(at, len);
+                result.body = result.body_storage;
+            }
+        } else {
+            result.body.append(at, len);
+        }
         return 0;
     }
 
     static int on_message_complete(http_parser* parser) {
         hook(parser->data).state_ = Success;
+        http_parser_pause(parser, 1);
         return 0;
     }
 
@@ -121,41 +236,13 @@ private:
     State state_;
 
     T result_;
-    std::pair<std::string, std::string> current_kv_;
-};
-
-inline HttpRequestUrl parse_http_request_url(std::string_view url) {
-    // /your/path?a=b&c=d
-    HttpRequestUrl res;
-    size_t pos = 0;
-    for (; pos < url.length() && url[pos] != '?' && url[pos] == '/';) {
-        std::string path;
-        for (++pos; pos < url.length() && url[pos] != '/' && url[pos] != '?'; ++pos) {
-            path.push_back(url[pos]);
-        }
-        if (!path.empty()) {
-            res.path.push_back(std::move(path));
-        }
-    }
-
-    if (pos >= url.length()) {
-        return res;
-    }
+    std::pair<String, String> current_kv_;
+    bool in_value_ = false;
 
-    for (++pos; pos < url.length(); ++pos) {
-        std::string key;
-        std::string value;
-        for (; pos < url.length() && url[pos] != '='; ++pos) {
-            key.push_back(url[pos]);
-        }
-        for (++pos; pos < url.length() && url[pos] != '&'; ++pos) {
-            value.push_back(url[pos]);
-        }
-        res.query.emplace(std::move(key), std::move(value));
-    }
-
-    return res;
-}
+    bool pause_after_headers_ = false;
+    bool stream_body_ = false;
+    std::vector<std::string_view> chunks_;
+};
 
 }
 
@@ -0,0 +1,102 @@
+#include "cyno/http/HttpResponseWriter.h"
+
+#include <charconv>
+
+namespace cyno {
+
+static asio::const_buffer size_line(std::array<char, 20>& line, size_t size) {
+    char* end = std::to_chars(line.data(), line.data() + line.size() - 2, size, 16).ptr;
+    *end++ = '\r';
+    *end++ = '\n';
+    return asio::buffer(line.data(), end - line.data());
+}
+
+HttpResponseWriter::HttpResponseWriter(HttpStream& stream, HttpResponse& resp, bool head_only, bool close_delimited)
+    : stream_(stream)
+    , resp_(resp)
+    , head_only_(head_only)
+    , close_delimited_(close_delimited)
+{
+    buffer_.reserve(buffer_size);
+}
+
+void HttpResponseWriter::status(int status) {
+    resp_.status_code = static_cast<HttpResponse::Status>(status);
+    resp_.status = http_status_str(resp_.status_code);
+}
+
+asio::awaitable<void> HttpResponseWriter::write(std::string_view data) {
+    if (finished_) {
+        throw HttpResponseError("The response is already finished");
+    }
+    if (buffer_.length() + data.length() <= buffer_size) {
+        buffer_.append(data);
+        co_return;
+    }
+    co_await send(data, false);
+}
+
+asio::awaitable<void> HttpResponseWriter::flush() {
+    if (finished_) {
+        throw HttpResponseError("The response is already finished");
+    }
+    co_await send({}, false);
+}
+
+asio::awaitable<void> HttpResponseWriter::finish() {
+    if (!finished_) {
+        co_await send({}, true);
+    }
+}
+
+asio::awaitable<void> HttpResponseWriter::send(std::string_view data, bool last) {
+    static constexpr std::string_view crlf = "\r\n";
+    static constexpr std::string_view last_chunk = "0\r\n\r\n";
+
+    gather_.clear();
+    if (!started_) {
+        resp_.headers.erase(HttpField::ContentLength);
+        if (close_delimited_) {
+            resp_.headers.erase(HttpField::TransferEncoding);
+            resp_.headers[HttpField::Connection] = "close";
+            resp_.should_keep_alive = false;
+        } else {
+            resp_.headers[HttpField::TransferEncoding] = "chunked";
+        }
+        auto status_line = serialize_response_head(resp_, head_);
+        gather_.push_back(asio::buffer(status_line));
+        gather_.push_back(asio::buffer(head_));
+        started_ = true;
+    }
+
+    if (close_delimited_ && !head_only_) {
+        if (!buffer_.empty()) {
+            gather_.push_back(asio::buffer(buffer_));
+        }
+        if (!data.empty()) {
+            gather_.push_back(asio::buffer(data));
+        }
+    } else if (!head_only_) {
+        if (!buffer_.empty()) {
+            gather_.push_back(size_line(buffer_size_line_, buffer_.length()));
+            gather_.push_back(asio::buffer(buffer_));
+            gather_.push_back(asio::buffer(crlf));
+        }
+        if (!data.empty()) {
+            gather_.push_back(size_line(data_size_line_, data.length()));
+            gather_.push_back(asio::buffer(data));
+            gather_.push_back(asio::buffer(crlf));
+        }
+        if (last) {
+            gather_.push_back(asio::buffer(last_chunk));
+        }
+    }
+    finished_ = last;
+
+    if (!gather_.empty()) {
+        bytes_sent_ += co_await stream_.write(gather_);
+    }
+    buffer_.clear();
+}
+
+}
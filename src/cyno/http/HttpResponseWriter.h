@@ -0,0 +1,77 @@
+#ifndef CYNO_HTTP_RESPONSE_WRITER_H_
+#define CYNO_HTTP_RESPONSE_WRITER_H_
+
+#include <array>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "asio/awaitable.hpp"
+#include "asio/buffer.hpp"
+#include "cyno/http/HttpMessage.h"
+#include "cyno/http/HttpStream.h"
+
+namespace cyno {
+
+// Sends a response while it is being produced, as Transfer-Encoding: chunked.
+// HTTP/1.0 has no chunked framing, there the body ends when the connection is
+// closed, and the response is marked not to keep it alive. Small writes are
+// collected and sent as one chunk; every send completes only once the socket
+// took the data, so a slow client slows the producer down.
+class HttpResponseWriter {
+public:
+    // head_only for HEAD requests, the chunks are then dropped;
+    // close_delimited for HTTP/1.0 requests
+    HttpResponseWriter(HttpStream& stream, HttpResponse& resp, bool head_only = false, bool close_delimited = false);
+
+    // headers may be changed until the first send
+    HttpResponse& response() {
+        return resp_;
+    }
+
+    void status(int status);
+
+    // buffered up to buffer_size, a larger piece is sent without a copy
+    asio::awaitable<void> write(std::string_view data);
+    // sends the head the first time, then everything buffered
+    asio::awaitable<void> flush();
+    // sends the last chunk, the server calls it when the handler returns
+    asio::awaitable<void> finish();
+
+    // the head is out, an error can no longer become a response
+    bool started() const {
+        return started_;
+    }
+
+    bool finished() const {
+        return finished_;
+    }
+
+    // head and chunk framing included
+    size_t bytes_sent() const {
+        return bytes_sent_;
+    }
+
+    static constexpr size_t buffer_size = 16 * 1024;
+
+private:
+    asio::awaitable<void> send(std::string_view data, bool last);
+
+    HttpStream& stream_;
+    HttpResponse& resp_;
+    bool head_only_;
+    bool close_delimited_;
+    bool started_ = false;
+    bool finished_ = false;
+    size_t bytes_sent_ = 0;
+
+    std::string head_;
+    std::string buffer_;
+    // "<hex size>\r\n" of the buffered chunk and of the unbuffered piece
+    std::array<char, 20> buffer_size_line_;
+    std::array<char, 20> data_size_line_;
+    std::vector<asio::const_buffer> gather_;
+};
+
+}
+
+#endif
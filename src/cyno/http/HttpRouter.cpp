@@ -1,7 +1,14 @@
 #include "cyno/http/HttpRouter.h"
 
-#include <map>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_map>
 #include "cyno/base/Exceptions.h"
+#include "cyno/http/HttpUrl.h"
+#include "cyno/http/StaticFiles.h"
 
 namespace cyno {
 
@@ -100,15 +107,128 @@ struct RouteParser {
     std::vector<std::pair<TokenType, std::string_view>>::iterator current;
 };
 
-struct FuzzyComparable {
-    bool operator()(std::string_view left, std::string_view right) const {
-        return left.length() < right.length();
+constexpr size_t method_count = std::max({
+#define XX(num, name, string) num,
+    HTTP_METHOD_MAP(XX)
+#undef XX
+}) + 1;
+
+// Compressed radix tree over the bytes of static route text. A ":name"
+// capture hangs off the node where its segment starts, so matching walks the
+// url once and never depends on the number of routes.
+struct RouteNode {
+    using HttpRoute = HttpRouter::HttpRoute;
+
+    std::string prefix;
+    // first byte of each static child
+    std::string indices;
+    std::vector<std::unique_ptr<RouteNode>> children;
+
+    std::unique_ptr<RouteNode> param;
+    std::string param_name;
+
+    std::optional<HttpRoute> handler;
+    std::optional<HttpRoute> wildcard;
+
+    RouteNode* insert_static(std::string_view text) {
+        RouteNode* node = this;
+        while (!text.empty()) {
+            size_t idx = node->indices.find(text.front());
+            if (idx == std::string::npos) {
+                auto child = std::make_unique<RouteNode>();
+                child->prefix = text;
+                node->indices.push_back(text.front());
+                node->children.emplace_back(std::move(child));
+                return node->children.back().get();
+            }
+
+            auto& child = node->children[idx];
+            size_t common = 0;
+            for (; common < child->prefix.size() && common < text.size() 
+                    && child->prefix[common] == text[common]; ++common);
+
+            if (common < child->prefix.size()) {
+                // split the edge at the first difference
+                auto mid = std::make_unique<RouteNode>();
+                mid->prefix = child->prefix.substr(0, common);
+                child->prefix.erase(0, common);
+                mid->indices.push_back(child->prefix.front());
+                mid->children.emplace_back(std::move(child));
+                child = std::move(mid);
+            }
+
+            node = child.get();
+            text.remove_prefix(common);
+        }
+        return node;
+    }
+
+    RouteNode* insert_param(std::string_view name) {
+        if (!param) {
+            param = std::make_unique<RouteNode>();
+            param->param_name = name;
+        } else if (param->param_name != name) {
+            throw IllegalRouteError("Conflicting names for the same route capture");
+        }
+        return param.get();
+    }
+
+    // path is what is left of the url after this node's prefix
+    const HttpRoute* find(std::string_view path, PathParams& params) const {
+        if (path.empty() && handler) {
+            return &*handler;
+        }
+
+        if (!path.empty()) {
+            if (size_t idx = indices.find(path.front()); idx != std::string::npos) {
+                auto& child = children[idx];
+                if (path.starts_with(child->prefix)) {
+                    if (auto res = child->find(path.substr(child->prefix.size()), params)) {
+                        return res;
+                    }
+                }
+            }
+
+            if (param && path.front() != '/') {
+                auto value = path.substr(0, path.find('/'));
+                params.push(param->param_name, value);
+                if (auto res = param->find(path.substr(value.size()), params)) {
+                    return res;
+                }
+                params.pop();
+            }
+        }
+
+        if (wildcard) {
+            params.push("*", path);
+            return &*wildcard;
+        }
+        return nullptr;
     }
 };
 
 struct HttpRouter::Impl{
-    std::unordered_map<std::string, HttpHandler> exact_map;
-    std::map<std::string, HttpHandler, FuzzyComparable> fuzzy_map;
+    std::array<RouteNode, method_count> trees;
+    // GET routes with a response cache, see HttpRouter::cache
+    std::unordered_map<const HttpRoute*, size_t> cache_ttls;
+    // see HttpRouter::route_id
+    std::unordered_map<const HttpRoute*, size_t> route_ids;
+    std::vector<std::pair<http_method, std::string>> route_infos;
+    // see HttpRouter::table, numbered from table_first_id on
+    TableFind table_find = nullptr;
+    std::vector<HttpRoute> table_routes;
+    size_t table_first_id = 0;
+
+    // nullptr if route is not one of table_routes
+    const HttpRoute* table_route(const HttpRoute* route) const {
+        std::less<const HttpRoute*> less;
+        return table_routes.empty() || less(route, table_routes.data())
+            || !less(route, table_routes.data() + table_routes.size()) ? nullptr : route;
+    }
+
+    // where the route for path is stored, nodes are created on the way
+    // throw IllegalRouteError
+    std::optional<HttpRoute>& slot(http_method method, std::string_view path);
 };
 
 CLASS_PIMPL_IMPLEMENT(HttpRouter)
@@ -117,23 +237,177 @@ HttpRouter::HttpRouter() {
     impl = new Impl;
 }
 
+void HttpRouter::route(http_method method, std::string_view path, HttpHandler handler) {
+    insert_handler(method, path, std::move(handler));
+}
+
+void HttpRouter::route(http_method method, std::string_view path, HttpStreamHandler handler) {
+    insert_handler(method, path, std::move(handler));
+}
+
+void HttpRouter::route(http_method method, std::string_view path, HttpAsyncHandler handler) {
+    insert_handler(method, path, std::move(handler));
+}
+
+void HttpRouter::route(http_method method, std::string_view path, HttpChunkedHandler handler) {
+    insert_handler(method, path, std::move(handler));
+}
+
+void HttpRouter::route(http_method method, std::string_view path, WebSocketHandler handler) {
+    insert_handler(method, path, std::move(handler));
+}
+
 void HttpRouter::Get(std::string_view path, HttpHandler handler) {
-    insert_handler("GET", path, handler);
+    insert_handler(HTTP_GET, path, std::move(handler));
+}
+
+void HttpRouter::Get(std::string_view path, HttpAsyncHandler handler) {
+    insert_handler(HTTP_GET, path, std::move(handler));
+}
+
+void HttpRouter::Get(std::string_view path, HttpChunkedHandler handler) {
+    insert_handler(HTTP_GET, path, std::move(handler));
 }
 
 void HttpRouter::Post(std::string_view path, HttpHandler handler) {
-    insert_handler("POST", path, handler);
+    insert_handler(HTTP_POST, path, std::move(handler));
+}
+
+void HttpRouter::Post(std::string_view path, HttpStreamHandler handler) {
+    insert_handler(HTTP_POST, path, std::move(handler));
+}
+
+void HttpRouter::Post(std::string_view path, HttpAsyncHandler handler) {
+    insert_handler(HTTP_POST, path, std::move(handler));
+}
+
+void HttpRouter::Post(std::string_view path, HttpChunkedHandler handler) {
+    insert_handler(HTTP_POST, path, std::move(handler));
 }
 
 void HttpRouter::Put(std::string_view path, HttpHandler handler) {
-    insert_handler("PUT", path, handler);
+    insert_handler(HTTP_PUT, path, std::move(handler));
+}
+
+void HttpRouter::Put(std::string_view path, HttpStreamHandler handler) {
+    insert_handler(HTTP_PUT, path, std::move(handler));
+}
+
+void HttpRouter::Put(std::string_view path, HttpAsyncHandler handler) {
+    insert_handler(HTTP_PUT, path, std::move(handler));
 }
 
 void HttpRouter::Delete(std::string_view path, HttpHandler handler) {
-    insert_handler("DELETE", path, handler);
+    insert_handler(HTTP_DELETE, path, std::move(handler));
+}
+
+void HttpRouter::Delete(std::string_view path, HttpAsyncHandler handler) {
+    insert_handler(HTTP_DELETE, path, std::move(handler));
 }
 
-void HttpRouter::insert_handler(std::string_view method, std::string_view path, HttpHandler handler) {
+void HttpRouter::Ws(std::string_view path, WebSocketHandler handler) {
+    insert_handler(HTTP_GET, path, std::move(handler));
+}
+
+void HttpRouter::Static(std::string_view prefix, std::string root) {
+    auto files = std::make_shared<StaticFiles>(std::move(root));
+    std::string path(prefix);
+    if (!path.ends_with('/')) {
+        path.push_back('/');
+    }
+    path.push_back('*');
+
+    // the capture is still encoded, serve checks the decoded path since
+    // "%2e%2e" is ".." as well
+    HttpHandler handler = [files](HttpRequestView& req, HttpResponse& resp) {
+        auto raw = req.params["*"];
+        if (raw.find('%') == std::string_view::npos) {
+            return files->serve(req, resp, raw);
+        }
+        std::string path;
+        percent_decode(raw, path);
+        return files->serve(req, resp, path);
+    };
+    insert_handler(HTTP_GET, path, handler);
+    insert_handler(HTTP_HEAD, path, std::move(handler));
+}
+
+void HttpRouter::cache(std::string_view path, size_t ttl) {
+    const HttpRoute* route = nullptr;
+    for (size_t i = 0; i < impl->table_routes.size(); ++i) {
+        auto& info = impl->route_infos[impl->table_first_id + i];
+        if (info.first == HTTP_GET && info.second == path) {
+            route = &impl->table_routes[i];
+            break;
+        }
+    }
+    // by the text it was added with, slot() would leave nodes behind for a
+    // path that is not routed
+    for (auto it = impl->route_ids.begin(); !route && it != impl->route_ids.end(); ++it) {
+        auto& info = impl->route_infos[it->second];
+        if (info.first == HTTP_GET && info.second == path) {
+            route = it->first;
+        }
+    }
+    if (!route) {
+        throw IllegalRouteError("Cannot cache a route that does not exist");
+    }
+    if (!std::holds_alternative<HttpHandler>(*route) && !std::holds_alternative<HttpAsyncHandler>(*route)) {
+        throw IllegalRouteError("Only routes that return a whole response can be cached");
+    }
+    impl->cache_ttls[route] = ttl;
+}
+
+size_t HttpRouter::cache_ttl(const HttpRoute* route) const {
+    if (impl->cache_ttls.empty() || !route) {
+        return 0;
+    }
+    auto it = impl->cache_ttls.find(route);
+    return it == impl->cache_ttls.end() ? 0 : it->second;
+}
+
+void HttpRouter::insert_handler(http_method method, std::string_view path, HttpRoute handler) {
+    auto& slot = impl->slot(method, path);
+    if (!slot) {
+        slot = std::move(handler);
+        impl->route_ids.emplace(&*slot, impl->route_infos.size());
+        impl->route_infos.emplace_back(method, path);
+    }
+}
+
+void HttpRouter::insert_table(TableFind find, std::vector<std::pair<http_method, std::string_view>> infos,
+    std::vector<HttpRoute> routes)
+{
+    if (impl->table_find) {
+        throw IllegalRouteError("A router takes one route table");
+    }
+    impl->table_find = find;
+    impl->table_routes = std::move(routes);
+    impl->table_first_id = impl->route_infos.size();
+    for (auto& [method, path] : infos) {
+        impl->route_infos.emplace_back(method, path);
+    }
+}
+
+size_t HttpRouter::route_count() const {
+    return impl->route_infos.size();
+}
+
+size_t HttpRouter::route_id(const HttpRoute* route) const {
+    // no hashing for the table
+    if (impl->table_route(route)) {
+        return impl->table_first_id + static_cast<size_t>(route - impl->table_routes.data());
+    }
+    auto it = route ? impl->route_ids.find(route) : impl->route_ids.end();
+    return it == impl->route_ids.end() ? impl->route_infos.size() : it->second;
+}
+
+std::pair<http_method, std::string_view> HttpRouter::route_info(size_t id) const {
+    auto& info = impl->route_infos.at(id);
+    return {info.first, info.second};
+}
+
+std::optional<HttpRouter::HttpRoute>& HttpRouter::Impl::slot(http_method method, std::string_view path) {
     if (path.empty()) {
         throw IllegalRouteError("Route cannot be empty");
     }
@@ -143,38 +417,80 @@ void HttpRouter::insert_handler(std::string_view method, std::string_view path,
         throw IllegalRouteError("Route syntax error");
     }
 
-    if (path.ends_with("*")) {
-        impl->fuzzy_map.emplace(std::string(method).append(path), std::move(handler));
-    } else {
-        impl->exact_map.emplace(std::string(method).append(path), std::move(handler));
+    if (static_cast<size_t>(method) >= method_count) {
+        throw IllegalRouteError("Unknown http method");
     }
-}
 
-HttpRouter::HttpHandler& HttpRouter::match(std::string_view method, const std::vector<std::string>& path) {
-    std::string join_path(method);
-    if (path.empty()) {
-        join_path.append("/");
+    RouteNode* node = &trees[method];
+    size_t captures = 0;
+    for (size_t pos = 0; pos < path.length();) {
+        if (path[pos] == '*') {
+            if (++captures > PathParams::max_size) {
+                throw IllegalRouteError("Too many captures in route");
+            }
+            return node->wildcard;
+        }
+
+        if (path[pos] == ':' && path[pos - 1] == '/') {
+            size_t end = std::min(path.find('/', pos), path.length());
+            if (end == pos + 1) {
+                throw IllegalRouteError("Route capture needs a name");
+            }
+            if (++captures > PathParams::max_size) {
+                throw IllegalRouteError("Too many captures in route");
+            }
+            node = node->insert_param(path.substr(pos + 1, end - pos - 1));
+            pos = end;
+            continue;
+        }
+
+        size_t end = pos + 1;
+        for (; end < path.length() && path[end] != '*' 
+                && !(path[end] == ':' && path[end - 1] == '/'); ++end);
+        node = node->insert_static(path.substr(pos, end - pos));
+        pos = end;
     }
-    for (auto& str : path) {
-        join_path.append("/");
-        join_path.append(str);
+    return node->handler;
+}
+
+const HttpRouter::HttpRoute& HttpRouter::match(http_method method, std::string_view url, PathParams& params) const {
+    if (auto res = find(method, url, params)) {
+        return *res;
     }
 
-    if (auto it = impl->exact_map.find(join_path); it != impl->exact_map.end()) {
-        return it->second;
+    throw NotMatchPathError("The requested path did not find a match in the routes");  
+}
+
+const HttpRouter::HttpRoute* HttpRouter::find(http_method method, std::string_view url, PathParams& params) const {
+    // find_first_of searches the set once per byte of url
+    size_t end = 0;
+    for (; end < url.size() && url[end] != '?' && url[end] != '#'; ++end);
+    auto path = url.substr(0, end);
+    if (static_cast<size_t>(method) >= method_count) {
+        return nullptr;
     }
 
-    for (auto&& [route, handler] : impl->fuzzy_map) {
-        if (route.length() > join_path.length()) {
-            break;
+    params.clear();
+    auto& root = impl->trees[method];
+    auto lookup = [&](std::string_view candidate) -> const HttpRoute* {
+        if (impl->table_find) {
+            if (auto res = impl->table_find(impl->table_routes.data(), method, candidate, params)) {
+                return res;
+            }
         }
+        return root.find(candidate, params);
+    };
 
-        if (route.compare(0, route.length() - 1, join_path, 0, route.length() - 1) == 0) {
-            return handler;
-        }
+    if (auto res = lookup(path)) {
+        return res;
     }
 
-    throw NotMatchPathError("The requested path did not find a match in the routes");  
+    // "/login/" finds "/login", but only if no route takes "/login/" itself
+    if (path.length() > 1 && path.ends_with('/')) {
+        params.clear();
+        return lookup(path.substr(0, path.length() - 1));
+    }
+    return nullptr;
 }
 
 }
\ No newline at end of file
@@ -2,32 +2,100 @@
 #define CYNO_HTTP_ROUTER_H_
 
 #include <functional>
+#include <memory>
+#include <utility>
+#include <variant>
+#include <vector>
+#include "asio/awaitable.hpp"
 #include "cyno/base/Pimpl.h"
+#include "cyno/http/HttpBodyReader.h"
 #include "cyno/http/HttpMessage.h"
+#include "cyno/http/HttpResponseWriter.h"
+#include "cyno/http/WebSocket.h"
 
 namespace cyno {
 
+template<typename... Routes>
+struct RouteTable;
+
+// Routes look like "/users/:id/posts" or "/static/*". A ":name" segment
+// captures one path segment, a trailing '*' captures the rest of the path.
+// Static segments win over captures, and the longest '*' prefix wins.
 class HttpRouter {
 
     CLASS_PIMPL_DECLARE(HttpRouter)
 
 public:
     HttpRouter();
-    using HttpHandler = std::function<int(HttpRequest&, HttpResponse&)>;
+    using HttpHandler = std::function<int(HttpRequestView&, HttpResponse&)>;
+    // may co_await I/O, other connections on the loop go on meanwhile
+    using HttpAsyncHandler = std::function<asio::awaitable<int>(HttpRequestView&, HttpResponse&)>;
+    // called when the headers are in, the reader then gets the body as it arrives
+    using HttpStreamHandler = std::function<std::unique_ptr<HttpBodyReader>(HttpRequestView&)>;
+    // writes the response body piece by piece, see HttpResponseWriter
+    using HttpChunkedHandler = std::function<asio::awaitable<void>(HttpRequestView&, HttpResponseWriter&)>;
+    // takes over the connection after the handshake, req stays valid until it returns
+    using WebSocketHandler = std::function<asio::awaitable<void>(HttpRequestView&, WebSocket&)>;
+    using HttpRoute = std::variant<HttpHandler, HttpStreamHandler, HttpAsyncHandler, HttpChunkedHandler, WebSocketHandler>;
 
+    void route(http_method method, std::string_view path, HttpHandler handler);
+    void route(http_method method, std::string_view path, HttpStreamHandler handler);
+    void route(http_method method, std::string_view path, HttpAsyncHandler handler);
+    void route(http_method method, std::string_view path, HttpChunkedHandler handler);
+    void route(http_method method, std::string_view path, WebSocketHandler handler);
     void Get(std::string_view path, HttpHandler handler);
+    void Get(std::string_view path, HttpAsyncHandler handler);
+    void Get(std::string_view path, HttpChunkedHandler handler);
     void Post(std::string_view path, HttpHandler handler);
+    void Post(std::string_view path, HttpStreamHandler handler);
+    void Post(std::string_view path, HttpAsyncHandler handler);
+    void Post(std::string_view path, HttpChunkedHandler handler);
     void Put(std::string_view path, HttpHandler handler);
+    void Put(std::string_view path, HttpStreamHandler handler);
+    void Put(std::string_view path, HttpAsyncHandler handler);
     void Delete(std::string_view path, HttpHandler handler);
+    void Delete(std::string_view path, HttpAsyncHandler handler);
+    // GET with "Upgrade: websocket", any other GET fails with HttpRequestError
+    void Ws(std::string_view path, WebSocketHandler handler);
+    // GET and HEAD of "prefix/..." serve the files below root, see StaticFiles
+    void Static(std::string_view prefix, std::string root);
+    // Routes known at compile time, matched before any route added at
+    // runtime. One table per router, see RouteTable.h.
+    // throw IllegalRouteError
+    template<typename... Routes>
+    void table(RouteTable<Routes...>);
+
+    // Responses of the GET route at path are cached for ttl milliseconds,
+    // see ResponseCache. The route must be added first.
+    void cache(std::string_view path, size_t ttl);
+    // 0 if the route is not cached
+    size_t cache_ttl(const HttpRoute* route) const;
 
-    HttpHandler& match(std::string_view method, const std::vector<std::string>& path);
+    // Routes are numbered 0..route_count() - 1 in the order they were added,
+    // e.g. for per route metrics. nullptr is numbered route_count().
+    size_t route_count() const;
+    size_t route_id(const HttpRoute* route) const;
+    // method and path as registered, e.g. GET "/users/:id"
+    std::pair<http_method, std::string_view> route_info(size_t id) const;
+
+    // throw NotMatchPathError
+    // url may carry a query, captures are written to params
+    const HttpRoute& match(http_method method, std::string_view url, PathParams& params) const;
+    // nullptr if nothing matches
+    const HttpRoute* find(http_method method, std::string_view url, PathParams& params) const;
 private:
+    using TableFind = const HttpRoute* (*)(const HttpRoute* routes, http_method method, std::string_view path,
+        PathParams& params);
+
     // throw
-    void insert_handler(std::string_view method, std::string_view path, HttpHandler handler);
+    void insert_handler(http_method method, std::string_view path, HttpRoute handler);
+    // throw IllegalRouteError
+    void insert_table(TableFind find, std::vector<std::pair<http_method, std::string_view>> infos,
+        std::vector<HttpRoute> routes);
 };
 
 }
 
 
 
-#endif
\ No newline at end of file
+#endif
@@ -1,59 +1,302 @@
 #include "cyno/http/HttpRouter.h"
 #include "cyno/http/HttpServer.h"
 
+#include <atomic>
+#include <charconv>
+#include <memory_resource>
+#include <optional>
+#include <thread>
+#include <variant>
 #include "spdlog/spdlog.h"
 #include "asio/ip/tcp.hpp"
 #include "asio/co_spawn.hpp"
 #include "asio/detached.hpp"
 #include "asio/awaitable.hpp"
-#include "asio/read_until.hpp"
 #include "asio/write.hpp"
-#include "asio/steady_timer.hpp"
+#include "asio/post.hpp"
+#include "asio/io_context.hpp"
+#include "asio/strand.hpp"
 
 #include "cyno/base/ResourcePool.h"
+#include "cyno/base/TimingWheel.h"
+#include "cyno/http/Http2Session.h"
 #include "cyno/http/HttpParser.h"
 #include "cyno/http/HttpConfig.h"
+#include "cyno/http/HttpMetrics.h"
+#include "cyno/http/HttpResponseWriter.h"
+#include "cyno/http/HttpStream.h"
+#include "cyno/http/ResponseCache.h"
+#include "cyno/http/StaticFiles.h"
+#include "cyno/http/WebSocket.h"
+
+#include <array>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/sendfile.h>
+#endif
 
 namespace cyno {
 
 using namespace std::chrono_literals;
 
-struct HttpServer::Impl {
-    inline static std::pmr::synchronized_pool_resource sync_pool;
-
-    State state;
-    asio::any_io_executor executor;
-    asio::ip::tcp::acceptor acceptor;
+#ifdef SO_REUSEPORT
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
 
-    HttpRouter router;
-    std::unique_ptr<ExceptionHandler> exception_handler;
-    std::vector<std::unique_ptr<HttpInterceptor>> interceptors;
+// io_context::shutdown is protected. Calling it before the loop members are
+// destroyed lets pending coroutines return their buffers to a live pool.
+struct LoopContext: asio::io_context {
+    using asio::io_context::io_context;
+    using asio::io_context::shutdown;
+};
 
+// one reactor: executor, acceptor and buffer pool, touched by one thread
+struct EventLoop {
+    std::unique_ptr<LoopContext> context;
+    asio::any_io_executor executor;
+    std::unique_ptr<std::pmr::memory_resource> buffer_memory;
+    asio::ip::tcp::acceptor acceptor{executor};
+    // read timeouts of every connection on the loop
+    TimingWheel wheel{executor, std::chrono::milliseconds(http_config.server_config.timer_tick)};
     ResourcePool<std::pmr::string> buffer_resource{
         executor, 
         PoolConfig(http_config.buffer_pool_config),
-        []{
-            std::pmr::string str(&ResourcePool<std::pmr::string>::pool_resource);
+        [this]{
+            std::pmr::string str(buffer_memory.get());
             str.reserve(http_config.request_config.max_line_and_headers_size);
             return str;
         }};
+    // nullptr unless metrics are enabled
+    MetricShard* metrics = nullptr;
+    // admission control, see AdmissionConfig
+    std::atomic<size_t> connections = 0;
+    std::atomic<size_t> inflight = 0;
+    // how late the last lag probe fired, in microseconds
+    std::atomic<uint64_t> lag = 0;
+    asio::steady_timer lag_probe{executor};
+    std::thread thread;
+
+    // the caller may run its executor on several threads
+    explicit EventLoop(asio::any_io_executor ex)
+        : executor(ex)
+        , buffer_memory(std::make_unique<std::pmr::synchronized_pool_resource>())
+    {}
+
+    EventLoop()
+        : context(std::make_unique<LoopContext>(1))
+        , executor(context->get_executor())
+        , buffer_memory(std::make_unique<std::pmr::unsynchronized_pool_resource>())
+    {}
+};
+
+// counts a request in EventLoop::inflight while it is handled
+struct InflightGuard {
+    std::atomic<size_t>& count;
+
+    explicit InflightGuard(std::atomic<size_t>& c): count(c) {
+        count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    ~InflightGuard() {
+        count.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// holds the admission slot run_accept took for a connection, and counts it
+// as open in the metrics, until process() returns or throws
+struct ConnectionGuard {
+    EventLoop& loop;
+
+    explicit ConnectionGuard(EventLoop& l): loop(l) {
+        if (loop.metrics) {
+            loop.metrics->connection_opened();
+        }
+    }
+
+    ~ConnectionGuard() {
+        if (loop.metrics) {
+            loop.metrics->connection_closed();
+        }
+        loop.connections.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// Gives a borrowed buffer back to the pool at its initial capacity. A large
+// request or a WebSocket session may have grown it, and the pool would
+// otherwise keep that memory for as long as the buffer stays idle.
+struct BufferTrim {
+    std::pmr::string& buffer;
+    size_t capacity;
+
+    ~BufferTrim() {
+        if (buffer.capacity() > capacity) {
+            std::pmr::string fresh(buffer.get_allocator());
+            fresh.reserve(capacity);
+            buffer = std::move(fresh);
+        }
+    }
+};
+
+// responses of pipelined requests, flushed in one gather write;
+// current() is always a fresh response for the request being parsed
+struct ResponseQueue {
+    // Header fields of the responses are allocated here instead of one by
+    // one from the heap, and forgotten at once when nothing is queued.
+    std::vector<std::byte> arena_buffer;
+    std::pmr::monotonic_buffer_resource arena;
+    std::vector<HttpResponse> responses;
+    std::vector<std::string> heads;
+    std::vector<asio::const_buffer> gather;
+    size_t pending = 0;
+
+    // upstream takes what does not fit into arena_size
+    ResponseQueue(std::pmr::memory_resource* upstream, size_t arena_size)
+        : arena_buffer(std::max<size_t>(arena_size, 1))
+        , arena(arena_buffer.data(), arena_buffer.size(), upstream)
+    {
+        reset_current();
+    }
 
-    asio::awaitable<void> run_accept();
-    asio::awaitable<void> process(asio::ip::tcp::socket socket);
-    void dispatch(HttpRequest&, HttpResponse&);
+    HttpResponse& current() {
+        return responses[pending];
+    }
+
+    void reset_current() {
+        if (pending == responses.size()) {
+            responses.emplace_back(&arena);
+        }
+        responses[pending].reset();
+    }
+
+    // Only once every response is sent and the current one is untouched.
+    // The field arrays are kept, the fields in them go with the arena.
+    void release_arena() {
+        for (auto& resp : responses) {
+            resp.headers.clear();
+        }
+        arena.release();
+        responses[pending].reset();
+    }
+
+    void push() {
+        ++pending;
+        reset_current();
+    }
+
+    // returns the bytes written
+    asio::awaitable<size_t> flush(HttpStream& stream);
+};
+
+struct HttpServer::Impl {
+    inline static std::pmr::synchronized_pool_resource sync_pool;
+
+    std::atomic<State> state = Stopped;
+    std::vector<std::unique_ptr<EventLoop>> loops;
+    std::atomic<size_t> next_loop = 0;
+
+    // read-only once started
+    HttpRouter router;
+    std::unique_ptr<ExceptionHandler> exception_handler;
+    std::vector<std::variant<std::unique_ptr<HttpInterceptor>, std::unique_ptr<AsyncHttpInterceptor>>> interceptors;
+    bool async_interceptors = false;
+    ResponseCache response_cache;
+    // empty if not enabled
+    std::string metrics_path;
+    std::unique_ptr<HttpMetrics> metrics;
+    // per loop shares of AdmissionConfig, 0 = unlimited
+    size_t connection_limit = 0;
+    size_t inflight_limit = 0;
+    // 503 with Retry-After, built on start()
+    std::shared_ptr<const std::string> overloaded;
+    std::shared_ptr<const std::string> overloaded_close;
+#ifdef CYNO_ENABLE_SSL
+    // every connection is TLS if set
+    std::unique_ptr<asio::ssl::context> tls_context;
+#endif
+
+    ~Impl();
+    bool tls_enabled() const {
+#ifdef CYNO_ENABLE_SSL
+        return tls_context != nullptr;
+#else
+        return false;
+#endif
+    }
+    void enable_metrics();
+    void enable_admission();
+    EventLoop& pick_loop(EventLoop& accepting);
+    asio::awaitable<void> run_accept(EventLoop& loop);
+    asio::awaitable<void> probe_lag(EventLoop& loop);
+    // a new request gets the 503 instead of a handler
+    bool overloaded_now(EventLoop& loop) const;
+    asio::awaitable<void> process(EventLoop& loop, asio::ip::tcp::socket socket);
+    // the rest of the connection, upgrade is the "Upgrade: h2c" request if any
+    asio::awaitable<void> serve_http2(EventLoop& loop, HttpStream& stream,
+        const HttpRequestView* upgrade, std::string_view received);
+    // the rest of the connection, accepted is the 101 answering req;
+    // req is buffer up to begin, the frames come after it
+    asio::awaitable<void> serve_websocket(EventLoop& loop, HttpStream& stream, const HttpRouter::WebSocketHandler& handler,
+        HttpRequestView& req, const std::string& accepted, std::pmr::string& buffer, size_t begin, WebSocket::OnMove on_move);
+    // one HTTP/2 stream, with the same routes and interceptors as HTTP/1
+    asio::awaitable<void> dispatch_http2(EventLoop& loop, HttpRequestView&, HttpResponse&);
+    void before(HttpRequestView&, HttpResponse&);
+    void after(HttpRequestView&, HttpResponse&);
+    void dispatch(const HttpRouter::HttpRoute* route, HttpRequestView&, HttpResponse&);
+    // used when an interceptor or the handler has to be awaited
+    asio::awaitable<void> before_async(HttpRequestView&, HttpResponse&);
+    asio::awaitable<void> after_async(HttpRequestView&, HttpResponse&);
+    asio::awaitable<void> dispatch_async(const HttpRouter::HttpRoute* route, HttpRequestView&, HttpResponse&);
+    asio::awaitable<void> dispatch_cached(const HttpRouter::HttpRoute* route, size_t ttl, HttpRequestView&, HttpResponse&);
 };
 
 void perfect_response(HttpResponse&, int status);
+asio::awaitable<void> send_file(HttpStream& stream, const HttpFileBody& file);
 
 CLASS_PIMPL_IMPLEMENT(HttpServer)
 
 HttpServer::HttpServer(asio::any_io_executor executor) {
-    impl = new Impl{Stopped, executor, asio::ip::tcp::acceptor{executor}};
+    impl = new Impl;
+    impl->loops.emplace_back(std::make_unique<EventLoop>(executor));
+}
+
+HttpServer::HttpServer() {
+    impl = new Impl;
+    size_t n = http_config.server_config.event_loops;
+    if (n == 0) {
+        n = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 0; i < n; ++i) {
+        impl->loops.emplace_back(std::make_unique<EventLoop>());
+    }
 }
 
 void HttpServer::bind(std::string_view host, unsigned port) {
     asio::ip::tcp::endpoint ep(asio::ip::make_address(host), port);
-    impl->acceptor = asio::ip::tcp::acceptor(impl->executor, ep);
+
+    bool sharded = impl->loops.size() > 1 && http_config.server_config.reuse_port;
+#ifndef SO_REUSEPORT
+    sharded = false;
+#endif
+    if (!sharded) {
+        // loop 0 accepts and hands sockets out round robin
+        auto& loop = *impl->loops.front();
+        loop.acceptor = asio::ip::tcp::acceptor(loop.executor, ep);
+        return;
+    }
+
+#ifdef SO_REUSEPORT
+    // the kernel spreads connections over one listening socket per loop
+    for (auto& loop : impl->loops) {
+        asio::ip::tcp::acceptor acceptor(loop->executor);
+        acceptor.open(ep.protocol());
+        acceptor.set_option(asio::socket_base::reuse_address(true));
+        acceptor.set_option(reuse_port(true));
+        acceptor.bind(ep);
+        acceptor.listen();
+        loop->acceptor = std::move(acceptor);
+    }
+#endif
 }
 
 void HttpServer::routes(HttpRouter router) {
@@ -64,30 +307,192 @@ void HttpServer::add_interceptor(std::unique_ptr<HttpInterceptor> interceptor) {
     impl->interceptors.emplace_back(std::move(interceptor));
 }
 
+void HttpServer::add_interceptor(std::unique_ptr<AsyncHttpInterceptor> interceptor) {
+    impl->interceptors.emplace_back(std::move(interceptor));
+    impl->async_interceptors = true;
+}
+
 void HttpServer::exception_handler(std::unique_ptr<ExceptionHandler> handler) {
     impl->exception_handler = std::move(handler);
 }
 
+void HttpServer::enable_metrics(std::string path) {
+    impl->metrics_path = std::move(path);
+}
+
+#ifdef CYNO_ENABLE_SSL
+void HttpServer::enable_tls(const std::string& cert_chain_file, const std::string& private_key_file) {
+    impl->tls_context = make_server_tls_context(cert_chain_file, private_key_file);
+}
+#endif
+
 void HttpServer::start() {
+    if (!impl->metrics_path.empty() && !impl->metrics) {
+        impl->enable_metrics();
+    }
+    impl->enable_admission();
+
     impl->state = Running;
-    asio::co_spawn(impl->executor, impl->run_accept(), asio::detached);
+    for (size_t i = 0; i < impl->loops.size(); ++i) {
+        auto& loop = *impl->loops[i];
+        if (loop.acceptor.is_open()) {
+            asio::co_spawn(loop.executor, impl->run_accept(loop), asio::detached);
+        }
+        if (http_config.admission_config.max_queue_time > 0) {
+            asio::co_spawn(loop.executor, impl->probe_lag(loop), asio::detached);
+        }
+
+        if (!loop.context) {
+            continue;
+        }
+
+        loop.thread = std::thread([context = loop.context.get()] {
+            context->run();
+        });
+#ifdef __linux__
+        if (http_config.server_config.pin_cpu) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(i % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+            pthread_setaffinity_np(loop.thread.native_handle(), sizeof(cpus), &cpus);
+        }
+#endif
+    }
 }
 
 void HttpServer::stop() {
     impl->state = Stopped;
+    for (auto& loop : impl->loops) {
+        if (loop->context) {
+            loop->context->stop();
+        } else {
+            asio::post(loop->executor, [&acceptor = loop->acceptor, &lag_probe = loop->lag_probe] {
+                asio::error_code err;
+                acceptor.close(err);
+                lag_probe.cancel();
+            });
+        }
+    }
+}
+
+void HttpServer::join() {
+    for (auto& loop : impl->loops) {
+        if (loop->thread.joinable()) {
+            loop->thread.join();
+        }
+    }
 }
 
-asio::awaitable<void> HttpServer::Impl::run_accept() {
+HttpServer::Impl::~Impl() {
+    for (auto& loop : loops) {
+        if (loop->thread.joinable()) {
+            loop->context->stop();
+            loop->thread.join();
+        }
+    }
+    for (auto& loop : loops) {
+        if (loop->context) {
+            loop->context->shutdown();
+        }
+    }
+}
+
+void HttpServer::Impl::enable_metrics() {
+    router.Get(metrics_path, [this](HttpRequestView&, HttpResponse& resp) {
+        PoolStats buffers;
+        for (auto& loop : loops) {
+            buffers.active += loop->buffer_resource.active_size();
+            buffers.idle += loop->buffer_resource.idle_size();
+            buffers.exhausted += loop->buffer_resource.exhausted_count();
+        }
+        metrics->render(router, buffers, resp.body);
+        resp.headers[HttpField::ContentType] = "text/plain; version=0.0.4; charset=utf-8";
+        return HTTP_STATUS_OK;
+    });
+
+    // the metrics route is counted too
+    metrics = std::make_unique<HttpMetrics>(loops.size(), router.route_count());
+    for (size_t i = 0; i < loops.size(); ++i) {
+        loops[i]->metrics = &metrics->shard(i);
+    }
+}
+
+void HttpServer::Impl::enable_admission() {
+    const auto& config = http_config.admission_config;
+    auto share = [n = loops.size()](size_t limit) {
+        return limit == 0 ? 0 : (limit + n - 1) / n;
+    };
+    connection_limit = share(config.max_connections);
+    inflight_limit = share(config.max_inflight);
+
+    HttpResponse resp = HttpResponse::from_default();
+    resp.headers[HttpField::RetryAfter] = std::to_string(config.retry_after);
+    perfect_response(resp, HTTP_STATUS_SERVICE_UNAVAILABLE);
+    overloaded = std::make_shared<const std::string>(serialize_response(resp));
+    resp.headers[HttpField::Connection] = "close";
+    overloaded_close = std::make_shared<const std::string>(serialize_response(resp));
+}
+
+bool HttpServer::Impl::overloaded_now(EventLoop& loop) const {
+    return (inflight_limit > 0 && loop.inflight.load(std::memory_order_relaxed) >= inflight_limit)
+        || (http_config.admission_config.max_queue_time > 0 
+            && loop.lag.load(std::memory_order_relaxed) > http_config.admission_config.max_queue_time * 1000);
+}
+
+// A timer that fires late means handlers are queued up on the loop, and a
+// new request would wait about as long before it is even looked at.
+asio::awaitable<void> HttpServer::Impl::probe_lag(EventLoop& loop) {
+    auto interval = std::chrono::milliseconds(std::max<size_t>(http_config.admission_config.max_queue_time / 4, 1));
     try {
         for (; state == Running;) {
-            asio::ip::tcp::socket socket(acceptor.get_executor());
-            
-            co_await acceptor.async_accept(socket, asio::use_awaitable);
+            auto expected = std::chrono::steady_clock::now() + interval;
+            loop.lag_probe.expires_at(expected);
+            co_await loop.lag_probe.async_wait(asio::use_awaitable);
+            auto late = std::chrono::steady_clock::now() - expected;
+            loop.lag.store(std::chrono::duration_cast<std::chrono::microseconds>(late).count(), std::memory_order_relaxed);
+        }
+    } catch(const std::system_error&) {
+        // cancelled on stop()
+    }
+}
 
-            asio::co_spawn(acceptor.get_executor(), 
-                [this, sock = std::move(socket)]() mutable 
+EventLoop& HttpServer::Impl::pick_loop(EventLoop& accepting) {
+    if (loops.size() == 1 || loops.back()->acceptor.is_open()) {
+        return accepting;
+    }
+    return *loops[next_loop.fetch_add(1, std::memory_order_relaxed) % loops.size()];
+}
+
+asio::awaitable<void> HttpServer::Impl::run_accept(EventLoop& loop) {
+    try {
+        for (; state == Running;) {
+            EventLoop& target = pick_loop(loop);
+            auto socket = co_await loop.acceptor.async_accept(target.executor, asio::use_awaitable);
+
+            // Over the limit, or no buffer free: answer at once instead of letting
+            // the connection wait wait_timeout for a buffer. Never blocks the acceptor.
+            if ((connection_limit > 0 && target.connections.load(std::memory_order_relaxed) >= connection_limit)
+                || target.buffer_resource.active_size() >= http_config.buffer_pool_config.max_active_size) 
+            {
+                asio::error_code err;
+                socket.non_blocking(true, err);
+                // a TLS client would not understand it before the handshake
+                if (!tls_enabled()) {
+                    socket.write_some(asio::buffer(*overloaded_close), err);
+                }
+                socket.close(err);
+                if (target.metrics) {
+                    target.metrics->connection_rejected();
+                }
+                continue;
+            }
+            // process() gives it back
+            target.connections.fetch_add(1, std::memory_order_relaxed);
+
+            asio::co_spawn(target.executor, 
+                [this, &target, sock = std::move(socket)]() mutable 
                 {
-                    return process(std::move(sock));
+                    return process(target, std::move(sock));
                 },
                 asio::detached);
         }
@@ -96,120 +501,728 @@ asio::awaitable<void> HttpServer::Impl::run_accept() {
     }
 }
 
-asio::awaitable<void> HttpServer::Impl::process(asio::ip::tcp::socket socket) {
-    // 
-    HttpParser<HttpRequest> parser;
-    HttpRequest& req = parser.result();
-    HttpResponse resp = HttpResponse::from_default();
-    asio::steady_timer deadline(executor);
+// Fields the before-interceptors set, e.g. a cookie, go out with the 101.
+// accepted is the handshake response, ending with its blank line.
+static void append_upgrade_fields(std::string& accepted, const HttpHeaders& fields) {
+    accepted.resize(accepted.size() - 2);
+    for (auto& field : fields) {
+        switch (field.id) {
+        case HttpField::Connection:
+        case HttpField::KeepAlive:
+        case HttpField::ContentLength:
+        case HttpField::TransferEncoding:
+        case HttpField::Upgrade:
+        case HttpField::SecWebSocketAccept:
+            continue;
+        default:
+            break;
+        }
+        accepted.append(field.name);
+        accepted.append(": ");
+        accepted.append(field.value);
+        accepted.append("\r\n");
+    }
+    accepted.append("\r\n");
+}
 
-    auto check_deadline = [&socket, &deadline] {
-        deadline.async_wait([&socket](asio::error_code err) {
-            if (!err) {
-                socket.close();
-            }
-        });
+asio::awaitable<void> HttpServer::Impl::process(EventLoop& loop, asio::ip::tcp::socket socket) {
+    ConnectionGuard guard(loop);
+    const auto& config = http_config.request_config;
+    const size_t max_request_size = config.max_line_and_headers_size + config.max_body_size;
+
+    HttpStream stream(std::move(socket));
+    HttpParser<HttpRequestView> parser;
+    HttpRequestView& req = parser.result();
+    // closing the socket fails the pending read
+    TimingWheel::Entry deadline([&stream] {
+        asio::error_code err;
+        stream.socket().close(err);
+    });
+
+    ResponseQueue queue(loop.buffer_memory.get(), http_config.request_config.response_arena_size);
+    MetricShard* metrics = loop.metrics;
+
+    // false if there is no handler and the connection is dropped instead
+    auto handle_error = [this](HttpResponse& resp) {
+        if (!exception_handler) {
+            return false;
+        }
+        int status = exception_handler->handle(std::current_exception(), resp);
+        perfect_response(resp, status);
+        return true;
     };
     
     try {
+#ifdef CYNO_ENABLE_SSL
+        if (tls_enabled()) {
+            loop.wheel.schedule(deadline, std::chrono::milliseconds(config.receive_headers_timeout));
+            co_await stream.accept_tls(*tls_context);
+            loop.wheel.cancel(deadline);
+        }
+#endif
+        // HTTP/2 by prior knowledge on cleartext, by ALPN under TLS
+        const bool http2 = stream.is_tls() 
+            ? stream.alpn() == "h2"
+            : http_config.http2_config.h2c;
+
         // borrow buffer
-        auto buffer = co_await buffer_resource.borrow();
+        auto buffer = co_await loop.buffer_resource.borrow();
+        BufferTrim trim{*buffer, http_config.request_config.max_line_and_headers_size};
+        buffer->clear();
+        parser.pause_after_headers(true);
+
+        // [request_begin, parsed) is the request being parsed, 
+        // [parsed, size) was read but not parsed yet
+        size_t request_begin = 0;
+        size_t parsed = 0;
+        bool keep_alive = true;
+
+        // the request being parsed
+        bool routed = false;
+        std::chrono::steady_clock::time_point routed_at;
+        const HttpRouter::HttpRoute* route = nullptr;
+        std::unique_ptr<HttpBodyReader> reader;
+        size_t stream_begin = 0;
+        size_t streamed = 0;
+        // nothing was answered yet, so the HTTP/2 preface may still come
+        bool fresh = true;
+        bool upgrade_h2c = false;
+        // the route the connection is handed to after its 101
+        const HttpRouter::WebSocketHandler* websocket = nullptr;
+        std::string websocket_accepted;
 
         for (; ;) {
-            buffer->clear();
-            
-            // set timeout
-            if (req.should_keep_alive) {
-                deadline.expires_after(
-                    std::chrono::milliseconds(http_config.request_config.keepalive_timeout));
-            } else {
-                deadline.expires_after(
-                    std::chrono::milliseconds(http_config.request_config.receive_headers_timeout));
-            }
-            
-            check_deadline();
-
-            // read until \r\n\r\n
-            co_await asio::async_read_until(socket, asio::dynamic_buffer(*buffer),
-                                            "\r\n\r\n", asio::use_awaitable);
-            
-            // refresh deadline and set for receive body task
-            deadline.expires_after(
-                std::chrono::milliseconds(http_config.request_config.receive_body_timeout));
-            try {
-                // parse first line and headers
-                parser.parse({buffer->data(), buffer->size()});
-
-                buffer->resize(http_config.request_config.max_line_and_headers_size);
-
-                // read body
-                for (; parser.state() != HttpParser<HttpRequest>::Success; ) {
-                    check_deadline();
-                    size_t read_len = co_await socket.async_read_some(asio::buffer(*buffer),
-                                                                        asio::use_awaitable);
-                    deadline.cancel_one();
-                    parser.parse({buffer->data(), read_len});
+            // prior knowledge: "PRI " cannot start an HTTP/1 request
+            if (fresh && http2 && buffer->size() >= 4
+                && http2_preface.starts_with(std::string_view(*buffer).substr(0, http2_preface.size())))
+            {
+                co_await serve_http2(loop, stream, nullptr, *buffer);
+                break;
+            }
+
+            // handle every complete request already in the buffer
+            bool need_more = false;
+            for (; keep_alive && queue.pending < config.max_pipeline_depth;) {
+                if (parsed == buffer->size()) {
+                    need_more = true;
+                    break;
                 }
 
-                // dispatch
-                auto url = parse_http_request_url(req.url);
-                req.path = std::move(url.path);
-                req.query = std::move(url.query);
-                dispatch(req, resp);
+                // moves to the front of the queue when the queue is flushed
+                HttpResponse* resp = &queue.current();
+                std::optional<HttpResponseWriter> writer;
+                bool complete = false;
+                try {
+                    parsed += parser.parse({buffer->data() + parsed, buffer->size() - parsed});
 
-            } catch(const CynoRuntimeError& err) {
-                if (exception_handler) {
-                    int status = exception_handler->handle(std::current_exception(), resp);
-                    perfect_response(resp, status);
+                    if (parser.state() == HttpParser<HttpRequestView>::HeadersComplete && !routed) {
+                        // route as soon as the headers are in, a stream route takes the body from here
+                        routed = true;
+                        req.bind_url();
+                        route = router.find(req.method, req.url, req.params);
+                        if (metrics) {
+                            routed_at = std::chrono::steady_clock::now();
+                        }
+
+                        auto stream = route ? std::get_if<HttpRouter::HttpStreamHandler>(route) : nullptr;
+                        if (stream) {
+                            if (overloaded_now(loop)) {
+                                throw OverloadedError("The server is overloaded");
+                            }
+                            if (async_interceptors) {
+                                co_await before_async(req, *resp);
+                            } else {
+                                before(req, *resp);
+                            }
+                            reader = (*stream)(req);
+                            if (!reader) {
+                                throw HttpRequestError("The request body was refused");
+                            }
+                            parser.stream_body(true);
+                            stream_begin = parsed;
+                        }
+                    }
+
+                    if (reader) {
+                        for (auto chunk : parser.chunks()) {
+                            streamed += chunk.length();
+                            if (streamed > config.max_file_size) {
+                                throw HttpRequestError("Request entity too large");
+                            }
+                            co_await reader->on_chunk(req, chunk);
+                        }
+                        parser.clear_chunks();
+
+                        // the body is consumed, only the head stays in the buffer
+                        buffer->erase(stream_begin, parsed - stream_begin);
+                        parsed = stream_begin;
+                    }
+
+                    if (parser.state() != HttpParser<HttpRequestView>::Success) {
+                        if (parsed - request_begin >= max_request_size) {
+                            throw HttpRequestError("Request entity too large");
+                        }
+                        continue;
+                    }
+                    complete = true;
+                    keep_alive = req.should_keep_alive;
+
+                    // answered with 101 once the responses before it are out
+                    if (http2 && !stream.is_tls() && !reader && req.headers.contains(HttpField::Http2Settings)
+                        && req.headers.get(HttpField::Upgrade).find("h2c") != std::string_view::npos) 
+                    {
+                        upgrade_h2c = true;
+                        break;
+                    }
+
+                    // a streamed body was admitted with its headers
+                    bool shed = !reader && overloaded_now(loop);
+
+                    // answered with 101 once the responses before it are out
+                    if (auto ws = route && !shed ? std::get_if<HttpRouter::WebSocketHandler>(route) : nullptr) {
+                        websocket_accepted = websocket_handshake(req);
+                        co_await before_async(req, *resp);
+                        append_upgrade_fields(websocket_accepted, resp->headers);
+                        websocket = ws;
+                        break;
+                    }
+                    InflightGuard inflight(loop.inflight);
+
+                    // dispatch
+                    if (reader) {
+                        int status = co_await reader->on_complete(req, *resp);
+                        perfect_response(*resp, status);
+                        if (async_interceptors) {
+                            co_await after_async(req, *resp);
+                        } else {
+                            after(req, *resp);
+                        }
+                    } else if (shed) {
+                        // pre-serialized, so rejecting costs next to nothing;
+                        // raw is sent as is, so it has to say close itself
+                        resp->raw = keep_alive ? overloaded : overloaded_close;
+                        resp->status_code = HTTP_STATUS_SERVICE_UNAVAILABLE;
+                        if (metrics) {
+                            metrics->request_shed();
+                        }
+                    } else if (size_t ttl = req.method == HTTP_GET ? router.cache_ttl(route) : 0; ttl > 0) {
+                        co_await dispatch_cached(route, ttl, req, *resp);
+                    } else if (auto chunked = route ? std::get_if<HttpRouter::HttpChunkedHandler>(route) : nullptr) {
+                        co_await before_async(req, *resp);
+                        // what is queued before it goes out first
+                        size_t flushed = co_await queue.flush(stream);
+                        if (metrics) {
+                            metrics->sent(flushed);
+                        }
+                        resp = &queue.current();
+                        // the head goes out with the first chunk, before the
+                        // fix-up after dispatch
+                        if (!keep_alive) {
+                            resp->headers[HttpField::Connection] = "close";
+                        }
+                        writer.emplace(stream, *resp, req.method == HTTP_HEAD, req.version == "HTTP/1.0");
+                        co_await (*chunked)(req, *writer);
+                        co_await writer->finish();
+                        // a close-delimited body ends with the connection
+                        keep_alive = keep_alive && resp->should_keep_alive;
+                        co_await after_async(req, *resp);
+                    } else if (async_interceptors 
+                        || (route && std::holds_alternative<HttpRouter::HttpAsyncHandler>(*route))) 
+                    {
+                        co_await dispatch_async(route, req, *resp);
+                    } else {
+                        dispatch(route, req, *resp);
+                    }
+
+                } catch(const OverloadedError&) {
+                    // refused before its body was read, so the connection cannot go on
+                    resp->raw = overloaded_close;
+                    resp->status_code = HTTP_STATUS_SERVICE_UNAVAILABLE;
+                    keep_alive = false;
+                    if (metrics) {
+                        metrics->request_shed();
+                    }
+                } catch(const CynoRuntimeError& err) {
+                    // the stream cannot be resynchronized after a bad request
+                    if (!complete) {
+                        keep_alive = false;
+                        if (metrics && dynamic_cast<const HttpRequestError*>(&err)) {
+                            metrics->parse_error();
+                        }
+                    }
+                    // part of the response is already out
+                    if (writer && writer->started()) {
+                        keep_alive = false;
+                        if (metrics) {
+                            metrics->sent(writer->bytes_sent());
+                        }
+                        break;
+                    }
+                    if (!handle_error(*resp)) {
+                        keep_alive = false;
+                        break;
+                    }
+                }
+
+                // the default head says keep-alive
+                if (!keep_alive && !resp->raw) {
+                    resp->headers[HttpField::Connection] = "close";
+                }
+                // same head as GET, no body
+                if (complete && req.method == HTTP_HEAD) {
+                    resp->body.clear();
+                    resp->file.reset();
+                }
+
+                if (metrics && routed) {
+                    auto elapsed = std::chrono::steady_clock::now() - routed_at;
+                    metrics->request(router.route_id(route), resp->status_code,
+                        std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+                }
+                if (metrics && writer) {
+                    metrics->sent(writer->bytes_sent());
+                }
+
+                if (writer && writer->started()) {
+                    queue.reset_current();
                 } else {
-                    break;
+                    queue.push();
                 }
+                parser.restart();
+                request_begin = parsed;
+                fresh = false;
+                routed = false;
+                route = nullptr;
+                reader.reset();
+                streamed = 0;
             }
 
-            buffer->assign(serialize_response(resp));
+            size_t flushed = co_await queue.flush(stream);
+            if (metrics) {
+                metrics->sent(flushed);
+            }
+
+            if (upgrade_h2c) {
+                co_await serve_http2(loop, stream, &req, {buffer->data() + parsed, buffer->size() - parsed});
+                break;
+            }
+            if (websocket) {
+                // frames go behind the request, which stays for the handler
+                buffer->erase(0, request_begin);
+                parser.rebase(buffer->data() + request_begin, buffer->data(), parsed - request_begin);
+                co_await serve_websocket(loop, stream, *websocket, req, websocket_accepted, *buffer, parsed - request_begin,
+                    [&parser](const char* from, const char* to, size_t size) {
+                        parser.rebase(from, to, size);
+                    });
+                break;
+            }
 
-            // send
-            co_await asio::async_write(socket, asio::buffer(*buffer), 
-                                            asio::use_awaitable);
-            
             // keepalive
-            if (!req.should_keep_alive) {
+            if (!keep_alive) {
                 break;
             }
+            // a routed request may have its response half built
+            if (!routed) {
+                queue.release_arena();
+            }
+            if (!need_more) {
+                continue;
+            }
+
+            // only the partial request still points into the buffer, move it to the front
+            if (request_begin > 0) {
+                size_t rest = buffer->size() - request_begin;
+                buffer->erase(0, request_begin);
+                parser.rebase(buffer->data() + request_begin, buffer->data(), rest);
+                parsed -= request_begin;
+                if (reader) {
+                    stream_begin -= request_begin;
+                }
+                request_begin = 0;
+            }
+
+            size_t used = buffer->size();
+            if (used == buffer->capacity()) {
+                const char* old_data = buffer->data();
+                buffer->reserve(std::min(used * 2, max_request_size));
+                parser.rebase(old_data, buffer->data(), used);
+            }
+            buffer->resize(buffer->capacity());
+
+            // set timeout
+            size_t timeout = used == 0 ? config.keepalive_timeout
+                : parser.state() == HttpParser<HttpRequestView>::HeadersComplete ? config.receive_body_timeout
+                : config.receive_headers_timeout;
+            loop.wheel.schedule(deadline, std::chrono::milliseconds(timeout));
+
+            size_t read_len = co_await stream.read_some(asio::buffer(buffer->data() + used, buffer->size() - used));
+            loop.wheel.cancel(deadline);
+            buffer->resize(used + read_len);
+            if (metrics) {
+                metrics->received(read_len);
+            }
         }
     } catch(const std::system_error& err) {
         spdlog::error("System error happend when receiving or sending: {}", err.what());
+    } catch(const std::exception& err) {
+        spdlog::error("Connection closed on an unexpected error: {}", err.what());
+    } catch(...) {
+        spdlog::error("Connection closed on an unknown error");
     }
+}
+
+asio::awaitable<void> HttpServer::Impl::serve_http2(EventLoop& loop, HttpStream& stream,
+    const HttpRequestView* upgrade, std::string_view received) 
+{
+    Http2Session session(stream, loop.wheel, [this, &loop](HttpRequestView& req, HttpResponse& resp) {
+        return dispatch_http2(loop, req, resp);
+    });
 
-    // return buffer
+    if (upgrade) {
+        static constexpr std::string_view switching = 
+            "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        static constexpr std::string_view bad_settings = 
+            "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        bool valid = true;
+        try {
+            session.upgrade(*upgrade, upgrade->headers.get(HttpField::Http2Settings));
+        } catch(const Http2Error&) {
+            valid = false;
+        }
+        co_await stream.write(asio::buffer(valid ? switching : bad_settings));
+        if (!valid) {
+            co_return;
+        }
+    }
+
+    // the streams of the connection run concurrently, a strand keeps
+    // them off each other even when the loop has several threads
+    co_await asio::co_spawn(asio::make_strand(loop.executor), session.run(received), asio::use_awaitable);
 }
 
-void HttpServer::Impl::dispatch(HttpRequest& req, HttpResponse& resp) {
-    // interceptor
+asio::awaitable<void> HttpServer::Impl::dispatch_http2(EventLoop& loop, HttpRequestView& req, HttpResponse& resp) {
+    req.bind_url();
+    auto route = router.find(req.method, req.url, req.params);
+    auto started = std::chrono::steady_clock::now();
+    MetricShard* metrics = loop.metrics;
+
+    bool shed = overloaded_now(loop);
+    InflightGuard inflight(loop.inflight);
+    try {
+        if (shed) {
+            resp.raw = overloaded;
+            resp.status_code = HTTP_STATUS_SERVICE_UNAVAILABLE;
+            if (metrics) {
+                metrics->request_shed();
+            }
+        } else if (auto stream = route ? std::get_if<HttpRouter::HttpStreamHandler>(route) : nullptr) {
+            // the body is already in, so it is one chunk
+            co_await before_async(req, resp);
+            auto reader = (*stream)(req);
+            if (!reader) {
+                throw HttpRequestError("The request body was refused");
+            }
+            if (!req.body.empty()) {
+                co_await reader->on_chunk(req, req.body);
+            }
+            int status = co_await reader->on_complete(req, resp);
+            perfect_response(resp, status);
+            co_await after_async(req, resp);
+        } else if (size_t ttl = req.method == HTTP_GET ? router.cache_ttl(route) : 0; ttl > 0) {
+            co_await dispatch_cached(route, ttl, req, resp);
+        } else if (route && std::holds_alternative<HttpRouter::HttpChunkedHandler>(*route)) {
+            // HttpResponseWriter writes HTTP/1 chunks to the socket
+            perfect_response(resp, HTTP_STATUS_NOT_IMPLEMENTED);
+        } else if (route && std::holds_alternative<HttpRouter::WebSocketHandler>(*route)) {
+            // WebSocket over HTTP/2 (RFC 8441) is not offered
+            perfect_response(resp, HTTP_STATUS_NOT_IMPLEMENTED);
+        } else {
+            co_await dispatch_async(route, req, resp);
+        }
+    } catch(const CynoRuntimeError&) {
+        // without a handler the stream is reset
+        if (!exception_handler) {
+            throw;
+        }
+        int status = exception_handler->handle(std::current_exception(), resp);
+        perfect_response(resp, status);
+    }
+
+    if (metrics) {
+        auto elapsed = std::chrono::steady_clock::now() - started;
+        metrics->request(router.route_id(route), resp.status_code,
+            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+    }
+}
+
+asio::awaitable<void> HttpServer::Impl::serve_websocket(EventLoop& loop, HttpStream& stream, 
+    const HttpRouter::WebSocketHandler& handler, HttpRequestView& req, const std::string& accepted, 
+    std::pmr::string& buffer, size_t begin, WebSocket::OnMove on_move)
+{
+    co_await stream.write(asio::buffer(accepted));
+    if (loop.metrics) {
+        loop.metrics->sent(accepted.size());
+    }
+
+    WebSocket socket(stream, loop.wheel, buffer, begin, std::move(on_move));
+    // broadcasts reach the connection through its strand
+    co_await asio::co_spawn(asio::make_strand(loop.executor), 
+        socket.run([&handler, &req](WebSocket& socket) { return handler(req, socket); }),
+        asio::use_awaitable);
+}
+
+// send status line, headers and body of every response in one gather write
+asio::awaitable<size_t> ResponseQueue::flush(HttpStream& stream) {
+    if (pending == 0) {
+        co_return 0;
+    }
+    if (heads.size() < pending) {
+        heads.resize(pending);
+    }
+
+    size_t written = 0;
+    gather.clear();
+    for (size_t i = 0; i < pending; ++i) {
+        if (responses[i].raw) {
+            gather.push_back(asio::buffer(*responses[i].raw));
+            continue;
+        }
+
+        auto status_line = serialize_response_head(responses[i], heads[i]);
+        gather.push_back(asio::buffer(status_line));
+        gather.push_back(asio::buffer(heads[i]));
+        if (!responses[i].file) {
+            gather.push_back(asio::buffer(responses[i].body));
+            continue;
+        }
+
+        // the file goes out between the heads
+        written += co_await stream.write(gather);
+        gather.clear();
+        co_await send_file(stream, *responses[i].file);
+        written += responses[i].file->length;
+    }
+    if (!gather.empty()) {
+        written += co_await stream.write(gather);
+    }
+
+    // the response being built moves to the front
+    std::swap(responses[0], responses[pending]);
+    pending = 0;
+    co_return written;
+}
+
+// only while every interceptor is synchronous
+void HttpServer::Impl::before(HttpRequestView& req, HttpResponse& resp) {
     for (auto& aop : interceptors) {
-        if (!aop->before(req, resp)) {
+        if (!std::get<0>(aop)->before(req, resp)) {
             throw InterceptorError("The conditions for passing the interceptor are not met");
         }
     }
+}
+
+void HttpServer::Impl::after(HttpRequestView& req, HttpResponse& resp) {
+    for (auto it = interceptors.rbegin(); it != interceptors.rend(); ++it) {
+        std::get<0>(*it)->after(req, resp);
+    }
+}
+
+asio::awaitable<void> HttpServer::Impl::before_async(HttpRequestView& req, HttpResponse& resp) {
+    for (auto& aop : interceptors) {
+        bool passed = aop.index() == 0 
+            ? std::get<0>(aop)->before(req, resp) 
+            : co_await std::get<1>(aop)->before(req, resp);
+        if (!passed) {
+            throw InterceptorError("The conditions for passing the interceptor are not met");
+        }
+    }
+}
+
+asio::awaitable<void> HttpServer::Impl::after_async(HttpRequestView& req, HttpResponse& resp) {
+    for (auto it = interceptors.rbegin(); it != interceptors.rend(); ++it) {
+        if (it->index() == 0) {
+            std::get<0>(*it)->after(req, resp);
+        } else {
+            co_await std::get<1>(*it)->after(req, resp);
+        }
+    }
+}
 
-    // router
-    int status = router.match(http_method_str(req.method), req.path)(req, resp);
+void HttpServer::Impl::dispatch(const HttpRouter::HttpRoute* route, HttpRequestView& req, HttpResponse& resp) {
+    // interceptor
+    before(req, resp);
+
+    // router, match() throws the not-found error
+    if (!route) {
+        route = &router.match(req.method, req.url, req.params);
+    }
+    int status = std::get<HttpRouter::HttpHandler>(*route)(req, resp);
     perfect_response(resp, status);
 
     // interceptor
-    for (auto it = interceptors.rbegin(); it != interceptors.rend(); ++it) {
-        (*it)->after(req, resp);
+    after(req, resp);
+}
+
+asio::awaitable<void> HttpServer::Impl::dispatch_async(const HttpRouter::HttpRoute* route, HttpRequestView& req, HttpResponse& resp) {
+    // interceptor
+    co_await before_async(req, resp);
+
+    // router, match() throws the not-found error
+    if (!route) {
+        route = &router.match(req.method, req.url, req.params);
     }
+    int status = std::holds_alternative<HttpRouter::HttpAsyncHandler>(*route)
+        ? co_await std::get<HttpRouter::HttpAsyncHandler>(*route)(req, resp)
+        : std::get<HttpRouter::HttpHandler>(*route)(req, resp);
+    perfect_response(resp, status);
+
+    // interceptor
+    co_await after_async(req, resp);
+}
 
+// seconds of a "name=seconds" directive, npos if absent
+static size_t cache_directive(std::string_view control, std::string_view name) {
+    size_t pos = control.find(name);
+    if (pos == std::string_view::npos || control.substr(pos + name.length(), 1) != "=") {
+        return std::string_view::npos;
+    }
+    size_t seconds = 0;
+    auto value = control.substr(pos + name.length() + 1);
+    auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.length(), seconds);
+    return ec == std::errc() ? seconds : std::string_view::npos;
+}
+
+// how long resp may be cached: route ttl, shortened by s-maxage or max-age
+static size_t cache_ttl_of(const HttpResponse& resp, size_t ttl) {
+    if (resp.status_code != HTTP_STATUS_OK || resp.file || resp.headers.contains(HttpField::SetCookie)) {
+        return 0;
+    }
+    auto control = resp.headers.get(HttpField::CacheControl);
+    if (control.empty()) {
+        return ttl;
+    }
+
+    if (control.find("no-store") != std::string_view::npos 
+        || control.find("no-cache") != std::string_view::npos
+        || control.find("private") != std::string_view::npos) 
+    {
+        return 0;
+    }
+    size_t seconds = cache_directive(control, "s-maxage");
+    if (seconds == std::string_view::npos) {
+        seconds = cache_directive(control, "max-age");
+    }
+    return seconds == std::string_view::npos ? ttl : std::min(ttl, seconds * 1000);
+}
+
+asio::awaitable<void> HttpServer::Impl::dispatch_cached(const HttpRouter::HttpRoute* route, size_t ttl, HttpRequestView& req, HttpResponse& resp) {
+    // interceptors run for hits too, e.g. to check credentials
+    co_await before_async(req, resp);
+
+    // the client asks for a fresh response, or not to store it
+    auto control = req.headers.get(HttpField::CacheControl);
+    bool no_store = control.find("no-store") != std::string_view::npos;
+    bool lookup = !no_store 
+        && control.find("no-cache") == std::string_view::npos
+        && control.find("max-age=0") == std::string_view::npos;
+
+    auto key = ResponseCache::key_of(req);
+    bool leader = true;
+    if (lookup) {
+        if (auto entry = co_await response_cache.get(key, leader)) {
+            entry->apply(resp);
+            co_await after_async(req, resp);
+            co_return;
+        }
+    }
+
+    // what the interceptors set for this request, kept out of the entry
+    HttpHeaders preset;
+    if (leader) {
+        preset = resp.headers;
+    }
+
+    int status = 0;
+    try {
+        status = std::holds_alternative<HttpRouter::HttpAsyncHandler>(*route)
+            ? co_await std::get<HttpRouter::HttpAsyncHandler>(*route)(req, resp)
+            : std::get<HttpRouter::HttpHandler>(*route)(req, resp);
+    } catch(...) {
+        // let the waiters run the handler themselves
+        if (leader) {
+            response_cache.put(key, nullptr, 0);
+        }
+        throw;
+    }
+    perfect_response(resp, status);
+
+    if (leader) {
+        size_t resp_ttl = no_store ? 0 : cache_ttl_of(resp, ttl);
+        auto entry = resp_ttl > 0 ? std::make_shared<const CachedResponse>(resp, preset) : nullptr;
+        response_cache.put(key, std::move(entry), resp_ttl);
+    }
+
+    // interceptor
+    co_await after_async(req, resp);
 }
 
 void perfect_response(HttpResponse& resp, int status) {
     resp.status_code = static_cast<HttpResponse::Status>(status);
     resp.status = http_status_str(resp.status_code);
 
-    resp.content_length = resp.body.length();
-    resp.headers["Content-Length"] = std::to_string(resp.content_length);
+    resp.content_length = resp.file ? resp.file->length : resp.body.length();
+    // a 304 describes the body it omits, so a length of 0 would be wrong;
+    // 1xx and 204 must not carry the field at all
+    if (status < 200 || status == HTTP_STATUS_NO_CONTENT || status == HTTP_STATUS_NOT_MODIFIED) {
+        resp.headers.erase(HttpField::ContentLength);
+        return;
+    }
+    char buf[24];
+    auto [end, ec] = std::to_chars(buf, buf + sizeof(buf), resp.content_length);
+    resp.headers[HttpField::ContentLength].assign(buf, end);
 }
 
 
-}
\ No newline at end of file
+asio::awaitable<void> send_file(HttpStream& stream, const HttpFileBody& file) {
+    size_t left = file.length;
+#ifdef __linux__
+    // from the page cache to the socket, waiting whenever the send buffer is full;
+    // TLS has to encrypt in user space, so it reads the file like other systems do
+    if (!stream.is_tls()) {
+        off_t offset = static_cast<off_t>(file.offset);
+        auto& socket = stream.socket();
+        socket.native_non_blocking(true);
+        for (; left > 0;) {
+            ssize_t n = ::sendfile(socket.native_handle(), file.fd, &offset, left);
+            if (n > 0) {
+                left -= static_cast<size_t>(n);
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                co_await socket.async_wait(asio::ip::tcp::socket::wait_write, asio::use_awaitable);
+                continue;
+            }
+            // n == 0: the file was truncated after the head went out
+            throw std::system_error(n < 0 ? errno : EIO, std::system_category(), "sendfile");
+        }
+        co_return;
+    }
+#endif
+    std::array<char, 64 * 1024> buf;
+    size_t offset = file.offset;
+    for (; left > 0;) {
+        size_t n = read_file_at(file.fd, buf.data(), std::min(left, buf.size()), offset);
+        if (n == 0) {
+            // truncated after the head went out
+            throw std::system_error(EIO, std::system_category(), "read_file_at");
+        }
+        co_await stream.write(asio::buffer(buf.data(), n));
+        offset += n;
+        left -= n;
+    }
+}
+
+}
@@ -2,6 +2,7 @@
 #define CYNO_HTTP_SERVER_H_
 
 #include <memory>
+#include <string>
 #include "asio/any_io_executor.hpp"
 #include "cyno/base/Pimpl.h"
 #include "cyno/http/ExceptionHandler.h"
@@ -20,15 +21,31 @@ public:
         Stopped, Running
     };
 
+    // run on the caller's executor
     HttpServer(asio::any_io_executor executor);
+    // own http_config.server_config.event_loops loops, one thread each;
+    // interceptors and the exception handler are then shared between threads
+    HttpServer();
 
     void bind(std::string_view host, unsigned port);
     void routes(HttpRouter router);
     void exception_handler(std::unique_ptr<ExceptionHandler>  handler);
+    // interceptors run in the order they were added, sync and async alike
     void add_interceptor(std::unique_ptr<HttpInterceptor> interceptor);
+    void add_interceptor(std::unique_ptr<AsyncHttpInterceptor> interceptor);
     void buffer_provider();
+    // Serves Prometheus text at path: per route latency histograms, connections,
+    // bytes and buffer pool counts. Off by default, takes effect on start().
+    void enable_metrics(std::string path = "/metrics");
+#ifdef CYNO_ENABLE_SSL
+    // Every connection is TLS from then on, HTTP/1.1 or "h2" as ALPN decides.
+    // PEM files, see http_config.tls_config. throw std::system_error
+    void enable_tls(const std::string& cert_chain_file, const std::string& private_key_file);
+#endif
     void start();
     void stop();
+    // wait for the owned loops to exit
+    void join();
 private:
 };
 
@@ -0,0 +1,261 @@
+#include "cyno/http/HttpStream.h"
+
+#include "asio/use_awaitable.hpp"
+#include "asio/write.hpp"
+#ifdef CYNO_ENABLE_SSL
+#include <mutex>
+#include <unordered_map>
+#include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include "asio/ssl/stream.hpp"
+#endif
+#include "cyno/http/HttpConfig.h"
+
+namespace cyno {
+
+#ifdef CYNO_ENABLE_SSL
+struct HttpStream::TlsLayer {
+    TlsLayer(asio::ip::tcp::socket socket, asio::ssl::context& context, std::string key)
+        : stream(std::move(socket), context)
+        , session_key(std::move(key))
+    {}
+    ~TlsLayer();
+
+    asio::ssl::stream<asio::ip::tcp::socket> stream;
+    // the SSL object points to it, to file new sessions under it
+    std::string session_key;
+};
+#else
+// never created without TLS support
+struct HttpStream::TlsLayer {};
+#endif
+
+HttpStream::HttpStream(asio::ip::tcp::socket socket): socket_(std::move(socket)) {}
+
+HttpStream::HttpStream(HttpStream&&) noexcept = default;
+
+HttpStream& HttpStream::operator=(HttpStream&&) noexcept = default;
+
+HttpStream::~HttpStream() = default;
+
+asio::ip::tcp::socket& HttpStream::socket() {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        return tls_->stream.next_layer();
+    }
+#endif
+    return socket_;
+}
+
+asio::awaitable<size_t> HttpStream::read_some(asio::mutable_buffer buffer) {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        return tls_->stream.async_read_some(buffer, asio::use_awaitable);
+    }
+#endif
+    return socket_.async_read_some(buffer, asio::use_awaitable);
+}
+
+asio::awaitable<size_t> HttpStream::write(asio::const_buffer buffer) {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        return asio::async_write(tls_->stream, buffer, asio::use_awaitable);
+    }
+#endif
+    return asio::async_write(socket_, buffer, asio::use_awaitable);
+}
+
+asio::awaitable<size_t> HttpStream::write(const std::vector<asio::const_buffer>& buffers) {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        return asio::async_write(tls_->stream, buffers, asio::use_awaitable);
+    }
+#endif
+    return asio::async_write(socket_, buffers, asio::use_awaitable);
+}
+
+void HttpStream::close() {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        socket_ = std::move(tls_->stream.next_layer());
+        tls_.reset();
+    }
+#endif
+    asio::error_code err;
+    socket_.close(err);
+}
+
+std::string_view HttpStream::alpn() const {
+#ifdef CYNO_ENABLE_SSL
+    if (tls_) {
+        const unsigned char* data = nullptr;
+        unsigned int length = 0;
+        SSL_get0_alpn_selected(tls_->stream.native_handle(), &data, &length);
+        return std::string_view(reinterpret_cast<const char*>(data), length);
+    }
+#endif
+    return {};
+}
+
+#ifdef CYNO_ENABLE_SSL
+
+// "h2" first, so it wins whenever the client offers it
+static constexpr unsigned char alpn_h2_http11[] = "\x02h2\x08http/1.1";
+static constexpr unsigned char alpn_http11[] = "\x08http/1.1";
+
+static int select_alpn(SSL*, const unsigned char** out, unsigned char* out_len,
+    const unsigned char* in, unsigned int in_len, void*)
+{
+    bool http2 = http_config.tls_config.http2;
+    const unsigned char* ours = http2 ? alpn_h2_http11 : alpn_http11;
+    unsigned int ours_len = http2 ? sizeof(alpn_h2_http11) - 1 : sizeof(alpn_http11) - 1;
+    unsigned char* selected = nullptr;
+    if (SSL_select_next_proto(&selected, out_len, ours, ours_len, in, in_len) != OPENSSL_NPN_NEGOTIATED) {
+        return SSL_TLSEXT_ERR_NOACK;
+    }
+    *out = selected;
+    return SSL_TLSEXT_ERR_OK;
+}
+
+// the newest session of every host:port, for client_tls_context()
+struct ClientSessions {
+    std::mutex mutex;
+    std::unordered_map<std::string, SSL_SESSION*> sessions;
+    int key_index = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+
+    ~ClientSessions() {
+        for (auto& [key, session] : sessions) {
+            SSL_SESSION_free(session);
+        }
+    }
+
+    // called by OpenSSL, also for TLS 1.3 tickets that come after the handshake
+    static int on_new_session(SSL* ssl, SSL_SESSION* session);
+
+    static ClientSessions& instance() {
+        static ClientSessions sessions;
+        return sessions;
+    }
+};
+
+int ClientSessions::on_new_session(SSL* ssl, SSL_SESSION* session) {
+    auto& self = instance();
+    auto key = static_cast<const std::string*>(SSL_get_ex_data(ssl, self.key_index));
+    if (!key || key->empty()) {
+        return 0;
+    }
+
+    std::unique_lock lk(self.mutex);
+    auto& slot = self.sessions[*key];
+    if (slot) {
+        SSL_SESSION_free(slot);
+    }
+    // returning 1 keeps the reference OpenSSL passed
+    slot = session;
+    return 1;
+}
+
+std::unique_ptr<asio::ssl::context> make_server_tls_context(const std::string& cert_chain_file,
+    const std::string& private_key_file)
+{
+    const auto& config = http_config.tls_config;
+    auto context = std::make_unique<asio::ssl::context>(asio::ssl::context::tls_server);
+    context->set_options(asio::ssl::context::default_workarounds
+        | asio::ssl::context::no_sslv2
+        | asio::ssl::context::no_sslv3
+        | asio::ssl::context::no_tlsv1
+        | asio::ssl::context::no_tlsv1_1);
+    context->use_certificate_chain_file(cert_chain_file);
+    context->use_private_key_file(private_key_file, asio::ssl::context::pem);
+
+    SSL_CTX* native = context->native_handle();
+    static constexpr unsigned char session_id_context[] = "cyno";
+    SSL_CTX_set_session_id_context(native, session_id_context, sizeof(session_id_context) - 1);
+    if (config.session_cache_size > 0) {
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_SERVER);
+        SSL_CTX_sess_set_cache_size(native, static_cast<long>(config.session_cache_size));
+    } else {
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_OFF);
+    }
+    SSL_CTX_set_timeout(native, static_cast<long>(config.session_timeout));
+    if (!config.session_tickets) {
+        SSL_CTX_set_options(native, SSL_OP_NO_TICKET);
+    }
+    SSL_CTX_set_alpn_select_cb(native, select_alpn, nullptr);
+    return context;
+}
+
+asio::ssl::context& client_tls_context() {
+    static asio::ssl::context context = [] {
+        asio::ssl::context res(asio::ssl::context::tls_client);
+        res.set_options(asio::ssl::context::default_workarounds
+            | asio::ssl::context::no_sslv2
+            | asio::ssl::context::no_sslv3
+            | asio::ssl::context::no_tlsv1
+            | asio::ssl::context::no_tlsv1_1);
+        res.set_default_verify_paths();
+
+        // sessions are looked up by host:port, not by OpenSSL's internal cache
+        SSL_CTX* native = res.native_handle();
+        SSL_CTX_set_session_cache_mode(native, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+        SSL_CTX_sess_set_new_cb(native, ClientSessions::on_new_session);
+        return res;
+    }();
+    return context;
+}
+
+HttpStream::TlsLayer::~TlsLayer() {
+    // HTTP frames its messages itself, so connections end without close_notify.
+    // Without this OpenSSL takes that for a broken connection and stops the
+    // session from being resumed.
+    SSL_set_shutdown(stream.native_handle(), SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+}
+
+asio::awaitable<void> HttpStream::accept_tls(asio::ssl::context& context) {
+    tls_ = std::make_unique<TlsLayer>(std::move(socket_), context, std::string());
+    co_await tls_->stream.async_handshake(asio::ssl::stream_base::server, asio::use_awaitable);
+}
+
+asio::awaitable<void> HttpStream::connect_tls(asio::ssl::context& context, const std::string& host,
+    std::string session_key)
+{
+    const auto& config = http_config.tls_config;
+    tls_ = std::make_unique<TlsLayer>(std::move(socket_), context, std::move(session_key));
+    SSL* ssl = tls_->stream.native_handle();
+
+    // SNI is for names only, an address is checked as such
+    asio::error_code err;
+    asio::ip::make_address(host, err);
+    bool is_address = !err;
+    if (!is_address) {
+        SSL_set_tlsext_host_name(ssl, host.c_str());
+    }
+    if (config.verify_peer) {
+        X509_VERIFY_PARAM* param = SSL_get0_param(ssl);
+        if (is_address) {
+            X509_VERIFY_PARAM_set1_ip_asc(param, host.c_str());
+        } else {
+            X509_VERIFY_PARAM_set1_host(param, host.c_str(), host.length());
+        }
+        tls_->stream.set_verify_mode(asio::ssl::verify_peer);
+    } else {
+        tls_->stream.set_verify_mode(asio::ssl::verify_none);
+    }
+    SSL_set_alpn_protos(ssl, alpn_http11, sizeof(alpn_http11) - 1);
+
+    auto& cache = ClientSessions::instance();
+    if (config.session_resumption && !tls_->session_key.empty()) {
+        SSL_set_ex_data(ssl, cache.key_index, &tls_->session_key);
+        std::unique_lock lk(cache.mutex);
+        if (auto it = cache.sessions.find(tls_->session_key); it != cache.sessions.end()) {
+            // takes its own reference
+            SSL_set_session(ssl, it->second);
+        }
+    }
+
+    co_await tls_->stream.async_handshake(asio::ssl::stream_base::client, asio::use_awaitable);
+}
+
+#endif
+
+}
@@ -0,0 +1,79 @@
+#ifndef CYNO_HTTP_STREAM_H_
+#define CYNO_HTTP_STREAM_H_
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "asio/awaitable.hpp"
+#include "asio/buffer.hpp"
+#include "asio/ip/tcp.hpp"
+#ifdef CYNO_ENABLE_SSL
+#include "asio/ssl/context.hpp"
+#endif
+
+namespace cyno {
+
+// A connection that is plain TCP until a TLS handshake puts TLS on it.
+// Reads and writes pick the layer at runtime, so the HTTP code is the same
+// for both. Can be moved at any time, the TLS state lives on the heap.
+// The layout does not depend on CYNO_ENABLE_SSL, so code built without it
+// can share the class with a library built with it.
+class HttpStream {
+public:
+    explicit HttpStream(asio::ip::tcp::socket socket);
+    HttpStream(HttpStream&&) noexcept;
+    HttpStream& operator=(HttpStream&&) noexcept;
+    ~HttpStream();
+
+    // the TCP socket, also under TLS, e.g. to close or cancel it
+    asio::ip::tcp::socket& socket();
+
+    bool is_tls() const {
+        return tls_ != nullptr;
+    }
+
+    asio::awaitable<size_t> read_some(asio::mutable_buffer buffer);
+    // all of buffers
+    asio::awaitable<size_t> write(asio::const_buffer buffer);
+    asio::awaitable<size_t> write(const std::vector<asio::const_buffer>& buffers);
+
+    // also drops TLS, so the stream can connect again
+    void close();
+
+    // the protocol chosen by ALPN, empty if none
+    std::string_view alpn() const;
+
+#ifdef CYNO_ENABLE_SSL
+    // throw std::system_error
+    asio::awaitable<void> accept_tls(asio::ssl::context& context);
+    // With SNI and, if tls_config.verify_peer, a host name check. Sessions of
+    // the context from client_tls_context() are resumed per session_key.
+    // throw std::system_error
+    asio::awaitable<void> connect_tls(asio::ssl::context& context, const std::string& host, std::string session_key);
+#endif
+
+private:
+    struct TlsLayer;
+
+    asio::ip::tcp::socket socket_;
+    // defined only with CYNO_ENABLE_SSL, always nullptr without it
+    std::unique_ptr<TlsLayer> tls_;
+};
+
+#ifdef CYNO_ENABLE_SSL
+// For HttpServer::enable_tls: the certificate chain and private key in PEM,
+// TLS 1.2 or later, ALPN, and a session cache and tickets so that returning
+// clients skip the full handshake, see http_config.tls_config.
+// throw std::system_error
+std::unique_ptr<asio::ssl::context> make_server_tls_context(const std::string& cert_chain_file,
+    const std::string& private_key_file);
+
+// Shared by every HttpClient: the system CA store, and the newest session
+// of each host:port, resumed by the next connection to it.
+asio::ssl::context& client_tls_context();
+#endif
+
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include "cyno/http/HttpUrl.h"
+
+#include <bit>
+#include <cstdint>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace cyno {
+
+// Calls on_match(i) for every i where str[i] is one of Cs, in order. Urls
+// are mostly plain characters, so 16 bytes are compared at a time and
+// only the hits are visited.
+template<char... Cs, typename OnMatch>
+static void url_scan(std::string_view str, OnMatch&& on_match) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    for (; i + 16 <= str.size(); i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(str.data() + i));
+        __m128i hits = _mm_setzero_si128();
+        ((hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, _mm_set1_epi8(Cs)))), ...);
+        auto mask = static_cast<uint32_t>(_mm_movemask_epi8(hits));
+        for (; mask != 0; mask &= mask - 1) {
+            on_match(i + std::countr_zero(mask));
+        }
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= str.size(); i += 16) {
+        uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(str.data() + i));
+        uint8x16_t hits = vdupq_n_u8(0);
+        ((hits = vorrq_u8(hits, vceqq_u8(block, vdupq_n_u8(static_cast<uint8_t>(Cs))))), ...);
+        // four bits per byte
+        uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(hits), 4)), 0)
+            & 0x8888888888888888ull;
+        for (; mask != 0; mask &= mask - 1) {
+            on_match(i + std::countr_zero(mask) / 4);
+        }
+    }
+#endif
+    for (; i < str.size(); ++i) {
+        if (((str[i] == Cs) || ...)) {
+            on_match(i);
+        }
+    }
+}
+
+static int url_hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+void percent_decode(std::string_view str, std::string& out, bool plus_is_space) {
+    for (size_t i = 0; i < str.size(); ++i) {
+        char c = str[i];
+        if (c == '%' && i + 2 < str.size()) {
+            int high = url_hex_value(str[i + 1]);
+            int low = url_hex_value(str[i + 2]);
+            if (high >= 0 && low >= 0) {
+                out.push_back(static_cast<char>(high << 4 | low));
+                i += 2;
+                continue;
+            }
+        } else if (c == '+' && plus_is_space) {
+            c = ' ';
+        }
+        out.push_back(c);
+    }
+}
+
+// part decoded into storage, which is reserved for all of raw at the first
+// part, so that it never moves under the views handed out before
+static std::string_view url_decode_part(std::string& storage, std::string_view raw, std::string_view part,
+    bool plus_is_space)
+{
+    if (part.find_first_of(plus_is_space ? "%+" : "%") == std::string_view::npos) {
+        return part;
+    }
+    if (storage.empty()) {
+        storage.reserve(raw.size());
+    }
+    size_t begin = storage.size();
+    percent_decode(part, storage, plus_is_space);
+    return std::string_view(storage).substr(begin);
+}
+
+void HttpUrlPath::split() const {
+    split_ = true;
+    size_t begin = 0;
+    bool encoded = false;
+    auto finish = [&](size_t end) {
+        if (end > begin) {
+            auto segment = raw_.substr(begin, end - begin);
+            segments_.push_back(encoded ? url_decode_part(decoded_, raw_, segment, false) : segment);
+        }
+    };
+    url_scan<'/', '%'>(raw_, [&](size_t i) {
+        if (raw_[i] == '%') {
+            encoded = true;
+            return;
+        }
+        finish(i);
+        begin = i + 1;
+        encoded = false;
+    });
+    finish(raw_.size());
+}
+
+void HttpUrlQuery::split() const {
+    split_ = true;
+    size_t begin = 0;
+    size_t equals = std::string_view::npos;
+    bool encoded = false;
+    auto finish = [&](size_t end) {
+        if (end == begin) {
+            return;
+        }
+        std::string_view key, value;
+        if (equals == std::string_view::npos) {
+            key = raw_.substr(begin, end - begin);
+        } else {
+            key = raw_.substr(begin, equals - begin);
+            value = raw_.substr(equals + 1, end - equals - 1);
+        }
+        if (encoded) {
+            key = url_decode_part(decoded_, raw_, key, true);
+            value = url_decode_part(decoded_, raw_, value, true);
+        }
+        fields_.emplace_back(key, value);
+    };
+    url_scan<'&', '=', '%', '+'>(raw_, [&](size_t i) {
+        switch (raw_[i]) {
+        case '&':
+            finish(i);
+            begin = i + 1;
+            equals = std::string_view::npos;
+            encoded = false;
+            break;
+        case '=':
+            if (equals == std::string_view::npos) {
+                equals = i;
+            }
+            break;
+        default:
+            encoded = true;
+        }
+    });
+    finish(raw_.size());
+}
+
+}
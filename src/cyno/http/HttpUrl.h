@@ -0,0 +1,203 @@
+#ifndef CYNO_HTTP_URL_H_
+#define CYNO_HTTP_URL_H_
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace cyno {
+
+// Appends str to out with %XX decoded, and + as a space if plus_is_space.
+// A % that is not followed by two hex digits is kept as it is.
+void percent_decode(std::string_view str, std::string& out, bool plus_is_space = false);
+
+// "/a/b?x=1#top" -> {"/a/b", "x=1"}
+inline std::pair<std::string_view, std::string_view> split_url_target(std::string_view url) {
+    url = url.substr(0, url.find('#'));
+    size_t pos = url.find('?');
+    if (pos == std::string_view::npos) {
+        return {url, {}};
+    }
+    return {url.substr(0, pos), url.substr(pos + 1)};
+}
+
+// The segments of a url path, split on first access: "/a//b/" is {"a", "b"}.
+// They are views into the path, or into storage of this object for the ones
+// that had %XX to decode. A copy splits again by itself.
+class HttpUrlPath {
+public:
+    using const_iterator = const std::string_view*;
+
+    HttpUrlPath() = default;
+    explicit HttpUrlPath(std::string_view raw): raw_(raw) {}
+
+    HttpUrlPath(const HttpUrlPath& other): raw_(other.raw_) {}
+    HttpUrlPath& operator=(const HttpUrlPath& other) {
+        assign(other.raw_);
+        return *this;
+    }
+
+    // nothing is parsed until the segments are read
+    void assign(std::string_view raw) {
+        clear();
+        raw_ = raw;
+    }
+
+    // keeps capacity for the next request on the connection
+    void clear() {
+        raw_ = {};
+        split_ = false;
+        segments_.clear();
+        decoded_.clear();
+    }
+
+    std::string_view raw() const {
+        return raw_;
+    }
+
+    size_t size() const {
+        return segments().size();
+    }
+
+    bool empty() const {
+        return segments().empty();
+    }
+
+    std::string_view operator[](size_t i) const {
+        return segments()[i];
+    }
+
+    const_iterator begin() const {
+        return segments().data();
+    }
+
+    const_iterator end() const {
+        return begin() + segments().size();
+    }
+
+    // shift(view) moves a view that points into a moved buffer
+    template<typename Shift>
+    void rebase(Shift&& shift) {
+        shift(raw_);
+        for (auto& segment : segments_) {
+            shift(segment);
+        }
+    }
+
+private:
+    const std::vector<std::string_view>& segments() const {
+        if (!split_) {
+            split();
+        }
+        return segments_;
+    }
+
+    void split() const;
+
+    std::string_view raw_;
+    mutable bool split_ = false;
+    mutable std::vector<std::string_view> segments_;
+    mutable std::string decoded_;
+};
+
+// The fields of a query string, split on first access. Keys and values are
+// views into the query, or into storage of this object for the ones that
+// had %XX or + to decode. A field without '=' has an empty value. Lookups
+// scan the fields in order, queries are short. A copy splits again by itself.
+class HttpUrlQuery {
+public:
+    using value_type = std::pair<std::string_view, std::string_view>;
+    using const_iterator = const value_type*;
+
+    HttpUrlQuery() = default;
+    explicit HttpUrlQuery(std::string_view raw): raw_(raw) {}
+
+    HttpUrlQuery(const HttpUrlQuery& other): raw_(other.raw_) {}
+    HttpUrlQuery& operator=(const HttpUrlQuery& other) {
+        assign(other.raw_);
+        return *this;
+    }
+
+    // nothing is parsed until a field is read
+    void assign(std::string_view raw) {
+        clear();
+        raw_ = raw;
+    }
+
+    // keeps capacity for the next request on the connection
+    void clear() {
+        raw_ = {};
+        split_ = false;
+        fields_.clear();
+        decoded_.clear();
+    }
+
+    std::string_view raw() const {
+        return raw_;
+    }
+
+    // the value of the first field called name, empty if there is none
+    std::string_view operator[](std::string_view name) const {
+        return get(name).value_or(std::string_view());
+    }
+
+    std::optional<std::string_view> get(std::string_view name) const {
+        for (auto& [key, value] : fields()) {
+            if (key == name) {
+                return value;
+            }
+        }
+        return std::nullopt;
+    }
+
+    bool contains(std::string_view name) const {
+        return get(name).has_value();
+    }
+
+    size_t size() const {
+        return fields().size();
+    }
+
+    bool empty() const {
+        return fields().empty();
+    }
+
+    const_iterator begin() const {
+        return fields().data();
+    }
+
+    const_iterator end() const {
+        return begin() + fields().size();
+    }
+
+    // shift(view) moves a view that points into a moved buffer
+    template<typename Shift>
+    void rebase(Shift&& shift) {
+        shift(raw_);
+        for (auto& [key, value] : fields_) {
+            shift(key);
+            shift(value);
+        }
+    }
+
+private:
+    const std::vector<value_type>& fields() const {
+        if (!split_) {
+            split();
+        }
+        return fields_;
+    }
+
+    void split() const;
+
+    std::string_view raw_;
+    mutable bool split_ = false;
+    mutable std::vector<value_type> fields_;
+    mutable std::string decoded_;
+};
+
+}
+
+#endif
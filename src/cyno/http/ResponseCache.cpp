@@ -0,0 +1,201 @@
+#include "cyno/http/ResponseCache.h"
+
+#include <algorithm>
+#include <cctype>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "asio/post.hpp"
+#include "asio/redirect_error.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/this_coro.hpp"
+#include "asio/use_awaitable.hpp"
+
+namespace cyno {
+
+using Clock = std::chrono::steady_clock;
+
+struct CacheWaiter {
+    asio::steady_timer timer;
+    ResponseCache::Entry entry;
+    bool done = false;
+
+    explicit CacheWaiter(asio::any_io_executor executor): timer(executor) {}
+};
+
+struct CacheItem {
+    std::string key;
+    ResponseCache::Entry entry;
+    Clock::time_point expires;
+};
+
+struct ResponseCache::State {
+    CacheConfig config;
+    std::mutex mutex;
+
+    // most recently used first
+    std::list<CacheItem> lru;
+    std::unordered_map<std::string_view, std::list<CacheItem>::iterator> index;
+    size_t bytes = 0;
+
+    // keys being fetched by a leader, with the requests waiting for them
+    std::unordered_map<std::string, std::vector<std::shared_ptr<CacheWaiter>>> flights;
+
+    void erase(std::list<CacheItem>::iterator it) {
+        bytes -= it->entry->size;
+        index.erase(it->key);
+        lru.erase(it);
+    }
+};
+
+CachedResponse::CachedResponse(const HttpResponse& resp, const HttpHeaders& preset)
+    : status_code(resp.status_code)
+    , status(resp.status)
+    , body(resp.body)
+{
+    for (auto& field : resp.headers) {
+        if (field.id == HttpField::Connection || field.id == HttpField::ContentLength) {
+            continue;
+        }
+        bool unchanged = std::any_of(preset.begin(), preset.end(), [&](auto& before) {
+            return iequals(before.name, field.name) && before.value == field.value;
+        });
+        if (!unchanged) {
+            headers.add(field.name, field.value);
+            size += field.name.length() + field.value.length();
+        }
+    }
+    size += body.length();
+}
+
+void CachedResponse::apply(HttpResponse& resp) const {
+    resp.status_code = status_code;
+    resp.status = status;
+    resp.body = body;
+    resp.content_length = body.length();
+    resp.headers[HttpField::ContentLength] = std::to_string(body.length());
+
+    // fields are only added, so resp's own stay in front
+    size_t own = resp.headers.size();
+    for (auto& field : headers) {
+        auto first = resp.headers.begin();
+        bool taken = std::any_of(first, first + static_cast<std::ptrdiff_t>(own), [&](auto& mine) {
+            return iequals(mine.name, field.name);
+        });
+        if (!taken) {
+            resp.headers.add(field.name, field.value);
+        }
+    }
+}
+
+ResponseCache::ResponseCache(CacheConfig config)
+    : state_(std::make_shared<State>())
+{
+    state_->config = config;
+}
+
+asio::awaitable<ResponseCache::Entry> ResponseCache::get(const std::string& key, bool& leader) {
+    auto executor = co_await asio::this_coro::executor;
+    leader = false;
+
+    std::shared_ptr<CacheWaiter> waiter;
+    {
+        std::unique_lock lk(state_->mutex);
+        if (auto it = state_->index.find(key); it != state_->index.end()) {
+            auto item = it->second;
+            if (item->expires > Clock::now()) {
+                state_->lru.splice(state_->lru.begin(), state_->lru, item);
+                co_return item->entry;
+            }
+            state_->erase(item);
+        }
+
+        auto [flight, inserted] = state_->flights.try_emplace(key);
+        if (inserted) {
+            leader = true;
+            co_return nullptr;
+        }
+        waiter = std::make_shared<CacheWaiter>(executor);
+        waiter->timer.expires_after(std::chrono::milliseconds(state_->config.coalesce_timeout));
+        flight->second.push_back(waiter);
+    }
+
+    asio::error_code err;
+    co_await waiter->timer.async_wait(asio::redirect_error(asio::use_awaitable, err));
+
+    std::unique_lock lk(state_->mutex);
+    if (!waiter->done) {
+        if (auto it = state_->flights.find(key); it != state_->flights.end()) {
+            std::erase(it->second, waiter);
+        }
+    }
+    co_return waiter->entry;
+}
+
+void ResponseCache::put(const std::string& key, Entry entry, size_t ttl) {
+    std::vector<std::shared_ptr<CacheWaiter>> waiters;
+    {
+        std::unique_lock lk(state_->mutex);
+        if (auto it = state_->flights.find(key); it != state_->flights.end()) {
+            waiters = std::move(it->second);
+            state_->flights.erase(it);
+        }
+
+        if (entry && ttl > 0 && entry->size <= state_->config.max_entry_size) {
+            if (auto it = state_->index.find(key); it != state_->index.end()) {
+                state_->erase(it->second);
+            }
+            state_->lru.push_front({key, entry, Clock::now() + std::chrono::milliseconds(ttl)});
+            state_->index.emplace(state_->lru.front().key, state_->lru.begin());
+            state_->bytes += entry->size;
+            for (; state_->bytes > state_->config.max_bytes;) {
+                state_->erase(std::prev(state_->lru.end()));
+            }
+        }
+
+        for (auto& waiter : waiters) {
+            waiter->entry = entry;
+            waiter->done = true;
+        }
+    }
+
+    // an expiry in the past also wakes a wait that has not started yet
+    for (auto& waiter : waiters) {
+        asio::post(waiter->timer.get_executor(), [waiter] {
+            waiter->timer.expires_at(Clock::time_point::min());
+        });
+    }
+}
+
+std::string ResponseCache::key_of(const HttpRequestView& req) {
+    std::string key = http_method_str(req.method);
+    key.push_back(' ');
+    // virtual hosts do not share entries, host names are case-insensitive
+    for (char c : req.headers.get(HttpField::Host)) {
+        key.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    }
+    key.push_back(' ');
+    auto [path, raw_query] = split_url_target(req.url);
+    key.append(path);
+
+    // the fields as they were sent, still encoded, so a decoded '&' or '='
+    // in a value cannot make it look like another query
+    std::vector<std::string_view> query;
+    for (size_t begin = 0; begin < raw_query.size();) {
+        size_t end = std::min(raw_query.find('&', begin), raw_query.size());
+        if (end > begin) {
+            query.push_back(raw_query.substr(begin, end - begin));
+        }
+        begin = end + 1;
+    }
+    std::sort(query.begin(), query.end());
+    char sep = '?';
+    for (auto field : query) {
+        key.push_back(sep);
+        key.append(field);
+        sep = '&';
+    }
+    return key;
+}
+}
@@ -0,0 +1,58 @@
+#ifndef CYNO_RESPONSE_CACHE_H_
+#define CYNO_RESPONSE_CACHE_H_
+
+#include <memory>
+#include <string>
+#include "asio/awaitable.hpp"
+#include "cyno/http/HttpConfig.h"
+#include "cyno/http/HttpMessage.h"
+
+namespace cyno {
+
+// What the hits of a cached response share. Their heads are written for
+// each request, so Connection and whatever interceptors set stay their own.
+struct CachedResponse {
+    HttpResponse::Status status_code;
+    std::string status;
+    // what the handler set, without Connection and Content-Length
+    HttpHeaders headers;
+    std::string body;
+    // counted against CacheConfig::max_bytes
+    size_t size = 0;
+
+    // preset holds the fields resp had before the handler ran, those it
+    // left as they were belong to the request and are not cached
+    CachedResponse(const HttpResponse& resp, const HttpHeaders& preset);
+
+    // fields resp already has, e.g. from interceptors, are kept
+    void apply(HttpResponse& resp) const;
+};
+
+// Responses in an LRU bounded by config.max_bytes, each with its
+// own expiry. Concurrent misses of a key are coalesced: the first becomes the
+// leader and fetches the response, the others wait for its put().
+class ResponseCache {
+public:
+    using Entry = std::shared_ptr<const CachedResponse>;
+
+    explicit ResponseCache(CacheConfig config = http_config.cache_config);
+
+    // A fresh entry, or nullptr. A leader must call put() for the key, even
+    // if fetching failed. nullptr without leader means the wait timed out or
+    // the leader had nothing to share, the caller then fetches on its own.
+    asio::awaitable<Entry> get(const std::string& key, bool& leader);
+    // entry may be nullptr, it is kept for ttl milliseconds if ttl > 0
+    void put(const std::string& key, Entry entry, size_t ttl);
+
+    // "GET example.com /path?a=1&b=2": method, host and path, then the
+    // query fields sorted and left encoded
+    static std::string key_of(const HttpRequestView& req);
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+}
+
+#endif
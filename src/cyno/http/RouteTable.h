@@ -0,0 +1,448 @@
+#ifndef CYNO_HTTP_ROUTE_TABLE_H_
+#define CYNO_HTTP_ROUTE_TABLE_H_
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "cyno/http/HttpRouter.h"
+
+namespace cyno {
+
+// a string literal as a template argument, e.g. the path of a TableRoute
+template<size_t N>
+struct RoutePath {
+    char data[N] {};
+
+    constexpr RoutePath(const char (&str)[N]) {
+        std::copy_n(str, N, data);
+    }
+
+    constexpr std::string_view view() const {
+        return std::string_view(data, N - 1);
+    }
+};
+
+// one '/' separated piece of a TableRoute path
+struct RouteSegment {
+    enum Kind : uint8_t {
+        Literal, Capture, Wildcard
+    };
+
+    Kind kind;
+    // the literal text or the capture name
+    std::string_view text;
+};
+
+constexpr size_t route_segment_count(std::string_view path) {
+    return static_cast<size_t>(std::count(path.begin(), path.end(), '/'));
+}
+
+// the end of the segment at pos; plain loops here and below, gcc 12 cannot
+// evaluate string_view::find on a template argument in a constant expression
+constexpr size_t route_segment_end(std::string_view path, size_t pos) {
+    for (; pos < path.size() && path[pos] != '/'; ++pos);
+    return pos;
+}
+
+// "/users/:id/*" -> {Literal "users", Capture "id", Wildcard "*"}
+template<size_t Count>
+constexpr std::array<RouteSegment, Count> split_route_path(std::string_view path) {
+    std::array<RouteSegment, Count> res{};
+    size_t pos = 1;
+    for (auto& segment : res) {
+        size_t end = route_segment_end(path, pos);
+        auto text = path.substr(pos, end - pos);
+        if (text == "*") {
+            segment = {RouteSegment::Wildcard, text};
+        } else if (text.starts_with(':')) {
+            segment = {RouteSegment::Capture, text.substr(1)};
+        } else {
+            segment = {RouteSegment::Literal, text};
+        }
+        pos = end + 1;
+    }
+    return res;
+}
+
+// '*' only as the whole last segment, every capture named
+constexpr bool route_path_valid(std::string_view path) {
+    for (size_t i = 0; i < path.size(); ++i) {
+        if (path[i] == '*' && (i == 0 || i + 1 != path.size() || path[i - 1] != '/')) {
+            return false;
+        }
+        if (path[i] == ':' && i > 0 && path[i - 1] == '/' && (i + 1 == path.size() || path[i + 1] == '/')) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Negative if a is tried before b. Segment by segment a literal goes before
+// a capture and a capture before '*', the order the radix tree of
+// HttpRouter tries them in, so both find the same route for a path.
+constexpr int compare_route_paths(std::string_view a, std::string_view b) {
+    auto kind_at = [](std::string_view path, size_t pos) {
+        return pos < path.size() && path[pos] == '*' ? RouteSegment::Wildcard
+            : pos < path.size() && path[pos] == ':' ? RouteSegment::Capture
+            : RouteSegment::Literal;
+    };
+    auto next = [](std::string_view path, size_t pos) {
+        size_t end = route_segment_end(path, pos);
+        return end == path.size() ? std::string_view::npos : end + 1;
+    };
+
+    size_t i = 1, j = 1;
+    for (; i != std::string_view::npos && j != std::string_view::npos; i = next(a, i), j = next(b, j)) {
+        auto x = kind_at(a, i);
+        auto y = kind_at(b, j);
+        if (x != y) {
+            return x < y ? -1 : 1;
+        }
+    }
+    if (i == j) {
+        return 0;
+    }
+    return i == std::string_view::npos ? -1 : 1;
+}
+
+// the path up to its first capture or '*', without the '/' before it:
+// "/users/:id" -> "/users", "/health" -> "/health", "/*" -> ""
+constexpr std::string_view route_literal_prefix(std::string_view path) {
+    for (size_t pos = 1; pos <= path.size(); pos = route_segment_end(path, pos) + 1) {
+        if (pos < path.size() && (path[pos] == ':' || path[pos] == '*')) {
+            return path.substr(0, pos - 1);
+        }
+    }
+    return path;
+}
+
+// the hash of "", the prefix of no segments
+constexpr uint64_t route_hash_basis = 0xcbf29ce484222325;
+
+// Hashes the segment of text that starts at pos into hash and returns its
+// end. Eight bytes at a time, the '/' is found in the word that is hashed;
+// the words are the same at compile time and at run time.
+constexpr size_t route_hash_segment(uint64_t& hash, std::string_view text, size_t pos) {
+    constexpr uint64_t prime = 0x9e3779b97f4a7c15;
+    constexpr uint64_t ones = 0x0101010101010101;
+    for (;; pos += 8) {
+        size_t n = std::min<size_t>(text.size() - pos, 8);
+        uint64_t word = 0;
+        if (!std::is_constant_evaluated() && std::endian::native == std::endian::little && n == 8) {
+            std::memcpy(&word, text.data() + pos, 8);
+        } else {
+            for (size_t i = 0; i < n; ++i) {
+                word |= static_cast<uint64_t>(static_cast<unsigned char>(text[pos + i])) << (8 * i);
+            }
+        }
+        // the lowest byte that is '/'
+        uint64_t slash = word ^ (ones * '/');
+        slash = (slash - ones) & ~slash & (ones << 7);
+        size_t length = slash ? static_cast<size_t>(std::countr_zero(slash)) / 8 : n;
+        if (length < 8) {
+            word &= (uint64_t(1) << (8 * length)) - 1;
+        }
+        hash = (hash ^ word) * prime;
+        if (length < 8) {
+            return pos + length;
+        }
+    }
+}
+
+constexpr uint64_t route_hash_prefix(std::string_view prefix) {
+    uint64_t hash = route_hash_basis;
+    for (size_t pos = 1; pos <= prefix.size(); ++pos) {
+        pos = route_hash_segment(hash, prefix, pos);
+    }
+    return hash;
+}
+
+// slots is a power of two; the top bits, a product leaves the low ones to
+// the low bytes
+constexpr size_t route_hash_slot(uint64_t hash, size_t slots) {
+    int bits = std::countr_zero(slots);
+    return bits == 0 ? 0 : static_cast<size_t>(hash >> (64 - bits));
+}
+
+// the routes of a RouteTable under one literal prefix
+struct RouteBucket {
+    uint64_t hash = 0;
+    std::string_view prefix;
+    // a range of RouteTable::by_prefix, empty for a free slot
+    size_t begin = 0;
+    size_t end = 0;
+};
+
+// path is everything before the query; captures go to params, which are
+// left as they were if the path does not match
+inline bool match_route_segments(const RouteSegment* segments, size_t count, std::string_view path,
+    PathParams& params)
+{
+    size_t pushed = params.size();
+    auto fail = [&] {
+        for (; params.size() > pushed; params.pop());
+        return false;
+    };
+
+    for (size_t i = 0; i < count; ++i) {
+        if (path.empty() || path.front() != '/') {
+            return fail();
+        }
+        path.remove_prefix(1);
+
+        auto& segment = segments[i];
+        if (segment.kind == RouteSegment::Wildcard) {
+            params.push("*", path);
+            return true;
+        }
+        auto value = path.substr(0, route_segment_end(path, 0));
+        if (segment.kind == RouteSegment::Literal) {
+            if (value != segment.text) {
+                return fail();
+            }
+        } else {
+            if (value.empty()) {
+                return fail();
+            }
+            params.push(segment.text, value);
+        }
+        path.remove_prefix(value.size());
+    }
+    return path.empty() || fail();
+}
+
+// One route of a RouteTable. Path has the syntax of HttpRouter routes, with
+// '*' only as the whole last segment. Handler is a function or a lambda
+// without captures, of any handler type HttpRouter::route takes. The server
+// reaches it through the std::function of the route, whose thunk calls it
+// directly, so the compiler can inline it there.
+template<http_method Method, RoutePath Path, auto Handler>
+struct TableRoute {
+    static constexpr http_method method = Method;
+    // a copy, views into Path itself are not usable in constant expressions
+    static constexpr auto path_data = Path;
+    static constexpr std::string_view path = path_data.view();
+    static constexpr auto segments = split_route_path<route_segment_count(path)>(path);
+    static constexpr bool exact = std::none_of(segments.begin(), segments.end(),
+        [](const RouteSegment& segment) { return segment.kind != RouteSegment::Literal; });
+
+    static_assert(path.starts_with('/'), "A table route starts with '/'");
+    static_assert(route_path_valid(path), "'*' must be the whole last segment and every capture needs a name");
+    static_assert(std::count_if(segments.begin(), segments.end(),
+        [](const RouteSegment& segment) { return segment.kind != RouteSegment::Literal; }) <= PathParams::max_size,
+        "Too many captures in route");
+
+    // segments of the literal prefix, see route_literal_prefix
+    static constexpr size_t literals = route_segment_count(route_literal_prefix(path));
+
+    // rest is what follows the literal prefix in the url path, the prefix
+    // itself has been matched by the caller
+    static bool match_rest(http_method method, std::string_view rest, PathParams& params) {
+        if (method != Method) {
+            return false;
+        }
+        if constexpr (exact) {
+            return rest.empty();
+        } else {
+            return match_route_segments(segments.data() + literals, segments.size() - literals, rest, params);
+        }
+    }
+
+    static HttpRouter::HttpRoute make_route() {
+        using H = decltype(Handler);
+        if constexpr (std::is_invocable_r_v<int, H, HttpRequestView&, HttpResponse&>) {
+            return HttpRouter::HttpHandler([](HttpRequestView& req, HttpResponse& resp) {
+                return std::invoke(Handler, req, resp);
+            });
+        } else if constexpr (std::is_invocable_r_v<asio::awaitable<int>, H, HttpRequestView&, HttpResponse&>) {
+            return HttpRouter::HttpAsyncHandler([](HttpRequestView& req, HttpResponse& resp) {
+                return std::invoke(Handler, req, resp);
+            });
+        } else if constexpr (std::is_invocable_r_v<std::unique_ptr<HttpBodyReader>, H, HttpRequestView&>) {
+            return HttpRouter::HttpStreamHandler([](HttpRequestView& req) {
+                return std::invoke(Handler, req);
+            });
+        } else if constexpr (std::is_invocable_r_v<asio::awaitable<void>, H, HttpRequestView&, HttpResponseWriter&>) {
+            return HttpRouter::HttpChunkedHandler([](HttpRequestView& req, HttpResponseWriter& writer) {
+                return std::invoke(Handler, req, writer);
+            });
+        } else {
+            static_assert(std::is_invocable_r_v<asio::awaitable<void>, H, HttpRequestView&, WebSocket&>,
+                "Handler has none of the HttpRouter handler signatures");
+            return HttpRouter::WebSocketHandler([](HttpRequestView& req, WebSocket& socket) {
+                return std::invoke(Handler, req, socket);
+            });
+        }
+    }
+};
+
+// Routes known at compile time, installed with HttpRouter::table:
+//
+//     using Api = RouteTable<
+//         TableRoute<HTTP_GET, "/health", health>,
+//         TableRoute<HTTP_GET, "/users/:id", get_user>,
+//         TableRoute<HTTP_POST, "/users", create_user>>;
+//     router.table(Api{});
+//
+// Each route is filed under its literal prefix in a hash table that is laid
+// out at compile time. A lookup hashes the url path once, taking the hash at
+// every '/', and probes the table for each prefix length the routes have,
+// longest first, since a longer literal prefix always takes precedence. Only
+// the routes under a matching prefix are tried, in precedence order, so an
+// exact path costs a hash and a compare however large the table is.
+template<typename... Routes>
+struct RouteTable {
+    static constexpr size_t size = sizeof...(Routes);
+
+    // indices into Routes in the order they are tried
+    static constexpr std::array<size_t, size> order = [] {
+        std::array<size_t, size> res{};
+        std::array<std::string_view, size> paths{Routes::path...};
+        for (size_t i = 0; i < size; ++i) {
+            res[i] = i;
+        }
+        std::sort(res.begin(), res.end(), [&](size_t a, size_t b) {
+            int cmp = compare_route_paths(paths[a], paths[b]);
+            return cmp != 0 ? cmp < 0 : a < b;
+        });
+        return res;
+    }();
+
+    static constexpr bool unique() {
+        // sorted, so that a large table stays within the constexpr limits
+        std::array<std::pair<http_method, std::string_view>, size> keys{std::pair{Routes::method, Routes::path}...};
+        std::sort(keys.begin(), keys.end());
+        return std::adjacent_find(keys.begin(), keys.end()) == keys.end();
+    }
+    static_assert(unique(), "A method and path appear twice in the route table");
+
+    static constexpr std::array<std::string_view, size> prefixes{route_literal_prefix(Routes::path)...};
+
+    // indices into Routes sorted by prefix, each prefix in the order of order
+    static constexpr std::array<size_t, size> by_prefix = [] {
+        std::array<size_t, size> rank{};
+        for (size_t i = 0; i < size; ++i) {
+            rank[order[i]] = i;
+        }
+        auto res = order;
+        std::sort(res.begin(), res.end(), [&](size_t a, size_t b) {
+            return prefixes[a] != prefixes[b] ? prefixes[a] < prefixes[b] : rank[a] < rank[b];
+        });
+        return res;
+    }();
+
+    static constexpr size_t prefix_count = [] {
+        size_t res = 0;
+        for (size_t i = 0; i < size; ++i) {
+            res += i == 0 || prefixes[by_prefix[i]] != prefixes[by_prefix[i - 1]];
+        }
+        return res;
+    }();
+
+    // open addressing, at most half full so that a miss ends soon
+    static constexpr std::array<RouteBucket, std::bit_ceil(2 * prefix_count + 1)> buckets = [] {
+        std::array<RouteBucket, std::bit_ceil(2 * prefix_count + 1)> res{};
+        for (size_t begin = 0, end = 0; begin < size; begin = end) {
+            auto prefix = prefixes[by_prefix[begin]];
+            for (end = begin + 1; end < size && prefixes[by_prefix[end]] == prefix; ++end);
+            uint64_t hash = route_hash_prefix(prefix);
+            size_t slot = route_hash_slot(hash, res.size());
+            for (; res[slot].begin != res[slot].end; slot = (slot + 1) & (res.size() - 1));
+            res[slot] = {hash, prefix, begin, end};
+        }
+        return res;
+    }();
+
+    // the number of '/' in a prefix, each one once and the largest first
+    static constexpr auto prefix_lengths = [] {
+        constexpr auto seen = [] {
+            std::array<bool, 1 + std::max({size_t(0), route_segment_count(Routes::path)...})> res{};
+            for (auto prefix : prefixes) {
+                res[route_segment_count(prefix)] = true;
+            }
+            return res;
+        }();
+        std::array<size_t, std::count(seen.begin(), seen.end(), true)> res{};
+        for (size_t i = seen.size(), n = 0; i-- > 0;) {
+            if (seen[i]) {
+                res[n++] = i;
+            }
+        }
+        return res;
+    }();
+
+    // routes holds make_route() of every route, in the order of Routes
+    static const HttpRouter::HttpRoute* find(const HttpRouter::HttpRoute* routes, http_method method,
+        std::string_view path, PathParams& params)
+    {
+        constexpr size_t longest = prefix_lengths.empty() ? 0 : prefix_lengths[0];
+        if (path.empty() || path.front() != '/') {
+            return nullptr;
+        }
+
+        // hashes[n] is the hash of the first n segments of the path, which end
+        // at ends[n]; one pass over the segments that can be part of a prefix
+        std::array<uint64_t, longest + 1> hashes;
+        std::array<size_t, longest + 1> ends;
+        hashes[0] = route_hash_basis;
+        ends[0] = 0;
+        size_t hashed = 1;
+        for (size_t pos = 1; hashed <= longest && pos <= path.size(); ++hashed, ++pos) {
+            uint64_t hash = hashes[hashed - 1];
+            pos = route_hash_segment(hash, path, pos);
+            hashes[hashed] = hash;
+            ends[hashed] = pos;
+        }
+
+        for (size_t length : prefix_lengths) {
+            if (length >= hashed) {
+                continue;
+            }
+            auto prefix = path.substr(0, ends[length]);
+            size_t slot = route_hash_slot(hashes[length], buckets.size());
+            for (; buckets[slot].begin != buckets[slot].end; slot = (slot + 1) & (buckets.size() - 1)) {
+                auto& bucket = buckets[slot];
+                if (bucket.hash != hashes[length] || bucket.prefix != prefix) {
+                    continue;
+                }
+                for (size_t i = bucket.begin; i < bucket.end; ++i) {
+                    if (matchers[by_prefix[i]](method, path.substr(prefix.size()), params)) {
+                        return routes + by_prefix[i];
+                    }
+                }
+                break;
+            }
+        }
+        return nullptr;
+    }
+
+    static std::vector<HttpRouter::HttpRoute> make_routes() {
+        std::vector<HttpRouter::HttpRoute> res;
+        res.reserve(size);
+        (res.push_back(Routes::make_route()), ...);
+        return res;
+    }
+
+private:
+    using Matcher = bool (*)(http_method, std::string_view, PathParams&);
+    static constexpr std::array<Matcher, size> matchers{&Routes::match_rest...};
+};
+
+template<typename... Routes>
+void HttpRouter::table(RouteTable<Routes...>) {
+    insert_table(&RouteTable<Routes...>::find,
+        {std::pair<http_method, std::string_view>{Routes::method, Routes::path}...},
+        RouteTable<Routes...>::make_routes());
+}
+
+}
+
+#endif
@@ -0,0 +1,460 @@
+#include "cyno/http/StaticFiles.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <list>
+#include <mutex>
+#include <sstream>
+#include <system_error>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <io.h>
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+namespace cyno {
+
+using Clock = std::chrono::steady_clock;
+
+// the few system calls used here, in POSIX and in the MSVC runtime
+#ifdef _WIN32
+using FileStat = struct _stat64;
+
+static int stat_path(const char* path, FileStat& st) {
+    return ::_stat64(path, &st);
+}
+
+static int stat_fd(int fd, FileStat& st) {
+    return ::_fstat64(fd, &st);
+}
+
+static bool is_regular_file(const FileStat& st) {
+    return (st.st_mode & _S_IFMT) == _S_IFREG;
+}
+
+static int open_read_only(const char* path) {
+    return ::_open(path, _O_RDONLY | _O_BINARY | _O_NOINHERIT);
+}
+
+static void close_fd(int fd) {
+    ::_close(fd);
+}
+
+static void utc_time(time_t time, std::tm& tm) {
+    ::_gmtime64_s(&tm, &time);
+}
+
+static time_t from_utc_time(std::tm& tm) {
+    return ::_mkgmtime(&tm);
+}
+#else
+using FileStat = struct stat;
+
+static int stat_path(const char* path, FileStat& st) {
+    return ::stat(path, &st);
+}
+
+static int stat_fd(int fd, FileStat& st) {
+    return ::fstat(fd, &st);
+}
+
+static bool is_regular_file(const FileStat& st) {
+    return S_ISREG(st.st_mode);
+}
+
+static int open_read_only(const char* path) {
+    return ::open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static void close_fd(int fd) {
+    ::close(fd);
+}
+
+static void utc_time(time_t time, std::tm& tm) {
+    ::gmtime_r(&time, &tm);
+}
+
+static time_t from_utc_time(std::tm& tm) {
+    return ::timegm(&tm);
+}
+#endif
+
+size_t read_file_at(int fd, char* buf, size_t size, size_t offset) {
+#ifdef _WIN32
+    // with an offset in OVERLAPPED, ReadFile reads there whatever the file position
+    OVERLAPPED overlapped{};
+    overlapped.Offset = static_cast<DWORD>(static_cast<uint64_t>(offset));
+    overlapped.OffsetHigh = static_cast<DWORD>(static_cast<uint64_t>(offset) >> 32);
+    DWORD read_len = 0;
+    auto handle = reinterpret_cast<HANDLE>(::_get_osfhandle(fd));
+    if (!::ReadFile(handle, buf, static_cast<DWORD>(std::min<size_t>(size, MAXDWORD)), &read_len, &overlapped)) {
+        DWORD err = ::GetLastError();
+        if (err == ERROR_HANDLE_EOF) {
+            return 0;
+        }
+        throw std::system_error(static_cast<int>(err), std::system_category(), "ReadFile");
+    }
+    return read_len;
+#else
+    for (; ;) {
+        ssize_t n = ::pread(fd, buf, size, static_cast<off_t>(offset));
+        if (n >= 0) {
+            return static_cast<size_t>(n);
+        }
+        if (errno != EINTR) {
+            throw std::system_error(errno, std::system_category(), "pread");
+        }
+    }
+#endif
+}
+
+// an open descriptor and what fstat said about it
+struct OpenFile {
+    int fd = -1;
+    decltype(FileStat::st_dev) device = 0;
+    decltype(FileStat::st_ino) inode = 0;
+    size_t size = 0;
+    time_t mtime = 0;
+    std::string etag;
+    std::string last_modified;
+    std::string_view content_type;
+    // guarded by StaticFiles::Impl::mutex
+    Clock::time_point checked;
+
+    ~OpenFile() {
+        if (fd >= 0) {
+            close_fd(fd);
+        }
+    }
+
+    bool same_as(const FileStat& st) const {
+        return device == st.st_dev && inode == st.st_ino
+            && size == static_cast<size_t>(st.st_size) && mtime == st.st_mtime;
+    }
+};
+
+struct StaticFiles::Impl {
+    std::string root;
+    StaticFileConfig config;
+
+    std::mutex mutex;
+    // most recently used first
+    std::list<std::pair<std::string, std::shared_ptr<OpenFile>>> lru;
+    std::unordered_map<std::string_view, decltype(lru)::iterator> index;
+
+    // nullptr if path is not a readable regular file
+    std::shared_ptr<OpenFile> open(const std::string& path);
+    void store(const std::string& path, std::shared_ptr<OpenFile> file);
+    void forget(const std::string& path);
+};
+
+static std::string_view content_type_of(std::string_view path) {
+    static const std::unordered_map<std::string_view, std::string_view> types = {
+        {"html", "text/html; charset=UTF-8"},
+        {"htm", "text/html; charset=UTF-8"},
+        {"css", "text/css; charset=UTF-8"},
+        {"js", "text/javascript; charset=UTF-8"},
+        {"mjs", "text/javascript; charset=UTF-8"},
+        {"json", "application/json"},
+        {"txt", "text/plain; charset=UTF-8"},
+        {"xml", "application/xml"},
+        {"svg", "image/svg+xml"},
+        {"png", "image/png"},
+        {"jpg", "image/jpeg"},
+        {"jpeg", "image/jpeg"},
+        {"gif", "image/gif"},
+        {"webp", "image/webp"},
+        {"ico", "image/x-icon"},
+        {"wasm", "application/wasm"},
+        {"pdf", "application/pdf"},
+        {"woff", "font/woff"},
+        {"woff2", "font/woff2"},
+        {"mp4", "video/mp4"},
+    };
+
+    auto name = path.substr(path.rfind('/') + 1);
+    if (size_t dot = name.rfind('.'); dot != std::string_view::npos) {
+        if (auto it = types.find(name.substr(dot + 1)); it != types.end()) {
+            return it->second;
+        }
+    }
+    return "application/octet-stream";
+}
+
+static std::string format_http_date(time_t time) {
+    std::tm tm;
+    utc_time(time, tm);
+    char buf[64];
+    size_t len = std::strftime(buf, sizeof(buf), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    return {buf, len};
+}
+
+// -1 if malformed
+static time_t parse_http_date(std::string_view str) {
+    std::tm tm{};
+    std::istringstream in{std::string(str)};
+    in >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S GMT");
+    return in.fail() ? -1 : from_utc_time(tm);
+}
+
+static std::string make_etag(const FileStat& st) {
+    char buf[64];
+    char* p = buf;
+    *p++ = '"';
+    p = std::to_chars(p, buf + sizeof(buf), static_cast<unsigned long long>(st.st_mtime), 16).ptr;
+    *p++ = '-';
+    p = std::to_chars(p, buf + sizeof(buf), static_cast<unsigned long long>(st.st_size), 16).ptr;
+    *p++ = '"';
+    return {buf, p};
+}
+
+static std::string_view trim(std::string_view str) {
+    size_t begin = str.find_first_not_of(" \t");
+    if (begin == std::string_view::npos) {
+        return {};
+    }
+    return str.substr(begin, str.find_last_not_of(" \t") - begin + 1);
+}
+
+// no "..", so the path cannot leave root
+static bool is_safe(std::string_view path) {
+    if (path.find('\0') != std::string_view::npos || path.find('\\') != std::string_view::npos) {
+        return false;
+    }
+    for (size_t pos = 0; pos <= path.length();) {
+        size_t end = std::min(path.find('/', pos), path.length());
+        if (path.substr(pos, end - pos) == "..") {
+            return false;
+        }
+        pos = end + 1;
+    }
+    return true;
+}
+
+static bool is_not_modified(const HttpRequestView& req, const OpenFile& file) {
+    // If-None-Match wins over If-Modified-Since
+    if (auto tags = req.headers.get(HttpField::IfNoneMatch); !tags.empty()) {
+        for (size_t pos = 0; pos <= tags.length();) {
+            size_t end = std::min(tags.find(',', pos), tags.length());
+            auto tag = trim(tags.substr(pos, end - pos));
+            if (tag.starts_with("W/")) {
+                tag.remove_prefix(2);
+            }
+            if (tag == "*" || tag == file.etag) {
+                return true;
+            }
+            pos = end + 1;
+        }
+        return false;
+    }
+
+    if (auto since = req.headers.get(HttpField::IfModifiedSince); !since.empty()) {
+        time_t time = parse_http_date(since);
+        return time != -1 && file.mtime <= time;
+    }
+    return false;
+}
+
+enum class RangeResult {
+    Whole, Partial, Unsatisfiable
+};
+
+// Only "bytes=first-last", "bytes=first-" and "bytes=-suffix". Anything else,
+// including a list of ranges, is ignored and the whole file is sent.
+static RangeResult parse_range(std::string_view range, size_t size, size_t& offset, size_t& length) {
+    range = trim(range);
+    if (!range.starts_with("bytes=") || range.find(',') != std::string_view::npos) {
+        return RangeResult::Whole;
+    }
+    range.remove_prefix(6);
+    size_t dash = range.find('-');
+    if (dash == std::string_view::npos) {
+        return RangeResult::Whole;
+    }
+
+    auto to_number = [](std::string_view str, size_t& num) {
+        str = trim(str);
+        auto [ptr, ec] = std::from_chars(str.data(), str.data() + str.length(), num);
+        return !str.empty() && ec == std::errc() && ptr == str.data() + str.length();
+    };
+
+    size_t first = 0;
+    size_t last = 0;
+    auto first_str = trim(range.substr(0, dash));
+    auto last_str = trim(range.substr(dash + 1));
+    if (first_str.empty()) {
+        // the last n bytes
+        if (!to_number(last_str, last)) {
+            return RangeResult::Whole;
+        }
+        if (last == 0 || size == 0) {
+            return RangeResult::Unsatisfiable;
+        }
+        offset = size - std::min(last, size);
+        length = size - offset;
+        return RangeResult::Partial;
+    }
+
+    if (!to_number(first_str, first) || (!last_str.empty() && !to_number(last_str, last))) {
+        return RangeResult::Whole;
+    }
+    if (last_str.empty() || last >= size) {
+        last = size - 1;
+    }
+    if (first >= size) {
+        return RangeResult::Unsatisfiable;
+    }
+    if (first > last) {
+        return RangeResult::Whole;
+    }
+    offset = first;
+    length = last - first + 1;
+    return RangeResult::Partial;
+}
+
+std::shared_ptr<OpenFile> StaticFiles::Impl::open(const std::string& path) {
+    auto now = Clock::now();
+    std::shared_ptr<OpenFile> cached;
+    {
+        std::unique_lock lk(mutex);
+        if (auto it = index.find(path); it != index.end()) {
+            lru.splice(lru.begin(), lru, it->second);
+            cached = it->second->second;
+            if (now - cached->checked < std::chrono::milliseconds(config.revalidate)) {
+                return cached;
+            }
+        }
+    }
+
+    FileStat st;
+    if (stat_path(path.c_str(), st) != 0 || !is_regular_file(st)) {
+        if (cached) {
+            forget(path);
+        }
+        return nullptr;
+    }
+    if (cached && cached->same_as(st)) {
+        std::unique_lock lk(mutex);
+        cached->checked = now;
+        return cached;
+    }
+
+    int fd = open_read_only(path.c_str());
+    if (fd < 0) {
+        return nullptr;
+    }
+    auto file = std::make_shared<OpenFile>();
+    file->fd = fd;
+    // the file may have been replaced between stat and open
+    if (stat_fd(fd, st) != 0 || !is_regular_file(st)) {
+        return nullptr;
+    }
+    file->device = st.st_dev;
+    file->inode = st.st_ino;
+    file->size = static_cast<size_t>(st.st_size);
+    file->mtime = st.st_mtime;
+    file->etag = make_etag(st);
+    file->last_modified = format_http_date(st.st_mtime);
+    file->content_type = content_type_of(path);
+    file->checked = now;
+
+    store(path, file);
+    return file;
+}
+
+void StaticFiles::Impl::store(const std::string& path, std::shared_ptr<OpenFile> file) {
+    std::unique_lock lk(mutex);
+    if (auto it = index.find(path); it != index.end()) {
+        it->second->second = std::move(file);
+        return;
+    }
+
+    lru.emplace_front(path, std::move(file));
+    index.emplace(lru.front().first, lru.begin());
+    // responses still being written keep their descriptor open
+    for (; lru.size() > config.max_open_files;) {
+        index.erase(lru.back().first);
+        lru.pop_back();
+    }
+}
+
+void StaticFiles::Impl::forget(const std::string& path) {
+    std::unique_lock lk(mutex);
+    if (auto it = index.find(path); it != index.end()) {
+        auto pos = it->second;
+        index.erase(it);
+        lru.erase(pos);
+    }
+}
+
+CLASS_PIMPL_IMPLEMENT(StaticFiles)
+
+StaticFiles::StaticFiles(std::string root, StaticFileConfig config) {
+    impl = new Impl;
+    impl->root = std::move(root);
+    impl->config = config;
+    for (; impl->root.length() > 1 && impl->root.ends_with('/'); impl->root.pop_back());
+}
+
+int StaticFiles::serve(HttpRequestView& req, HttpResponse& resp, std::string_view path) {
+    if (!is_safe(path)) {
+        throw NotMatchPathError("The requested file does not exist");
+    }
+
+    std::string full = impl->root;
+    if (!path.starts_with('/')) {
+        full.push_back('/');
+    }
+    full.append(path);
+    if (full.ends_with('/')) {
+        full.append("index.html");
+    }
+
+    auto file = impl->open(full);
+    if (!file) {
+        throw NotMatchPathError("The requested file does not exist");
+    }
+
+    resp.headers[HttpField::ETag] = file->etag;
+    resp.headers[HttpField::LastModified] = file->last_modified;
+    resp.headers[HttpField::AcceptRanges] = "bytes";
+    if (is_not_modified(req, *file)) {
+        return HTTP_STATUS_NOT_MODIFIED;
+    }
+    resp.headers[HttpField::ContentType] = file->content_type;
+
+    size_t offset = 0;
+    size_t length = file->size;
+    int status = HTTP_STATUS_OK;
+
+    // If-Range: the range only applies to the version the client has
+    auto range = req.headers.get(HttpField::Range);
+    auto if_range = trim(req.headers.get(HttpField::IfRange));
+    if (!range.empty() && (if_range.empty() || if_range == file->etag || if_range == file->last_modified)) {
+        switch (parse_range(range, file->size, offset, length)) {
+        case RangeResult::Unsatisfiable:
+            resp.headers[HttpField::ContentRange] = "bytes */" + std::to_string(file->size);
+            return HTTP_STATUS_RANGE_NOT_SATISFIABLE;
+        case RangeResult::Partial:
+            resp.headers[HttpField::ContentRange] = "bytes " + std::to_string(offset) + "-"
+                + std::to_string(offset + length - 1) + "/" + std::to_string(file->size);
+            status = HTTP_STATUS_PARTIAL_CONTENT;
+            break;
+        case RangeResult::Whole:
+            break;
+        }
+    }
+
+    resp.file = HttpFileBody{file, file->fd, offset, length};
+    return status;
+}
+
+}
@@ -0,0 +1,35 @@
+#ifndef CYNO_STATIC_FILES_H_
+#define CYNO_STATIC_FILES_H_
+
+#include <string>
+#include <string_view>
+#include "cyno/base/Pimpl.h"
+#include "cyno/http/HttpConfig.h"
+#include "cyno/http/HttpMessage.h"
+
+namespace cyno {
+
+// Reads up to size bytes of fd at offset without moving its file position,
+// so threads may share fd. Returns the bytes read, 0 at the end of the file.
+// throw std::system_error
+size_t read_file_at(int fd, char* buf, size_t size, size_t offset);
+
+// Serves the files below root. The response carries the open file, which the
+// server sends with sendfile. Open descriptors and their stat results are kept
+// in an LRU cache and checked against the file system after config.revalidate.
+// Handles Range (one range), If-Range, If-None-Match and If-Modified-Since.
+class StaticFiles {
+
+    CLASS_PIMPL_DECLARE(StaticFiles)
+
+public:
+    explicit StaticFiles(std::string root, StaticFileConfig config = http_config.static_file_config);
+
+    // path is decoded and relative to root, a directory serves its index.html
+    // throw NotMatchPathError
+    int serve(HttpRequestView& req, HttpResponse& resp, std::string_view path);
+};
+
+}
+
+#endif
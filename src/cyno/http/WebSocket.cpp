@@ -0,0 +1,684 @@
+#include "cyno/http/WebSocket.h"
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include "asio/co_spawn.hpp"
+#include "asio/detached.hpp"
+#include "asio/post.hpp"
+#include "asio/redirect_error.hpp"
+#include "asio/steady_timer.hpp"
+#include "asio/this_coro.hpp"
+#include "asio/use_awaitable.hpp"
+#include "cyno/base/Exceptions.h"
+#include "cyno/http/HttpConfig.h"
+#include "spdlog/spdlog.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace cyno {
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr std::string_view websocket_guid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+// 2 + 8 bytes of length + 4 of mask
+static constexpr size_t websocket_max_header_size = 14;
+static constexpr size_t websocket_max_control_size = 125;
+
+// xors len bytes of src with the 4 byte mask into dst, the mask starting
+// over at src; dst may be src or lie before it, every block is loaded
+// before it is stored
+static void websocket_unmask(char* dst, const char* src, size_t len, uint32_t mask) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i mask256 = _mm256_set1_epi32(static_cast<int>(mask));
+    for (; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(block, mask256));
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i mask128 = _mm_set1_epi32(static_cast<int>(mask));
+    for (; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(block, mask128));
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t mask128 = vreinterpretq_u8_u32(vdupq_n_u32(mask));
+    for (; i + 16 <= len; i += 16) {
+        uint8x16_t block = vld1q_u8(reinterpret_cast<const uint8_t*>(src + i));
+        vst1q_u8(reinterpret_cast<uint8_t*>(dst + i), veorq_u8(block, mask128));
+    }
+#endif
+    const uint64_t mask64 = mask | static_cast<uint64_t>(mask) << 32;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t block;
+        std::memcpy(&block, src + i, 8);
+        block ^= mask64;
+        std::memcpy(dst + i, &block, 8);
+    }
+    unsigned char bytes[4];
+    std::memcpy(bytes, &mask, 4);
+    for (; i < len; ++i) {
+        dst[i] = static_cast<char>(src[i] ^ bytes[i & 3]);
+    }
+}
+
+// text messages must be UTF-8, without surrogates or overlong forms
+static bool websocket_valid_utf8(std::string_view str) {
+    auto p = reinterpret_cast<const unsigned char*>(str.data());
+    auto end = p + str.size();
+    while (p < end) {
+        // ASCII eight bytes at a time
+        if (end - p >= 8) {
+            uint64_t block;
+            std::memcpy(&block, p, 8);
+            if ((block & 0x8080808080808080ull) == 0) {
+                p += 8;
+                continue;
+            }
+        }
+        unsigned char c = *p;
+        if (c < 0x80) {
+            ++p;
+            continue;
+        }
+        size_t n = c >= 0xf0 ? 3 : c >= 0xe0 ? 2 : c >= 0xc2 ? 1 : 0;
+        if (n == 0 || c > 0xf4 || static_cast<size_t>(end - p) <= n) {
+            return false;
+        }
+        unsigned char second = p[1];
+        unsigned char low = 0x80, high = 0xbf;
+        if (c == 0xe0) {
+            low = 0xa0;
+        } else if (c == 0xed) {
+            high = 0x9f;
+        } else if (c == 0xf0) {
+            low = 0x90;
+        } else if (c == 0xf4) {
+            high = 0x8f;
+        }
+        if (second < low || second > high) {
+            return false;
+        }
+        for (size_t k = 2; k <= n; ++k) {
+            if ((p[k] & 0xc0) != 0x80) {
+                return false;
+            }
+        }
+        p += n + 1;
+    }
+    return true;
+}
+
+// only for Sec-WebSocket-Accept
+static std::array<unsigned char, 20> websocket_sha1(std::string_view data) {
+    uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+    std::string msg(data);
+    uint64_t bits = static_cast<uint64_t>(data.size()) * 8;
+    msg.push_back(static_cast<char>(0x80));
+    while (msg.size() % 64 != 56) {
+        msg.push_back('\0');
+    }
+    for (int i = 7; i >= 0; --i) {
+        msg.push_back(static_cast<char>(bits >> (i * 8)));
+    }
+
+    auto rotl = [](uint32_t x, int n) { return (x << n) | (x >> (32 - n)); };
+    for (size_t chunk = 0; chunk < msg.size(); chunk += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            auto b = reinterpret_cast<const unsigned char*>(msg.data() + chunk + i * 4);
+            w[i] = uint32_t(b[0]) << 24 | uint32_t(b[1]) << 16 | uint32_t(b[2]) << 8 | b[3];
+        }
+        for (int i = 16; i < 80; ++i) {
+            w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        }
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5a827999;
+            } else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ed9eba1;
+            } else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8f1bbcdc;
+            } else {
+                f = b ^ c ^ d;
+                k = 0xca62c1d6;
+            }
+            uint32_t temp = rotl(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    std::array<unsigned char, 20> digest;
+    for (int i = 0; i < 20; ++i) {
+        digest[i] = static_cast<unsigned char>(h[i / 4] >> (24 - (i % 4) * 8));
+    }
+    return digest;
+}
+
+static std::string websocket_base64(const unsigned char* data, size_t len) {
+    static constexpr char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string out;
+    for (size_t i = 0; i < len; i += 3) {
+        uint32_t group = uint32_t(data[i]) << 16;
+        if (i + 1 < len) {
+            group |= uint32_t(data[i + 1]) << 8;
+        }
+        if (i + 2 < len) {
+            group |= data[i + 2];
+        }
+        out.push_back(alphabet[group >> 18 & 63]);
+        out.push_back(alphabet[group >> 12 & 63]);
+        out.push_back(i + 1 < len ? alphabet[group >> 6 & 63] : '=');
+        out.push_back(i + 2 < len ? alphabet[group & 63] : '=');
+    }
+    return out;
+}
+
+// token is one of the comma separated values, in any case
+static bool has_token(std::string_view value, std::string_view token) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        auto item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) {
+            item.remove_prefix(1);
+        }
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) {
+            item.remove_suffix(1);
+        }
+        if (iequals(item, token)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) {
+            break;
+        }
+        value.remove_prefix(comma + 1);
+    }
+    return false;
+}
+
+std::string websocket_handshake(const HttpRequestView& req) {
+    auto key = req.headers.get(HttpField::SecWebSocketKey);
+    if (req.method != HTTP_GET
+        || !has_token(req.headers.get(HttpField::Upgrade), "websocket")
+        || !has_token(req.headers.get(HttpField::Connection), "upgrade")
+        || req.headers.get(HttpField::SecWebSocketVersion) != "13"
+        || key.length() != 24)
+    {
+        throw HttpRequestError("Not a WebSocket handshake");
+    }
+
+    std::string accept(key);
+    accept.append(websocket_guid);
+    auto digest = websocket_sha1(accept);
+
+    std::string resp = "HTTP/1.1 101 Switching Protocols\r\n"
+                       "Upgrade: websocket\r\n"
+                       "Connection: Upgrade\r\n"
+                       "Sec-WebSocket-Accept: ";
+    resp.append(websocket_base64(digest.data(), digest.size()));
+    resp.append("\r\n\r\n");
+    return resp;
+}
+
+WebSocketFrame make_websocket_frame(WebSocketOpcode opcode, std::string_view payload) {
+    auto frame = std::make_shared<std::string>();
+    frame->reserve(payload.size() + 10);
+    frame->push_back(static_cast<char>(0x80 | opcode));
+    size_t len = payload.size();
+    if (len < 126) {
+        frame->push_back(static_cast<char>(len));
+    } else if (len <= 0xffff) {
+        frame->push_back(static_cast<char>(126));
+        frame->push_back(static_cast<char>(len >> 8));
+        frame->push_back(static_cast<char>(len));
+    } else {
+        frame->push_back(static_cast<char>(127));
+        for (int i = 7; i >= 0; --i) {
+            frame->push_back(static_cast<char>(static_cast<uint64_t>(len) >> (i * 8)));
+        }
+    }
+    frame->append(payload);
+    return frame;
+}
+
+struct WebSocket::State {
+    HttpStream& stream;
+    TimingWheel& wheel;
+    WebSocketConfig config = http_config.websocket_config;
+    asio::any_io_executor executor;
+
+    // [begin, message_end) is the message being joined,
+    // [pos, size) was read but not parsed yet
+    std::pmr::string& buffer;
+    size_t begin;
+    OnMove on_move;
+    size_t message_end;
+    size_t pos;
+    WebSocketOpcode message_opcode = WS_CONTINUATION;
+    bool delivered = false;
+    Clock::time_point last_received = Clock::now();
+    TimingWheel::Entry deadline;
+
+    // queued frames, swapped with writing by the writer
+    std::vector<WebSocketFrame> out;
+    std::vector<WebSocketFrame> writing;
+    std::vector<asio::const_buffer> gather;
+    size_t pending = 0;
+    bool close_sent = false;
+    bool close_received = false;
+    // the connection broke or was dropped
+    bool failed = false;
+    // run() is done with the handler, the writer drains the queue and stops
+    bool finishing = false;
+    bool writer_done = false;
+
+    // wakes everything waiting for a change by cancelling
+    asio::steady_timer changed;
+    asio::steady_timer ping_timer;
+
+    State(HttpStream& s, TimingWheel& w, std::pmr::string& b, size_t begin_, OnMove move)
+        : stream(s)
+        , wheel(w)
+        , buffer(b)
+        , begin(begin_)
+        , on_move(std::move(move))
+        , message_end(begin_)
+        , pos(begin_)
+        , deadline([this] { drop(); })
+        , changed(s.socket().get_executor(), asio::steady_timer::time_point::max())
+        , ping_timer(s.socket().get_executor())
+    {}
+
+    void notify() {
+        changed.cancel();
+    }
+
+    asio::awaitable<void> wait() {
+        asio::error_code err;
+        co_await changed.async_wait(asio::redirect_error(asio::use_awaitable, err));
+    }
+
+    void drop() {
+        asio::error_code err;
+        stream.socket().close(err);
+    }
+
+    void enqueue(WebSocketFrame frame) {
+        pending += frame->size();
+        out.push_back(std::move(frame));
+        notify();
+    }
+
+    void send_close(uint16_t code, std::string_view reason) {
+        if (close_sent) {
+            return;
+        }
+        close_sent = true;
+        std::string payload;
+        payload.push_back(static_cast<char>(code >> 8));
+        payload.push_back(static_cast<char>(code));
+        payload.append(reason.substr(0, websocket_max_control_size - 2));
+        enqueue(make_websocket_frame(WS_CLOSE, payload));
+    }
+
+    // a broadcast, on the strand
+    void post(WebSocketFrame frame) {
+        if (finishing || failed || close_sent) {
+            return;
+        }
+        if (pending + frame->size() > config.max_pending_bytes) {
+            // a slow reader must not hold up the group
+            failed = true;
+            drop();
+            notify();
+            return;
+        }
+        enqueue(std::move(frame));
+    }
+
+    asio::awaitable<void> read_more(size_t wanted);
+    // false if the frame at pos is incomplete, wanted is then what it needs
+    bool parse_frame(WebSocketMessage& message, bool& complete, size_t& wanted);
+    asio::awaitable<void> write_loop();
+    asio::awaitable<void> ping_loop();
+};
+
+WebSocket::WebSocket(HttpStream& stream, TimingWheel& wheel, std::pmr::string& buffer, size_t begin, OnMove on_move)
+    : state_(std::make_shared<State>(stream, wheel, buffer, begin, std::move(on_move)))
+{}
+
+WebSocket::~WebSocket() = default;
+
+asio::awaitable<void> WebSocket::run(Handler handler) {
+    auto& self = *state_;
+    self.executor = co_await asio::this_coro::executor;
+    // both hold the state, broadcasts may still reach it after run()
+    asio::co_spawn(self.executor, [state = state_]() { return state->write_loop(); }, asio::detached);
+    if (self.config.ping_interval > 0) {
+        asio::co_spawn(self.executor, [state = state_]() { return state->ping_loop(); }, asio::detached);
+    }
+
+    try {
+        co_await handler(*this);
+        self.send_close(1000, {});
+    } catch(const std::system_error&) {
+        // closed by the peer, or timed out
+        self.failed = true;
+    } catch(const std::exception& err) {
+        spdlog::error("WebSocket handler failed: {}", err.what());
+        self.send_close(1011, {});
+    }
+    // a peer that stopped reading cannot keep the queue from draining
+    if (self.config.idle_timeout > 0) {
+        self.wheel.schedule(self.deadline, std::chrono::milliseconds(self.config.idle_timeout));
+    }
+    self.finishing = true;
+    self.ping_timer.cancel();
+    self.notify();
+    for (; !self.writer_done;) {
+        co_await self.wait();
+    }
+    self.wheel.cancel(self.deadline);
+}
+
+void WebSocket::close(uint16_t code, std::string_view reason) {
+    state_->send_close(code, reason);
+}
+
+asio::awaitable<void> WebSocket::send(WebSocketOpcode opcode, std::string_view payload) {
+    return send(make_websocket_frame(opcode, payload));
+}
+
+asio::awaitable<void> WebSocket::send(WebSocketFrame frame) {
+    auto& self = *state_;
+    for (; !self.failed && self.pending > self.config.max_pending_bytes;) {
+        co_await self.wait();
+    }
+    if (self.failed || self.close_sent) {
+        throw std::system_error(asio::error::make_error_code(asio::error::not_connected));
+    }
+    self.enqueue(std::move(frame));
+}
+
+asio::awaitable<bool> WebSocket::receive(WebSocketMessage& message) {
+    auto& self = *state_;
+    if (self.delivered) {
+        self.message_end = self.begin;
+        self.delivered = false;
+    }
+
+    for (; !self.close_received && !self.failed;) {
+        try {
+            bool complete = false;
+            size_t wanted = 0;
+            for (; self.parse_frame(message, complete, wanted);) {
+                if (complete) {
+                    self.delivered = true;
+                    co_return true;
+                }
+                if (self.close_received) {
+                    co_return false;
+                }
+            }
+            co_await self.read_more(wanted);
+        } catch(const WebSocketError& err) {
+            spdlog::warn("WebSocket connection error: {}", err.what());
+            self.send_close(err.code(), err.what());
+            self.close_received = true;
+        }
+    }
+    co_return false;
+}
+
+bool WebSocket::State::parse_frame(WebSocketMessage& message, bool& complete, size_t& wanted) {
+    auto p = reinterpret_cast<const unsigned char*>(buffer.data() + pos);
+    size_t avail = buffer.size() - pos;
+    if (avail < 2) {
+        wanted = 2;
+        return false;
+    }
+
+    bool fin = p[0] & 0x80;
+    auto opcode = static_cast<WebSocketOpcode>(p[0] & 0x0f);
+    size_t len = p[1] & 0x7f;
+    if (p[0] & 0x70) {
+        throw WebSocketError(1002, "Reserved bits are set");
+    }
+    if (!(p[1] & 0x80)) {
+        throw WebSocketError(1002, "Client frames must be masked");
+    }
+    size_t header = 2 + (len == 126 ? 2 : len == 127 ? 8 : 0) + 4;
+    if (avail < header) {
+        wanted = header;
+        return false;
+    }
+    if (len == 126) {
+        len = size_t(p[2]) << 8 | p[3];
+    } else if (len == 127) {
+        uint64_t len64 = 0;
+        for (int i = 0; i < 8; ++i) {
+            len64 = len64 << 8 | p[2 + i];
+        }
+        if (len64 > config.max_message_size) {
+            throw WebSocketError(1009, "Message too big");
+        }
+        len = static_cast<size_t>(len64);
+    }
+
+    bool control = opcode & 0x8;
+    if (control) {
+        if (opcode != WS_CLOSE && opcode != WS_PING && opcode != WS_PONG) {
+            throw WebSocketError(1002, "Unknown opcode");
+        }
+        if (!fin || len > websocket_max_control_size) {
+            throw WebSocketError(1002, "Control frames must be whole and short");
+        }
+    } else {
+        if (opcode != WS_CONTINUATION && opcode != WS_TEXT && opcode != WS_BINARY) {
+            throw WebSocketError(1002, "Unknown opcode");
+        }
+        if ((opcode == WS_CONTINUATION) != (message_opcode != WS_CONTINUATION)) {
+            throw WebSocketError(1002, "Unexpected continuation");
+        }
+        if (message_end - begin + len > config.max_message_size) {
+            throw WebSocketError(1009, "Message too big");
+        }
+    }
+    if (avail < header + len) {
+        wanted = header + len;
+        return false;
+    }
+
+    uint32_t mask;
+    std::memcpy(&mask, p + header - 4, 4);
+    char* payload = buffer.data() + pos + header;
+    pos += header + len;
+    last_received = Clock::now();
+
+    if (!control) {
+        // unmasked straight behind the fragments before it
+        websocket_unmask(buffer.data() + message_end, payload, len, mask);
+        message_end += len;
+        if (opcode != WS_CONTINUATION) {
+            message_opcode = opcode;
+        }
+        if (fin) {
+            message.opcode = message_opcode;
+            message.payload = std::string_view(buffer.data() + begin, message_end - begin);
+            message_opcode = WS_CONTINUATION;
+            if (message.is_text() && !websocket_valid_utf8(message.payload)) {
+                throw WebSocketError(1007, "Text is not UTF-8");
+            }
+            complete = true;
+        }
+        return true;
+    }
+
+    websocket_unmask(payload, payload, len, mask);
+    std::string_view body(payload, len);
+    if (opcode == WS_PING) {
+        if (!close_sent) {
+            enqueue(make_websocket_frame(WS_PONG, body));
+        }
+    } else if (opcode == WS_CLOSE) {
+        if (len == 1) {
+            throw WebSocketError(1002, "Bad close frame");
+        }
+        uint16_t code = len >= 2 ? static_cast<uint16_t>(uint16_t(uint8_t(body[0])) << 8 | uint8_t(body[1])) : 1000;
+        // echoes the code, as the close handshake asks
+        send_close(code, {});
+        close_received = true;
+    }
+    return true;
+}
+
+asio::awaitable<void> WebSocket::State::read_more(size_t wanted) {
+    // what was parsed after the message being joined is done with
+    if (pos > message_end) {
+        buffer.erase(message_end, pos - message_end);
+        pos = message_end;
+    }
+
+    size_t used = buffer.size();
+    size_t needed = std::max(pos + std::max(wanted, websocket_max_header_size), used + 1);
+    if (needed > buffer.capacity()) {
+        const char* old_data = buffer.data();
+        buffer.reserve(std::max(needed, buffer.capacity() * 2));
+        if (buffer.data() != old_data && on_move) {
+            on_move(old_data, buffer.data(), begin);
+        }
+    }
+    buffer.resize(buffer.capacity());
+
+    if (config.idle_timeout > 0) {
+        wheel.schedule(deadline, std::chrono::milliseconds(config.idle_timeout));
+    }
+    size_t read_len = 0;
+    try {
+        read_len = co_await stream.read_some(asio::buffer(buffer.data() + used, buffer.size() - used));
+    } catch(...) {
+        buffer.resize(used);
+        wheel.cancel(deadline);
+        failed = true;
+        notify();
+        throw;
+    }
+    wheel.cancel(deadline);
+    buffer.resize(used + read_len);
+}
+
+asio::awaitable<void> WebSocket::State::write_loop() {
+    try {
+        for (;;) {
+            if (out.empty() || failed) {
+                if (finishing || failed) {
+                    break;
+                }
+                co_await wait();
+                continue;
+            }
+            // frames queued meanwhile go out with the next write
+            std::swap(out, writing);
+            gather.clear();
+            size_t bytes = 0;
+            for (auto& frame : writing) {
+                gather.push_back(asio::buffer(*frame));
+                bytes += frame->size();
+            }
+            co_await stream.write(gather);
+            pending -= bytes;
+            writing.clear();
+            notify();
+        }
+    } catch(const std::system_error&) {
+        failed = true;
+        drop();
+    }
+    out.clear();
+    pending = 0;
+    writer_done = true;
+    notify();
+}
+
+asio::awaitable<void> WebSocket::State::ping_loop() {
+    const auto interval = std::chrono::milliseconds(config.ping_interval);
+    for (; !finishing && !failed;) {
+        ping_timer.expires_after(interval);
+        asio::error_code err;
+        co_await ping_timer.async_wait(asio::redirect_error(asio::use_awaitable, err));
+        if (finishing || failed) {
+            break;
+        }
+        // a quiet peer is asked to prove it is still there
+        if (!close_sent && Clock::now() - last_received >= interval) {
+            enqueue(make_websocket_frame(WS_PING, {}));
+        }
+    }
+}
+
+void WebSocketGroup::join(WebSocket& socket) {
+    std::unique_lock lk(mutex_);
+    members_.push_back(socket.state_);
+}
+
+void WebSocketGroup::leave(WebSocket& socket) {
+    std::unique_lock lk(mutex_);
+    std::erase_if(members_, [&socket](const std::weak_ptr<WebSocket::State>& member) {
+        return !member.owner_before(socket.state_) && !socket.state_.owner_before(member);
+    });
+}
+
+size_t WebSocketGroup::broadcast(WebSocketOpcode opcode, std::string_view payload) {
+    return broadcast(make_websocket_frame(opcode, payload));
+}
+
+size_t WebSocketGroup::broadcast(WebSocketFrame frame) {
+    std::vector<std::shared_ptr<WebSocket::State>> targets;
+    {
+        std::unique_lock lk(mutex_);
+        targets.reserve(members_.size());
+        std::erase_if(members_, [&targets](const std::weak_ptr<WebSocket::State>& member) {
+            auto state = member.lock();
+            if (!state) {
+                return true;
+            }
+            targets.push_back(std::move(state));
+            return false;
+        });
+    }
+
+    for (auto& state : targets) {
+        asio::post(state->executor, [state, frame] {
+            state->post(frame);
+        });
+    }
+    return targets.size();
+}
+
+size_t WebSocketGroup::size() const {
+    std::unique_lock lk(mutex_);
+    return members_.size();
+}
+
+}
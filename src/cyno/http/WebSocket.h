@@ -0,0 +1,117 @@
+#ifndef CYNO_HTTP_WEBSOCKET_H_
+#define CYNO_HTTP_WEBSOCKET_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "asio/awaitable.hpp"
+#include "cyno/base/TimingWheel.h"
+#include "cyno/http/HttpMessage.h"
+#include "cyno/http/HttpStream.h"
+
+namespace cyno {
+
+// RFC 6455 section 5.2
+enum WebSocketOpcode : uint8_t {
+    WS_CONTINUATION = 0x0,
+    WS_TEXT = 0x1,
+    WS_BINARY = 0x2,
+    WS_CLOSE = 0x8,
+    WS_PING = 0x9,
+    WS_PONG = 0xa,
+};
+
+// A whole message, its fragments joined. payload points into the
+// connection buffer and is valid until the next receive().
+struct WebSocketMessage {
+    WebSocketOpcode opcode = WS_TEXT;
+    std::string_view payload;
+
+    bool is_text() const {
+        return opcode == WS_TEXT;
+    }
+};
+
+// A serialized frame. The same one can be queued on many connections,
+// server frames are never masked.
+using WebSocketFrame = std::shared_ptr<const std::string>;
+
+WebSocketFrame make_websocket_frame(WebSocketOpcode opcode, std::string_view payload);
+
+// The "101 Switching Protocols" answering req.
+// throw HttpRequestError if req is no version 13 WebSocket handshake
+std::string websocket_handshake(const HttpRequestView& req);
+
+// The server side of one WebSocket connection, after the handshake. Frames
+// are read into the connection buffer, unmasked and joined in place, so a
+// message costs no copy. What is sent goes through a queue that one writer
+// drains with gather writes. Must run on a strand.
+class WebSocket {
+public:
+    using Handler = std::function<asio::awaitable<void>(WebSocket&)>;
+    // the buffer moved, views into its first size bytes must follow
+    using OnMove = std::function<void(const char* from, const char* to, size_t size)>;
+
+    // buffer holds the request up to begin, then what was read after it.
+    // Limits and timeouts come from http_config.websocket_config.
+    // The stream, the wheel and the buffer must outlive the connection.
+    WebSocket(HttpStream& stream, TimingWheel& wheel, std::pmr::string& buffer, size_t begin, OnMove on_move);
+    ~WebSocket();
+
+    WebSocket(const WebSocket&) = delete;
+    WebSocket& operator=(const WebSocket&) = delete;
+
+    // Returns once handler did and the queue is sent, closing with 1000,
+    // or with 1011 if handler threw.
+    asio::awaitable<void> run(Handler handler);
+
+    // The next text or binary message. Pings are answered meanwhile.
+    // false once the connection is closed, the close handshake and
+    // protocol errors are taken care of.
+    // throw std::system_error
+    asio::awaitable<bool> receive(WebSocketMessage& message);
+
+    // Waits while more than max_pending_bytes are queued.
+    // throw std::system_error once the connection is closed
+    asio::awaitable<void> send(WebSocketOpcode opcode, std::string_view payload);
+    asio::awaitable<void> send(WebSocketFrame frame);
+
+    // queues the close frame, receive() goes on until the peer answers it
+    void close(uint16_t code = 1000, std::string_view reason = {});
+
+private:
+    friend class WebSocketGroup;
+
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+// Connections that get the same frames, e.g. every viewer of a dashboard.
+// A broadcast serializes its frame once and hands it to every member on
+// its own strand, so it can be called from any thread. Members that closed
+// drop out by themselves; a member whose queue is full is disconnected
+// rather than holding up the others.
+class WebSocketGroup {
+public:
+    void join(WebSocket& socket);
+    void leave(WebSocket& socket);
+
+    // returns the connections it was queued on
+    size_t broadcast(WebSocketOpcode opcode, std::string_view payload);
+    size_t broadcast(WebSocketFrame frame);
+
+    size_t size() const;
+
+private:
+    mutable std::mutex mutex_;
+    std::vector<std::weak_ptr<WebSocket::State>> members_;
+};
+
+}
+
+#endif
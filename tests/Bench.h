@@ -0,0 +1,109 @@
+#ifndef CYNO_TESTS_BENCH_H_
+#define CYNO_TESTS_BENCH_H_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace cyno::bench {
+
+// keeps the compiler from dropping a result nobody reads
+template<typename T>
+inline void do_not_optimize(const T& value) {
+#if defined(__GNUC__) || defined(__clang__)
+    asm volatile("" : : "r,m"(value) : "memory");
+#else
+    static const void* volatile sink;
+    sink = &value;
+    _ReadWriteBarrier();
+#endif
+}
+
+struct Result {
+    std::string name;
+    uint64_t iterations;
+    // over the samples
+    double median_ns;
+    double min_ns;
+    double max_ns;
+    // 0 if the case has no byte count
+    double bytes_per_op;
+};
+
+// Each case is calibrated until one sample takes min_time, then measured
+// samples times; the median is the number to track. CYNO_BENCH_TIME (ms)
+// and CYNO_BENCH_SAMPLES override the defaults. print() writes one JSON
+// document to stdout, so runs of two releases can be diffed by a script.
+class Suite {
+public:
+    explicit Suite(std::string name): name_(std::move(name)) {
+        if (auto env = std::getenv("CYNO_BENCH_TIME")) {
+            min_time_ = std::chrono::milliseconds(std::atoll(env));
+        }
+        if (auto env = std::getenv("CYNO_BENCH_SAMPLES")) {
+            samples_ = std::max(1, std::atoi(env));
+        }
+    }
+
+    // fn(n) runs the measured operation n times
+    template<typename Fn>
+    void run(std::string name, Fn fn, size_t bytes_per_op = 0) {
+        using Clock = std::chrono::steady_clock;
+        auto measure = [&](uint64_t n) {
+            auto begin = Clock::now();
+            fn(n);
+            return std::chrono::duration<double, std::nano>(Clock::now() - begin).count();
+        };
+
+        uint64_t n = 1;
+        for (double ns = measure(n); ns < std::chrono::duration<double, std::nano>(min_time_).count();) {
+            // aim a little past min_time, at most 100x more at a time
+            double factor = ns > 0 ? std::chrono::duration<double, std::nano>(min_time_).count() * 1.2 / ns : 100;
+            n = std::max<uint64_t>(n + 1, static_cast<uint64_t>(n * std::min(factor, 100.0)));
+            ns = measure(n);
+        }
+
+        std::vector<double> per_op;
+        for (int i = 0; i < samples_; ++i) {
+            per_op.push_back(measure(n) / n);
+        }
+        std::sort(per_op.begin(), per_op.end());
+        results_.push_back({std::move(name), n, per_op[per_op.size() / 2],
+            per_op.front(), per_op.back(), static_cast<double>(bytes_per_op)});
+        std::fprintf(stderr, "%-48s %12.1f ns/op\n", results_.back().name.c_str(), results_.back().median_ns);
+    }
+
+    void print() const {
+        std::printf("{\n  \"suite\": \"%s\",\n  \"samples\": %d,\n  \"results\": [", name_.c_str(), samples_);
+        for (size_t i = 0; i < results_.size(); ++i) {
+            auto& res = results_[i];
+            std::printf("%s\n    {\"name\": \"%s\", \"iterations\": %llu, \"ns_per_op\": %.2f, "
+                "\"min_ns_per_op\": %.2f, \"max_ns_per_op\": %.2f, \"ops_per_sec\": %.0f",
+                i == 0 ? "" : ",", res.name.c_str(), static_cast<unsigned long long>(res.iterations),
+                res.median_ns, res.min_ns, res.max_ns, 1e9 / res.median_ns);
+            if (res.bytes_per_op > 0) {
+                std::printf(", \"mb_per_sec\": %.1f", res.bytes_per_op * 1e3 / res.median_ns);
+            }
+            std::printf("}");
+        }
+        std::printf("\n  ]\n}\n");
+    }
+
+private:
+    std::string name_;
+    std::chrono::nanoseconds min_time_ = std::chrono::milliseconds(200);
+    int samples_ = 5;
+    std::vector<Result> results_;
+};
+
+}
+
+#endif
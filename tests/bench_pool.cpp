@@ -0,0 +1,89 @@
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "asio/co_spawn.hpp"
+#include "asio/detached.hpp"
+#include "asio/io_context.hpp"
+#include "Bench.h"
+#include "cyno/base/ResourcePool.h"
+
+using namespace std;
+using namespace cyno;
+
+// n borrow/return pairs spread over one coroutine per thread, the context
+// run by that many threads. Returns once every coroutine is done.
+static void borrow_loop(asio::io_context& context, ResourcePool<string>& pool, size_t threads, uint64_t n) {
+    atomic<size_t> running = threads;
+    for (size_t t = 0; t < threads; ++t) {
+        uint64_t share = n / threads + (t < n % threads ? 1 : 0);
+        asio::co_spawn(context, [&pool, &running, &context, share]() -> asio::awaitable<void> {
+            for (uint64_t i = 0; i < share; ++i) {
+                auto item = co_await pool.borrow();
+                bench::do_not_optimize(item->data());
+            }
+            if (running.fetch_sub(1) == 1) {
+                // the pool's cleanup timer would keep run() going
+                context.stop();
+            }
+        }, asio::detached);
+    }
+
+    vector<thread> workers;
+    for (size_t t = 1; t < threads; ++t) {
+        workers.emplace_back([&context] { context.run(); });
+    }
+    context.run();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    context.restart();
+}
+
+int main() {
+    bench::Suite suite("pool");
+
+    size_t cores = max(1u, thread::hardware_concurrency());
+    vector<size_t> thread_counts = {1};
+    for (size_t t = 2; t <= min<size_t>(cores, 16); t *= 2) {
+        thread_counts.push_back(t);
+    }
+
+    for (size_t threads : thread_counts) {
+        asio::io_context context(static_cast<int>(threads));
+        PoolConfig config{
+            .core_idle_size = 64,
+            .max_idle_size = 256,
+            .max_active_size = 1024,
+            .max_idle_time = 1000 * 60,
+            .wait_timeout = 1000 * 15,
+        };
+        ResourcePool<string> pool(context.get_executor(), config, [] { return string(4096, '\0'); });
+
+        string name = threads == 1 ? "borrow/uncontended" : "borrow/contended_" + to_string(threads) + "_threads";
+        suite.run(name, [&](uint64_t n) {
+            borrow_loop(context, pool, threads, n);
+        });
+    }
+
+    // fewer items than borrowers: returns hand items to queued waiters
+    if (cores > 1) {
+        size_t threads = min<size_t>(cores, 8);
+        asio::io_context context(static_cast<int>(threads));
+        PoolConfig config{
+            .core_idle_size = 1,
+            .max_idle_size = 1,
+            .max_active_size = 1,
+            .max_idle_time = 1000 * 60,
+            .wait_timeout = 1000 * 15,
+        };
+        ResourcePool<string> pool(context.get_executor(), config, [] { return string(4096, '\0'); });
+
+        suite.run("borrow/exhausted_" + to_string(threads) + "_threads", [&](uint64_t n) {
+            borrow_loop(context, pool, threads, n);
+        });
+    }
+
+    suite.print();
+}
@@ -0,0 +1,166 @@
+#include <string>
+#include <vector>
+#include "Bench.h"
+#include "cyno/http/HttpRouter.h"
+#include "cyno/http/RouteTable.h"
+
+using namespace std;
+using namespace cyno;
+
+// A route table shaped like a REST API: static routes, ":id" captures and
+// "*" prefixes in equal parts. urls gets one request path per route.
+static HttpRouter make_router(size_t count, vector<string>& urls) {
+    HttpRouter router;
+    HttpRouter::HttpHandler handler = [](HttpRequestView&, HttpResponse&) { return 200; };
+    for (size_t i = 0; i < count; ++i) {
+        string n = to_string(i);
+        switch (i % 3) {
+        case 0:
+            router.Get("/api/v1/resource" + n + "/list", handler);
+            urls.push_back("/api/v1/resource" + n + "/list");
+            break;
+        case 1:
+            router.Get("/api/v1/resource" + n + "/:id/detail", handler);
+            urls.push_back("/api/v1/resource" + n + "/12345/detail?verbose=1");
+            break;
+        case 2:
+            router.Get("/static/bundle" + n + "/*", handler);
+            urls.push_back("/static/bundle" + n + "/js/vendor/app.min.js");
+            break;
+        }
+    }
+    return router;
+}
+
+static int bench_handler(HttpRequestView&, HttpResponse&) {
+    return 200;
+}
+
+// the path make_router gives route I, as a template argument
+template<size_t I>
+constexpr auto bench_route_path() {
+    constexpr string_view head = I % 3 == 2 ? "/static/bundle" : "/api/v1/resource";
+    constexpr string_view tail = I % 3 == 0 ? "/list" : I % 3 == 1 ? "/:id/detail" : "/*";
+    constexpr size_t digits = [] {
+        size_t res = 1;
+        for (size_t n = I; n >= 10; n /= 10, ++res);
+        return res;
+    }();
+
+    char str[head.size() + digits + tail.size() + 1] {};
+    copy(head.begin(), head.end(), str);
+    for (size_t n = I, i = head.size() + digits; i-- > head.size(); n /= 10) {
+        str[i] = static_cast<char>('0' + n % 10);
+    }
+    copy(tail.begin(), tail.end(), str + head.size() + digits);
+    return RoutePath(str);
+}
+
+template<size_t... I>
+RouteTable<TableRoute<HTTP_GET, bench_route_path<I>(), bench_handler>...> make_bench_table(index_sequence<I...>) {
+    return {};
+}
+
+// the routes of make_router(Count) as a RouteTable
+template<size_t Count>
+using BenchTable = decltype(make_bench_table(make_index_sequence<Count>()));
+
+// a small service, the same routes as a RouteTable and as runtime routes
+using ServiceTable = RouteTable<
+    TableRoute<HTTP_GET, "/health", bench_handler>,
+    TableRoute<HTTP_GET, "/users", bench_handler>,
+    TableRoute<HTTP_POST, "/users", bench_handler>,
+    TableRoute<HTTP_GET, "/users/me", bench_handler>,
+    TableRoute<HTTP_GET, "/users/:id", bench_handler>,
+    TableRoute<HTTP_GET, "/users/:id/orders/:order", bench_handler>,
+    TableRoute<HTTP_GET, "/static/*", bench_handler>>;
+
+static HttpRouter make_service_router() {
+    HttpRouter router;
+    HttpRouter::HttpHandler handler = bench_handler;
+    router.Get("/health", handler);
+    router.Get("/users", handler);
+    router.Post("/users", handler);
+    router.Get("/users/me", handler);
+    router.Get("/users/:id", handler);
+    router.Get("/users/:id/orders/:order", handler);
+    router.Get("/static/*", handler);
+    return router;
+}
+
+// the routes of make_router(Count) as a RouteTable and as runtime routes,
+// every url in turn
+template<size_t Count>
+static void bench_table(bench::Suite& suite) {
+    vector<string> urls;
+    HttpRouter tree_router = make_router(Count, urls);
+    HttpRouter table_router;
+    table_router.table(BenchTable<Count>{});
+    PathParams params;
+
+    for (auto [name, router] : {pair{"table", &table_router}, pair{"tree", &tree_router}}) {
+        suite.run("find/" + to_string(Count) + "_routes/" + name, [&](uint64_t iterations) {
+            size_t next = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                bench::do_not_optimize(router->find(HTTP_GET, urls[next], params));
+                next = next + 1 == urls.size() ? 0 : next + 1;
+            }
+        });
+    }
+}
+
+int main() {
+    bench::Suite suite("router");
+
+    for (size_t count : {10, 100, 1000}) {
+        vector<string> urls;
+        HttpRouter router = make_router(count, urls);
+        PathParams params;
+        string n = to_string(count);
+
+        // every route in turn, so the table does not sit in one cache line
+        suite.run("match/" + n + "_routes", [&](uint64_t iterations) {
+            size_t next = 0;
+            for (uint64_t i = 0; i < iterations; ++i) {
+                bench::do_not_optimize(&router.match(HTTP_GET, urls[next], params));
+                next = next + 1 == urls.size() ? 0 : next + 1;
+            }
+        });
+
+        suite.run("match/" + n + "_routes_hot", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                bench::do_not_optimize(&router.match(HTTP_GET, urls[1], params));
+            }
+        });
+
+        // find() is what the server calls, a miss walks as far as it can
+        suite.run("find_miss/" + n + "_routes", [&](uint64_t iterations) {
+            for (uint64_t i = 0; i < iterations; ++i) {
+                bench::do_not_optimize(router.find(HTTP_GET, "/api/v1/resource1/12345/missing", params));
+            }
+        });
+    }
+
+    bench_table<100>(suite);
+    bench_table<1000>(suite);
+
+    {
+        HttpRouter table_router;
+        table_router.table(ServiceTable{});
+        HttpRouter tree_router = make_service_router();
+        PathParams params;
+        const char* urls[] = {"/health", "/users/me", "/users/42", "/users/42/orders/7", "/static/js/app.js"};
+
+        for (auto [name, router] : {pair{"table", &table_router}, pair{"tree", &tree_router}}) {
+            suite.run(string("find_service/") + name, [&](uint64_t iterations) {
+                size_t next = 0;
+                for (uint64_t i = 0; i < iterations; ++i) {
+                    bench::do_not_optimize(router->find(HTTP_GET, urls[next], params));
+                    next = next + 1 == size(urls) ? 0 : next + 1;
+                }
+            });
+        }
+    }
+
+    suite.print();
+}
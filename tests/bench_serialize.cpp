@@ -0,0 +1,115 @@
+#include <string>
+#include "Bench.h"
+#include "cyno/http/HttpParser.h"
+
+using namespace std;
+using namespace cyno;
+
+// a JSON API response with the headers a typical handler sets
+static HttpResponse make_response(size_t body_size) {
+    HttpResponse resp = HttpResponse::from_default();
+    resp.status_code = HTTP_STATUS_OK;
+    resp.status = "OK";
+    resp.headers[HttpField::ContentType] = "application/json";
+    resp.headers[HttpField::CacheControl] = "private, max-age=60";
+    resp.headers[HttpField::ETag] = "\"5d41402abc4b2a76\"";
+    resp.headers["X-Request-Id"] = "0f8fad5b-d9cb-469f-a165-70867728950e";
+    resp.body.assign(body_size, 'x');
+    resp.headers[HttpField::ContentLength] = to_string(body_size);
+    return resp;
+}
+
+int main() {
+    bench::Suite suite("serialize");
+
+    for (size_t body_size : {0, 1024, 16 * 1024}) {
+        HttpResponse resp = make_response(body_size);
+        string name = to_string(body_size) + "_byte_body";
+        suite.run("serialize_response/" + name, [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                bench::do_not_optimize(serialize_response(resp));
+            }
+        }, serialize_response(resp).size());
+    }
+
+    // what the server does: the head into a reused string, the body gathered
+    {
+        HttpResponse resp = make_response(1024);
+        string head;
+        suite.run("serialize_response_head/reused_buffer", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                bench::do_not_optimize(serialize_response_head(resp, head));
+                bench::do_not_optimize(head);
+            }
+        });
+    }
+
+    // what a handler sets on the connection's response, once from the heap
+    // and once from an arena released after every response like the server's
+    {
+        auto build = [](HttpResponse& resp) {
+            resp.reset();
+            resp.headers[HttpField::ContentType] = "application/json";
+            resp.headers[HttpField::CacheControl] = "private, max-age=60";
+            resp.headers[HttpField::ETag] = "\"5d41402abc4b2a76\"";
+            resp.headers["X-Request-Id"] = "0f8fad5b-d9cb-469f-a165-70867728950e";
+            bench::do_not_optimize(resp.headers);
+        };
+
+        HttpResponse resp;
+        suite.run("build_response/heap", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                build(resp);
+            }
+        });
+
+        vector<std::byte> buffer(4096);
+        std::pmr::monotonic_buffer_resource arena(buffer.data(), buffer.size());
+        HttpResponse arena_resp(&arena);
+        suite.run("build_response/arena", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                build(arena_resp);
+                arena_resp.headers.clear();
+                arena.release();
+            }
+        });
+    }
+
+    for (auto [name, url] : {
+        pair<string_view, string_view>{"root", "/"},
+        {"path", "/api/v1/users/42/posts"},
+        {"path_query", "/api/v1/users/42/posts?limit=10&offset=20&sort=desc&fields=id,title,created_at"},
+        {"encoded_query_fragment", "/search?q=hello%20world&lang=en&page=3#results"},
+    }) {
+        // reused like a connection's request, every segment and field read
+        HttpUrlPath path;
+        HttpUrlQuery query;
+        suite.run("parse_url/" + string(name), [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                auto [raw_path, raw_query] = split_url_target(url);
+                path.assign(raw_path);
+                query.assign(raw_query);
+                bench::do_not_optimize(path.size());
+                bench::do_not_optimize(query.size());
+            }
+        }, url.size());
+    }
+
+    // what a handler that never reads the query pays
+    {
+        string_view url = "/api/v1/users/42/posts?limit=10&offset=20&sort=desc&fields=id,title,created_at";
+        HttpUrlPath path;
+        HttpUrlQuery query;
+        suite.run("parse_url/path_query_unread", [&](uint64_t n) {
+            for (uint64_t i = 0; i < n; ++i) {
+                auto [raw_path, raw_query] = split_url_target(url);
+                path.assign(raw_path);
+                query.assign(raw_query);
+                bench::do_not_optimize(path);
+                bench::do_not_optimize(query);
+            }
+        }, url.size());
+    }
+
+    suite.print();
+}
@@ -0,0 +1,147 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <thread>
+#include "asio/connect.hpp"
+#include "asio/read.hpp"
+#include "asio/write.hpp"
+#include "cyno/base/Exceptions.h"
+#include "cyno/http/HttpResponseWriter.h"
+#include "cyno/http/HttpRouter.h"
+#include "cyno/http/HttpServer.h"
+
+using namespace std;
+using namespace cyno;
+
+// Self-checking, servers listen on 127.0.0.1 only. The process exits with the
+// number of failed checks, so a test runner only has to look at the status.
+
+static int failures = 0;
+
+#define CHECK(cond)                                                            \
+    do {                                                                       \
+        if (!(cond)) {                                                         \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            ++failures;                                                        \
+        }                                                                      \
+    } while (0)
+
+// runs the GET route for url, -1 if it throws NotMatchPathError
+static int call_route(const HttpRouter& router, string_view url, HttpResponse& resp) {
+    HttpRequestView req;
+    req.method = HTTP_GET;
+    req.url = url;
+    auto route = router.find(HTTP_GET, url, req.params);
+    if (!route) {
+        return -1;
+    }
+    try {
+        return get<HttpRouter::HttpHandler>(*route)(req, resp);
+    } catch (const NotMatchPathError&) {
+        return -1;
+    }
+}
+
+static void test_static_encoded_paths() {
+    auto dir = filesystem::temp_directory_path() / "cyno_test_static";
+    filesystem::remove_all(dir);
+    filesystem::create_directories(dir / "public");
+    ofstream(dir / "public" / "a b.txt") << "spaced";
+    ofstream(dir / "secret.txt") << "secret";
+
+    HttpRouter router;
+    router.Static("/files", (dir / "public").string());
+
+    auto resp = HttpResponse::from_default();
+    CHECK(call_route(router, "/files/a%20b.txt", resp) == HTTP_STATUS_OK);
+    CHECK(resp.file && resp.file->length == 6);
+
+    // "%2e%2e" decodes to "..", after the router has matched the capture
+    resp = HttpResponse::from_default();
+    CHECK(call_route(router, "/files/%2e%2e/secret.txt", resp) == -1);
+    CHECK(!resp.file);
+    CHECK(call_route(router, "/files/%2E%2E%2Fsecret.txt", resp) == -1);
+    CHECK(call_route(router, "/files/a%00b.txt", resp) == -1);
+
+    filesystem::remove_all(dir);
+}
+
+static void test_cache_missing_route() {
+    HttpRouter router;
+    HttpRouter::HttpHandler handler = [](HttpRequestView&, HttpResponse&) { return 200; };
+    router.Get("/users", handler);
+
+    // a failed cache() must not leave a ":uid" capture behind
+    bool thrown = false;
+    try {
+        router.cache("/users/:uid", 1000);
+    } catch (const IllegalRouteError&) {
+        thrown = true;
+    }
+    CHECK(thrown);
+    router.Get("/users/:id", handler);
+    router.cache("/users/:id", 1000);
+
+    PathParams params;
+    auto route = router.find(HTTP_GET, "/users/42", params);
+    CHECK(route && params["id"] == "42");
+    CHECK(router.cache_ttl(route) == 1000);
+    CHECK(router.cache_ttl(router.find(HTTP_GET, "/users", params)) == 0);
+}
+
+// a free port at the time of the call
+static unsigned free_port() {
+    asio::io_context ctx;
+    asio::ip::tcp::acceptor acceptor(ctx, {asio::ip::make_address("127.0.0.1"), 0});
+    return acceptor.local_endpoint().port();
+}
+
+// sends request on a fresh connection, everything up to the close comes back
+static string round_trip(unsigned port, string_view request) {
+    asio::io_context ctx;
+    asio::ip::tcp::socket socket(ctx);
+    socket.connect({asio::ip::make_address("127.0.0.1"), static_cast<unsigned short>(port)});
+    asio::write(socket, asio::buffer(request));
+    string out;
+    asio::error_code err;
+    asio::read(socket, asio::dynamic_buffer(out), err);
+    return out;
+}
+
+static void test_chunked_close_head() {
+    HttpRouter router;
+    router.Get("/chunks", [](HttpRequestView&, HttpResponseWriter& writer) -> asio::awaitable<void> {
+        co_await writer.write("hello");
+    });
+
+    asio::io_context ctx;
+    unsigned port = free_port();
+    HttpServer server(ctx.get_executor());
+    server.routes(std::move(router));
+    server.bind("127.0.0.1", port);
+    server.start();
+    thread loop([&ctx] { ctx.run(); });
+
+    // the head is written with the first chunk, it has to say close already
+    auto out = round_trip(port, "GET /chunks HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+    auto head = out.substr(0, out.find("\r\n\r\n"));
+    CHECK(head.starts_with("HTTP/1.1 200"));
+    CHECK(head.find("Connection: close") != string::npos);
+    CHECK(head.find("keep-alive") == string::npos);
+    CHECK(out.ends_with("5\r\nhello\r\n0\r\n\r\n"));
+
+    server.stop();
+    ctx.stop();
+    loop.join();
+}
+
+int main() {
+    test_static_encoded_paths();
+    test_cache_missing_route();
+    test_chunked_close_head();
+    if (failures) {
+        fprintf(stderr, "%d checks failed\n", failures);
+    }
+    return failures;
+}
@@ -3,6 +3,18 @@ set_version("0.0.1")
 
 add_rules("mode.debug", "mode.release")
 add_requires("asio", "http_parser", "spdlog", "fmt")
+
+option("ssl")
+    set_default(false)
+    set_showmenu(true)
+    set_description("TLS for HttpServer and HttpClient, needs openssl")
+    add_defines("CYNO_ENABLE_SSL")
+option_end()
+
+if has_config("ssl") then
+    add_requires("openssl")
+end
+
 add_cxxflags("/EHa", "/EHs")
 set_languages("cxx20")
 set_warnings("all")
@@ -20,6 +32,12 @@ target("cyno")
     add_includedirs("src", {public = true})
     add_defines("ASIO_HAS_CO_AWAIT")
     add_packages("asio", "http_parser", "spdlog")
+    add_options("ssl")
+    if has_config("ssl") then
+        add_packages("openssl")
+        -- the TLS api of the headers, for every target that uses the library
+        add_defines("CYNO_ENABLE_SSL", {public = true})
+    end
 
 --examples
 for _, dir in ipairs(os.files("examples/*.cpp")) do
@@ -29,6 +47,10 @@ for _, dir in ipairs(os.files("examples/*.cpp")) do
         add_deps("cyno")
         add_defines("ASIO_HAS_CO_AWAIT")
         add_packages("asio", "http_parser", "spdlog")
+        add_options("ssl")
+        if has_config("ssl") then
+            add_packages("openssl")
+        end
 end
 
 --tests
@@ -40,4 +62,8 @@ for _, dir in ipairs(os.files("tests/*.cpp")) do
         add_deps("cyno")
         add_defines("ASIO_HAS_CO_AWAIT")
         add_packages("asio", "http_parser", "spdlog")
+        add_options("ssl")
+        if has_config("ssl") then
+            add_packages("openssl")
+        end
 end